@@ -31,6 +31,8 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
+#include "ngx_http_cache_purge.h"
+#include "ngx_http_cache_purge_index.h"
 
 
 #ifndef nginx_version
@@ -40,13 +42,61 @@
 
 #if (NGX_HTTP_CACHE)
 
+/* cache nodes handled under a single lock of the cache zone */
+#define NGX_HTTP_CACHE_PURGE_BATCH    64
+
+#define NGX_HTTP_CACHE_PURGE_MISSING  0
+#define NGX_HTTP_CACHE_PURGE_PROBE    1
+#define NGX_HTTP_CACHE_PURGE_RETIRED  2
+
+/* one second ticks of the scheduled purges timer wheel */
+#define NGX_HTTP_CACHE_PURGE_WHEEL    1024
+
+/* sharded purges are checked for completion this often, in ms */
+#define NGX_HTTP_CACHE_PURGE_POLL     100
+
+#define NGX_HTTP_CACHE_PURGE_SHARD_FREE     0
+#define NGX_HTTP_CACHE_PURGE_SHARD_CLAIMED  1
+#define NGX_HTTP_CACHE_PURGE_SHARD_DONE     2
+
+/*
+ * shards without progress for this long, in seconds, are taken over
+ * from their worker process, and sharded purges nobody waits for anymore
+ * are dropped
+ */
+#define NGX_HTTP_CACHE_PURGE_SHARD_TIMEOUT  10
+
+/* keys of an index matched between checks for other events */
+#define NGX_HTTP_CACHE_PURGE_MATCH    4096
+
+/* snapshot of keys kept in the purge zone, with the key index header */
+#define NGX_HTTP_CACHE_PURGE_SNAPSHOT_MAGIC    "NGXCPSNP"
+#define NGX_HTTP_CACHE_PURGE_SNAPSHOT_VERSION  1
+
+/* a snapshot still being written after this long, in seconds, is redone */
+#define NGX_HTTP_CACHE_PURGE_SNAPSHOT_TIMEOUT  60
+
+/* trees checked against cache zones after a snapshot is loaded */
+#define NGX_HTTP_CACHE_PURGE_RECONCILE_ERRORS     1
+#define NGX_HTTP_CACHE_PURGE_RECONCILE_PRIMARIES  2
+
+/* longest key accepted by bulk purges */
+#define NGX_HTTP_CACHE_PURGE_LINE     4096
+
 typedef struct {
     ngx_flag_t                    enable;
     ngx_str_t                     method;
     ngx_array_t                  *access;   /* array of ngx_in_cidr_t */
     ngx_array_t                  *access6;  /* array of ngx_in6_cidr_t */
+    ngx_flag_t                    unsafe;
 } ngx_http_cache_purge_conf_t;
 
+/* steps following purges of entries, kept with purges done later */
+typedef struct {
+    ngx_msec_t                    retain;  /* for coalescing and fencing */
+    ngx_flag_t                    vary;    /* variants are purged too */
+} ngx_http_cache_purge_post_t;
+
 typedef struct {
 # if (NGX_HTTP_FASTCGI)
     ngx_http_cache_purge_conf_t   fastcgi;
@@ -64,8 +114,352 @@ typedef struct {
     ngx_http_cache_purge_conf_t  *conf;
     ngx_http_handler_pt           handler;
     ngx_http_handler_pt           original_handler;
+
+    ngx_msec_t                    coalesce;
+    ngx_msec_t                    fence;
+
+    ngx_flag_t                    rewarm;
+    ngx_http_complex_value_t     *rewarm_uri;
+    ngx_uint_t                    rewarm_min_uses;
+    ngx_uint_t                    rewarm_concurrency;
+
+    ngx_flag_t                    vary;
+    ngx_flag_t                    conditional;
+    ngx_flag_t                    track_errors;
+
+    ngx_http_cache_purge_post_t   post;
+
+    size_t                        slice;
+    ngx_http_complex_value_t     *slice_length;
+    ngx_uint_t                    slice_max;
+
+    ngx_http_complex_value_t     *schedule;
+    time_t                        schedule_jitter;
+
+    ngx_uint_t                    shards;
+    ngx_uint_t                    rate;    /* entries per second */
+    time_t                        rate_jitter;
+
+    ngx_str_t                     invalidate;
+    uint32_t                      invalidate_cache;
+
+    ngx_str_t                     bulk;    /* cache zone name */
+    ngx_str_t                     inspect; /* method */
+    ngx_str_t                     export;  /* cache zone name */
+    ngx_str_t                     evict;   /* cache zone name */
+    ngx_str_t                     filter;  /* cache zone name */
+    ngx_str_t                     errors;  /* cache zone name */
+
+    ngx_str_t                     regex;   /* cache zone name */
+    ngx_str_t                     regex_index;
 } ngx_http_cache_purge_loc_conf_t;
 
+/* response written in pieces, with buffers reused once sent */
+typedef struct {
+    ngx_buf_t                    *buf;
+    ngx_chain_t                  *out;
+    ngx_chain_t                 **last_out;
+    ngx_chain_t                  *free;
+    ngx_chain_t                  *busy;
+} ngx_http_cache_purge_stream_t;
+
+#  if (nginx_version >= 1007011)
+
+typedef struct {
+    uint32_t                      cache;
+    ngx_pool_t                   *pool;    /* reset after each batch */
+
+    ngx_uint_t                    keys;
+    ngx_uint_t                    purged;
+    ngx_uint_t                    errors;
+
+    ngx_uint_t                    n;       /* keys in the current batch */
+    u_char                        hashes[NGX_HTTP_CACHE_PURGE_BATCH
+                                         * NGX_HTTP_CACHE_KEY_LEN];
+    u_char                        states[NGX_HTTP_CACHE_PURGE_BATCH];
+    u_char                       *results[NGX_HTTP_CACHE_PURGE_BATCH];
+
+    size_t                        len;     /* of a line split between bufs */
+    ngx_flag_t                    skip;    /* rest of a too long line */
+    u_char                        line[NGX_HTTP_CACHE_PURGE_LINE];
+
+    ngx_http_cache_purge_stream_t stream;
+} ngx_http_cache_purge_bulk_t;
+
+#  endif /* nginx_version >= 1007011 */
+
+typedef struct {
+    u_char                        key[NGX_HTTP_CACHE_KEY_LEN];
+    off_t                         fs_size;
+    time_t                        valid_sec;
+    ngx_uint_t                    uses;
+} ngx_http_cache_purge_entry_t;
+
+typedef struct {
+    uint32_t                      cache;
+    ngx_uint_t                    limit;   /* entries, 0 is unlimited */
+    ngx_uint_t                    entries;
+
+    ngx_flag_t                    started; /* cursor is set */
+    u_char                        cursor[NGX_HTTP_CACHE_KEY_LEN];
+
+    ngx_http_cache_purge_entry_t  page[NGX_HTTP_CACHE_PURGE_BATCH];
+
+    ngx_http_cache_purge_stream_t stream;
+} ngx_http_cache_purge_export_t;
+
+/* key index of a cache directory, see ngx_http_cache_purge_index.h */
+typedef struct {
+    ngx_http_cache_purge_index_header_t  *header;
+    ngx_http_cache_purge_index_entry_t   *entries;
+    u_char                               *keys;
+
+    u_char                               *addr;
+    size_t                                size;
+} ngx_http_cache_purge_index_t;
+
+/* error (with status) or variant (with primary key) of a snapshot */
+typedef struct {
+    uint32_t                      cache;
+    uint16_t                      status;
+    uint16_t                      reserved;
+    u_char                        key[NGX_HTTP_CACHE_KEY_LEN];
+    u_char                        primary[NGX_HTTP_CACHE_KEY_LEN];
+} ngx_http_cache_purge_record_t;
+
+/* snapshot being collected, a batch of records per lock of the zone */
+typedef struct {
+    ngx_array_t                  *records;
+    ngx_uint_t                    tree;    /* walked, as for reconcile */
+    ngx_uint_t                    started; /* cursor is set */
+    uint32_t                      cache;
+    u_char                        key[NGX_HTTP_CACHE_KEY_LEN];
+} ngx_http_cache_purge_snapshot_t;
+
+/* filters of cache_purge_filter, all given have to match */
+typedef struct {
+    off_t                         min_size;
+    off_t                         max_size;
+    time_t                        stale;   /* valid until before */
+    time_t                        idle;    /* expires before */
+    size_t                        min_header;
+} ngx_http_cache_purge_filter_t;
+
+typedef struct ngx_http_cache_purge_sweep_s  ngx_http_cache_purge_sweep_t;
+
+typedef ngx_int_t (*ngx_http_cache_purge_batch_pt)(
+    ngx_http_file_cache_t *cache, ngx_http_cache_purge_sweep_t *sw,
+    ngx_uint_t max, ngx_log_t *log);
+
+/* purge of a whole cache zone, done in batches */
+struct ngx_http_cache_purge_sweep_s {
+    uint32_t                      cache;
+    ngx_http_file_cache_t        *file_cache;
+    ngx_str_t                     name;    /* of cache files */
+    ngx_http_cache_purge_batch_pt batch;
+
+    off_t                         target;  /* bytes to evict */
+
+    ngx_http_cache_purge_filter_t filter;
+    ngx_rbtree_key_t              first;   /* range of node keys walked */
+    ngx_rbtree_key_t              last;
+
+    ngx_uint_t                    status_min;
+    ngx_uint_t                    status_max;
+
+    ngx_http_cache_purge_index_t *index;
+#  if (NGX_PCRE)
+    ngx_regex_t                  *regex;
+#  endif
+    ngx_flag_t                    dry_run; /* only count matches */
+
+    /* matches are queued at the rate of the location, if any */
+    ngx_http_cache_purge_loc_conf_t  *rated;
+
+    ngx_flag_t                    started; /* cursor is set */
+    u_char                        cursor[NGX_HTTP_CACHE_KEY_LEN];
+    uint32_t                      cursor_cache;
+    ngx_uint_t                    scanned;
+
+    off_t                         freed;
+    ngx_uint_t                    entries;
+
+    u_char                        keys[NGX_HTTP_CACHE_PURGE_BATCH
+                                       * NGX_HTTP_CACHE_KEY_LEN];
+};
+
+typedef struct {
+    ngx_pid_t                     pid;     /* of the worker walking it */
+    time_t                        alive;   /* of the last progress */
+    ngx_uint_t                    state;
+} ngx_http_cache_purge_claim_t;
+
+/* filter purge walked by all workers, in shards of node key ranges */
+typedef struct {
+    ngx_queue_t                   queue;
+    ngx_uint_t                    id;
+    uint32_t                      cache;
+    ngx_http_cache_purge_filter_t filter;
+
+    ngx_uint_t                    shards;
+    ngx_uint_t                    free;    /* shards not claimed */
+    ngx_uint_t                    active;  /* shards being walked */
+
+    ngx_uint_t                    scanned;
+    ngx_uint_t                    entries;
+    off_t                         freed;
+
+    time_t                        alive;   /* of the request waiting */
+    unsigned                      abandoned:1;
+
+    ngx_http_cache_purge_claim_t  claims[1];
+} ngx_http_cache_purge_shared_t;
+
+typedef struct {
+#  if (nginx_version >= 1007011)
+    ngx_http_cache_purge_bulk_t  *bulk;
+#  endif
+    ngx_http_cache_purge_export_t *export;
+    ngx_http_cache_purge_sweep_t *sweep;
+    ngx_http_cache_purge_shared_t *shared;
+    ngx_atomic_uint_t             sequence; /* of purges before the request */
+    unsigned                      sequenced:1;
+    unsigned                      rewarm:1;
+    unsigned                      done:1;
+    unsigned                      stored:1;
+    unsigned                      admitted:1;
+} ngx_http_cache_purge_ctx_t;
+
+typedef struct {
+    ngx_rbtree_node_t             node;
+    ngx_queue_t                   queue;
+    uint32_t                      cache;   /* crc32 of cache zone name */
+    u_char                        key[NGX_HTTP_CACHE_KEY_LEN];
+} ngx_http_cache_purge_node_t;
+
+typedef struct {
+    ngx_http_cache_purge_node_t   sn;
+    ngx_msec_t                    purged;
+    ngx_msec_t                    expire;
+    ngx_atomic_uint_t             sequence;
+    ngx_int_t                     rc;      /* NGX_OK or NGX_DECLINED */
+} ngx_http_cache_purge_recent_t;
+
+typedef struct {
+    ngx_http_cache_purge_node_t   sn;
+    ngx_queue_t                   variants;
+} ngx_http_cache_purge_primary_t;
+
+typedef struct {
+    ngx_queue_t                   queue;
+    u_char                        key[NGX_HTTP_CACHE_KEY_LEN];
+} ngx_http_cache_purge_variant_t;
+
+typedef struct {
+    ngx_http_cache_purge_node_t   sn;
+    u_short                       status;  /* of the stored response */
+} ngx_http_cache_purge_error_t;
+
+typedef struct {
+    ngx_queue_t                   queue;
+    time_t                        due;
+    uint32_t                      cache;
+    ngx_http_cache_purge_post_t   post;
+    u_char                        key[NGX_HTTP_CACHE_KEY_LEN];
+} ngx_http_cache_purge_job_t;
+
+/* budgets of a cache zone, for cache_purge_io and cache_purge_rate */
+typedef struct {
+    ngx_queue_t                   queue;
+    uint32_t                      cache;
+    ngx_msec_t                    last;
+    ngx_uint_t                    excess;  /* in 1/1000 of operation */
+    time_t                        rate_due;    /* last second queued to */
+    ngx_uint_t                    rate_queued; /* purges due then */
+} ngx_http_cache_purge_bucket_t;
+
+typedef struct {
+    ngx_rbtree_t                  rbtree;
+    ngx_rbtree_node_t             sentinel;
+    ngx_queue_t                   queue;   /* recently purged keys, LRU */
+    ngx_atomic_t                  sequence;  /* of the last one */
+
+    ngx_rbtree_t                  primaries;
+    ngx_rbtree_node_t             primaries_sentinel;
+    ngx_queue_t                   primaries_queue;
+
+    ngx_rbtree_t                  errors;  /* cached error responses */
+    ngx_rbtree_node_t             errors_sentinel;
+    ngx_queue_t                   errors_queue;
+
+    ngx_queue_t                   shared;  /* sharded purges */
+    ngx_uint_t                    shared_id;
+
+    uint64_t                      generation;  /* of the last snapshot */
+    time_t                        snapshot_last;
+    ngx_pid_t                     snapshot_pid;  /* of the one writing */
+
+    ngx_uint_t                    reconcile;   /* tree left to check */
+    ngx_uint_t                    reconcile_started;
+    uint32_t                      reconcile_cache;
+    u_char                        reconcile_key[NGX_HTTP_CACHE_KEY_LEN];
+
+    time_t                        wheel_last;
+    ngx_uint_t                    scheduled;
+    ngx_queue_t                   wheel[NGX_HTTP_CACHE_PURGE_WHEEL];
+
+    ngx_queue_t                   buckets; /* disk operations per cache */
+
+    ngx_atomic_t                  ingest_keys;
+    ngx_atomic_t                  ingest_purged;
+    ngx_atomic_t                  ingest_errors;
+} ngx_http_cache_purge_shctx_t;
+
+typedef struct {
+    ngx_http_cache_purge_shctx_t *sh;
+    ngx_slab_pool_t              *shpool;
+    ngx_str_t                     snapshot;
+} ngx_http_cache_purge_zone_t;
+
+/* purge through the C API, kept until disk operations are admitted */
+typedef struct {
+    ngx_event_t                      event;
+    ngx_pool_t                      *pool;
+    uint32_t                         cache;
+    u_char                          *keys;
+    ngx_uint_t                       n;
+    ngx_uint_t                       purged;
+    ngx_http_cache_purge_handler_pt  handler;
+    void                            *data;
+} ngx_http_cache_purge_op_t;
+
+/* cache zone named by a directive, checked once all zones are known */
+typedef struct {
+    ngx_str_t                     name;
+    u_char                       *file;
+    ngx_uint_t                    line;
+} ngx_http_cache_purge_zone_ref_t;
+
+typedef struct {
+    ngx_shm_zone_t               *shm_zone;
+    ngx_uint_t                    batch;   /* scheduled purges per tick */
+
+    ngx_uint_t                    io_rate; /* disk operations per second */
+    ngx_uint_t                    io_burst;
+
+    ngx_str_t                     snapshot;
+    ngx_str_t                     snapshot_temp;
+    time_t                        snapshot_interval;
+
+#  if (NGX_HAVE_UNIX_DOMAIN)
+    ngx_addr_t                   *listen;
+    ngx_uint_t                    listen_mode;
+    ngx_socket_t                  fd;      /* valid with listen only */
+#  endif
+
+    ngx_array_t                  *zone_refs;
+} ngx_http_cache_purge_main_conf_t;
+
 # if (NGX_HTTP_FASTCGI)
 char       *ngx_http_fastcgi_cache_purge_conf(ngx_conf_t *cf,
                 ngx_command_t *cmd, void *conf);
@@ -94,7 +488,8 @@ ngx_int_t   ngx_http_cache_purge_access_handler(ngx_http_request_t *r);
 ngx_int_t   ngx_http_cache_purge_access(ngx_array_t *a, ngx_array_t *a6,
     struct sockaddr *s);
 
-ngx_int_t   ngx_http_cache_purge_send_response(ngx_http_request_t *r);
+ngx_int_t   ngx_http_cache_purge_send_response(ngx_http_request_t *r,
+    ngx_uint_t status, ngx_str_t *info);
 # if (nginx_version >= 1007009)
 ngx_int_t   ngx_http_cache_purge_cache_get(ngx_http_request_t *r,
     ngx_http_upstream_t *u, ngx_http_file_cache_t **cache);
@@ -104,10 +499,256 @@ ngx_int_t   ngx_http_cache_purge_init(ngx_http_request_t *r,
 void        ngx_http_cache_purge_handler(ngx_http_request_t *r);
 
 ngx_int_t   ngx_http_file_cache_purge(ngx_http_request_t *r);
+#  if (nginx_version >= 1007003)
+ngx_int_t   ngx_http_cache_purge_precondition(ngx_http_request_t *r);
+ngx_uint_t  ngx_http_cache_purge_test_if_match(ngx_str_t *etag,
+    ngx_str_t *list);
+#  endif /* nginx_version >= 1007003 */
+ngx_int_t   ngx_http_cache_purge_file_name(ngx_pool_t *pool,
+    ngx_http_file_cache_t *cache, u_char *key, ngx_str_t *name);
+ngx_msec_t  ngx_http_cache_purge_msec(void);
+
+ngx_int_t   ngx_http_cache_purge_recent_lookup(
+    ngx_http_cache_purge_zone_t *zone, uint32_t cache, u_char *key,
+    ngx_msec_t window, ngx_int_t *rc);
+void        ngx_http_cache_purge_recent_add(ngx_http_cache_purge_zone_t *zone,
+    uint32_t cache, u_char *key, ngx_int_t rc, ngx_msec_t retain,
+    ngx_log_t *log);
+void        ngx_http_cache_purge_recent_expire(
+    ngx_http_cache_purge_zone_t *zone, ngx_uint_t force);
+ngx_int_t   ngx_http_cache_purge_fenced(ngx_http_request_t *r);
+ngx_int_t   ngx_http_cache_purge_fence_handler(ngx_http_request_t *r);
+ngx_http_cache_purge_node_t *ngx_http_cache_purge_find(ngx_rbtree_t *rbtree,
+    uint32_t cache, u_char *key);
+ngx_rbtree_node_t *ngx_http_cache_purge_find_next(ngx_rbtree_t *rbtree,
+    uint32_t cache, u_char *key);
+void        ngx_http_cache_purge_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+uint32_t    ngx_http_cache_purge_cache_id(ngx_http_file_cache_t *cache);
+
+ngx_http_file_cache_node_t *ngx_http_cache_purge_lookup(
+    ngx_http_file_cache_t *cache, u_char *key);
+ngx_rbtree_node_t *ngx_http_cache_purge_lookup_first(
+    ngx_http_file_cache_t *cache, ngx_rbtree_key_t node_key);
+ngx_rbtree_node_t *ngx_http_cache_purge_lookup_next(
+    ngx_http_file_cache_t *cache, u_char *key);
+ngx_rbtree_node_t *ngx_http_cache_purge_rbtree_next(ngx_rbtree_t *tree,
+    ngx_rbtree_node_t *node);
+ngx_int_t   ngx_http_cache_purge_hex_key(u_char *key, u_char *p, size_t len);
+void        ngx_http_cache_purge_retire(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
+ngx_int_t   ngx_http_cache_purge_entries(ngx_pool_t *pool,
+    ngx_http_file_cache_t *cache, u_char *keys, ngx_uint_t n,
+    ngx_uint_t *purged, u_char *results, ngx_log_t *log);
+ngx_int_t   ngx_http_cache_purge_hashes(ngx_http_cache_purge_post_t *post,
+    ngx_http_cache_purge_zone_t *zone, ngx_pool_t *pool,
+    ngx_http_file_cache_t *cache, u_char *keys, ngx_uint_t n,
+    ngx_uint_t *purged, u_char *results, ngx_log_t *log);
+ngx_int_t   ngx_http_cache_purge_unlink(ngx_http_file_cache_t *cache,
+    ngx_str_t *name, u_char *key, ngx_uint_t probe, ngx_log_t *log);
+ngx_int_t   ngx_http_cache_purge_slices(ngx_http_request_t *r,
+    ngx_uint_t *purged);
+ngx_http_file_cache_t *ngx_http_cache_purge_file_cache(ngx_cycle_t *cycle,
+    uint32_t id);
+ngx_uint_t  ngx_http_cache_purge_is_file_cache(ngx_shm_zone_t *shm_zone);
+
+ngx_int_t   ngx_http_cache_purge_schedule(ngx_http_request_t *r,
+    time_t *due);
+ngx_int_t   ngx_http_cache_purge_spread(ngx_http_cache_purge_loc_conf_t *cplcf,
+    ngx_http_cache_purge_post_t *post, ngx_http_cache_purge_zone_t *zone,
+    ngx_http_file_cache_t *cache, u_char *keys, ngx_uint_t n,
+    u_char *results, ngx_uint_t *queued, ngx_log_t *log);
+ngx_http_cache_purge_bucket_t *ngx_http_cache_purge_bucket_locked(
+    ngx_http_cache_purge_zone_t *zone, uint32_t cache);
+ngx_int_t   ngx_http_cache_purge_job_add_locked(
+    ngx_http_cache_purge_zone_t *zone, uint32_t cache, u_char *key,
+    ngx_http_cache_purge_post_t *post, time_t *due, ngx_log_t *log);
+ngx_int_t   ngx_http_cache_purge_init_process(ngx_cycle_t *cycle);
+void        ngx_http_cache_purge_exit_process(ngx_cycle_t *cycle);
+ngx_uint_t  ngx_http_cache_purge_io_take(
+    ngx_http_cache_purge_main_conf_t *cpmcf, uint32_t cache, ngx_uint_t n,
+    ngx_uint_t force, ngx_msec_t *delay);
+ngx_int_t   ngx_http_cache_purge_admit(ngx_http_request_t *r);
+ngx_int_t   ngx_http_cache_purge_invalidate(ngx_http_request_t *r);
+ngx_int_t   ngx_http_cache_purge_unsafe(ngx_http_request_t *r);
+
+#  if (nginx_version >= 1007011)
+ngx_int_t   ngx_http_cache_purge_bulk_handler(ngx_http_request_t *r);
+void        ngx_http_cache_purge_bulk_start(ngx_http_request_t *r);
+void        ngx_http_cache_purge_bulk_process(ngx_http_request_t *r);
+ngx_int_t   ngx_http_cache_purge_bulk_parse(ngx_http_request_t *r,
+    ngx_http_cache_purge_bulk_t *bulk, ngx_buf_t *b);
+ngx_int_t   ngx_http_cache_purge_bulk_key(ngx_http_request_t *r,
+    ngx_http_cache_purge_bulk_t *bulk, u_char *key, size_t len);
+ngx_int_t   ngx_http_cache_purge_bulk_error(ngx_http_request_t *r,
+    ngx_http_cache_purge_bulk_t *bulk);
+ngx_int_t   ngx_http_cache_purge_bulk_flush(ngx_http_request_t *r,
+    ngx_http_cache_purge_bulk_t *bulk);
+void        ngx_http_cache_purge_bulk_cleanup(void *data);
+#  endif /* nginx_version >= 1007011 */
+
+ngx_int_t   ngx_http_cache_purge_export_handler(ngx_http_request_t *r);
+void        ngx_http_cache_purge_export_process(ngx_http_request_t *r);
+ngx_int_t   ngx_http_cache_purge_export_page(ngx_http_file_cache_t *cache,
+    ngx_http_cache_purge_export_t *exp, ngx_uint_t *n);
+ngx_int_t   ngx_http_cache_purge_evict_handler(ngx_http_request_t *r);
+ngx_int_t   ngx_http_cache_purge_evict_batch(ngx_http_file_cache_t *cache,
+    ngx_http_cache_purge_sweep_t *sw, ngx_uint_t max, ngx_log_t *log);
+ngx_int_t   ngx_http_cache_purge_filter_handler(ngx_http_request_t *r);
+ngx_int_t   ngx_http_cache_purge_filter_batch(ngx_http_file_cache_t *cache,
+    ngx_http_cache_purge_sweep_t *sw, ngx_uint_t max, ngx_log_t *log);
+ngx_int_t   ngx_http_cache_purge_shared_start(ngx_http_request_t *r,
+    ngx_http_cache_purge_sweep_t *sw, ngx_uint_t shards);
+void        ngx_http_cache_purge_shared_wait(ngx_http_request_t *r);
+void        ngx_http_cache_purge_shared_cleanup(void *data);
+void        ngx_http_cache_purge_shard_post(ngx_http_cache_purge_zone_t *zone);
+void        ngx_http_cache_purge_shard_handler(ngx_event_t *ev);
+ngx_int_t   ngx_http_cache_purge_shard_claim(
+    ngx_http_cache_purge_zone_t *zone);
+void        ngx_http_cache_purge_shard_done(ngx_http_cache_purge_zone_t *zone);
+ngx_http_cache_purge_claim_t *ngx_http_cache_purge_shard_find_locked(
+    ngx_http_cache_purge_zone_t *zone);
+ngx_uint_t  ngx_http_cache_purge_shared_expire_locked(
+    ngx_http_cache_purge_shared_t *job, time_t now);
+void        ngx_http_cache_purge_shared_abandon_locked(
+    ngx_http_cache_purge_shared_t *job);
+ngx_int_t   ngx_http_cache_purge_errors_handler(ngx_http_request_t *r);
+ngx_int_t   ngx_http_cache_purge_errors_batch(ngx_http_file_cache_t *cache,
+    ngx_http_cache_purge_sweep_t *sw, ngx_uint_t max, ngx_log_t *log);
+#  if (NGX_PCRE)
+ngx_int_t   ngx_http_cache_purge_regex_handler(ngx_http_request_t *r);
+ngx_int_t   ngx_http_cache_purge_regex_batch(ngx_http_file_cache_t *cache,
+    ngx_http_cache_purge_sweep_t *sw, ngx_uint_t max, ngx_log_t *log);
+#    if (NGX_HAVE_PCRE_JIT && !(NGX_PCRE2))
+void       *ngx_http_cache_purge_pcre_malloc(size_t size);
+void        ngx_http_cache_purge_pcre_free_study(void *data);
+#    endif
+#  endif /* NGX_PCRE */
+ngx_int_t   ngx_http_cache_purge_index_map(ngx_pool_t *pool, ngx_str_t *name,
+    ngx_http_cache_purge_index_t *index, ngx_log_t *log);
+void        ngx_http_cache_purge_index_unmap(void *data);
+ngx_int_t   ngx_http_cache_purge_sweep_init(ngx_http_request_t *r,
+    ngx_str_t *zone, ngx_http_cache_purge_sweep_t **sw,
+    ngx_http_file_cache_t **cache);
+ngx_int_t   ngx_http_cache_purge_sweep_start(ngx_http_request_t *r,
+    ngx_http_cache_purge_sweep_t *sw);
+void        ngx_http_cache_purge_sweep_process(ngx_http_request_t *r);
+void        ngx_http_cache_purge_sweep_flush(ngx_http_file_cache_t *cache,
+    ngx_http_cache_purge_sweep_t *sw, ngx_uint_t n, ngx_log_t *log);
+ngx_int_t   ngx_http_cache_purge_sweep_report(ngx_http_request_t *r,
+    ngx_http_file_cache_t *cache);
+ngx_buf_t  *ngx_http_cache_purge_stream_reserve(ngx_http_request_t *r,
+    ngx_http_cache_purge_stream_t *st, size_t size);
+ngx_int_t   ngx_http_cache_purge_stream_send(ngx_http_request_t *r,
+    ngx_http_cache_purge_stream_t *st);
+
+ngx_int_t   ngx_http_cache_purge_is_inspect(ngx_http_request_t *r,
+    ngx_http_cache_purge_loc_conf_t *cplcf);
+ngx_int_t   ngx_http_cache_purge_inspect(ngx_http_request_t *r);
+uintptr_t   ngx_http_cache_purge_escape_json(u_char *dst, u_char *src,
+    size_t size);
+void        ngx_http_cache_purge_delay(ngx_http_request_t *r);
+void        ngx_http_cache_purge_timer_handler(ngx_event_t *ev);
+void        ngx_http_cache_purge_op_handler(ngx_event_t *ev);
+#  if (NGX_HAVE_UNIX_DOMAIN)
+ngx_int_t   ngx_http_cache_purge_init_module(ngx_cycle_t *cycle);
+void        ngx_http_cache_purge_close_listen(void *data);
+void        ngx_http_cache_purge_ingest_handler(ngx_event_t *rev);
+ngx_int_t   ngx_http_cache_purge_ingest_line(u_char *p, u_char *last,
+    uint32_t *cache, u_char *key);
+void        ngx_http_cache_purge_ingest_flush(
+    ngx_http_cache_purge_main_conf_t *cpmcf, ngx_pool_t *pool,
+    uint32_t cache, u_char *keys, ngx_uint_t n, ngx_log_t *log);
+#  endif
+void        ngx_http_cache_purge_op_run(ngx_http_cache_purge_op_t *op);
+
+void        ngx_http_cache_purge_error_add(ngx_http_request_t *r,
+    ngx_http_cache_purge_zone_t *zone);
+void        ngx_http_cache_purge_error_free(ngx_http_cache_purge_zone_t *zone,
+    ngx_http_cache_purge_error_t *en);
+
+#  if (nginx_version >= 1007007)
+void        ngx_http_cache_purge_variant_add(ngx_http_request_t *r,
+    ngx_http_cache_purge_zone_t *zone);
+ngx_int_t   ngx_http_cache_purge_variants(ngx_http_request_t *r,
+    ngx_http_cache_purge_zone_t *zone);
+void        ngx_http_cache_purge_variant_keys(
+    ngx_http_cache_purge_zone_t *zone, uint32_t cache, u_char *main,
+    u_char *skip, ngx_array_t *keys);
+void        ngx_http_cache_purge_primary_free(
+    ngx_http_cache_purge_zone_t *zone, ngx_http_cache_purge_primary_t *pn);
+#  endif /* nginx_version >= 1007007 */
+
+void        ngx_http_cache_purge_snapshot_load(
+    ngx_http_cache_purge_zone_t *zone, ngx_log_t *log);
+ngx_int_t   ngx_http_cache_purge_snapshot_restore(
+    ngx_http_cache_purge_zone_t *zone, ngx_http_cache_purge_record_t *rec);
+void        ngx_http_cache_purge_snapshot_save(
+    ngx_http_cache_purge_main_conf_t *cpmcf, ngx_uint_t exiting,
+    ngx_log_t *log);
+ngx_int_t   ngx_http_cache_purge_snapshot_records(
+    ngx_http_cache_purge_zone_t *zone, ngx_http_cache_purge_snapshot_t *ss);
+void        ngx_http_cache_purge_snapshot_handler(ngx_event_t *ev);
+ngx_int_t   ngx_http_cache_purge_snapshot_reconcile(
+    ngx_http_cache_purge_zone_t *zone, ngx_log_t *log);
+
+ngx_int_t   ngx_http_cache_purge_rewarm(ngx_http_request_t *r);
+ngx_int_t   ngx_http_cache_purge_rewarm_done(ngx_http_request_t *r,
+    void *data, ngx_int_t rc);
+void        ngx_http_cache_purge_rewarm_cleanup(void *data);
+ngx_int_t   ngx_http_cache_purge_header_filter(ngx_http_request_t *r);
+ngx_int_t   ngx_http_cache_purge_body_filter(ngx_http_request_t *r,
+    ngx_chain_t *in);
+ngx_int_t   ngx_http_cache_purge_filter_init(ngx_conf_t *cf);
 
 char       *ngx_http_cache_purge_conf(ngx_conf_t *cf,
     ngx_http_cache_purge_conf_t *cpcf);
+char       *ngx_http_cache_purge_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+ngx_int_t   ngx_http_cache_purge_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+char       *ngx_http_cache_purge_rewarm_conf(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+char       *ngx_http_cache_purge_slice_conf(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+char       *ngx_http_cache_purge_schedule_conf(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+char       *ngx_http_cache_purge_rate_conf(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+char       *ngx_http_cache_purge_io_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+char       *ngx_http_cache_purge_snapshot_conf(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+char       *ngx_http_cache_purge_invalidate_conf(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+char       *ngx_http_cache_purge_bulk_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+char       *ngx_http_cache_purge_inspect_conf(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+char       *ngx_http_cache_purge_export_conf(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+char       *ngx_http_cache_purge_evict_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+char       *ngx_http_cache_purge_filter_conf(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+char       *ngx_http_cache_purge_errors_conf(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+char       *ngx_http_cache_purge_regex_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+#  if (NGX_HAVE_UNIX_DOMAIN)
+char       *ngx_http_cache_purge_listen(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+#  endif
+
+ngx_int_t   ngx_http_cache_purge_add_variables(ngx_conf_t *cf);
+ngx_int_t   ngx_http_cache_purge_pending_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+ngx_int_t   ngx_http_cache_purge_counter_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
 
+void       *ngx_http_cache_purge_create_main_conf(ngx_conf_t *cf);
+char       *ngx_http_cache_purge_init_main_conf(ngx_conf_t *cf, void *conf);
+ngx_int_t   ngx_http_cache_purge_zone_ref(ngx_conf_t *cf, ngx_str_t *name);
 void       *ngx_http_cache_purge_create_loc_conf(ngx_conf_t *cf);
 char       *ngx_http_cache_purge_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
@@ -121,6 +762,13 @@ static ngx_command_t  ngx_http_cache_purge_module_commands[] = {
       NGX_HTTP_LOC_CONF_OFFSET,
       0,
       NULL },
+
+    { ngx_string("fastcgi_cache_purge_on_unsafe"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_cache_purge_loc_conf_t, fastcgi.unsafe),
+      NULL },
 # endif /* NGX_HTTP_FASTCGI */
 
 # if (NGX_HTTP_PROXY)
@@ -130,6 +778,13 @@ static ngx_command_t  ngx_http_cache_purge_module_commands[] = {
       NGX_HTTP_LOC_CONF_OFFSET,
       0,
       NULL },
+
+    { ngx_string("proxy_cache_purge_on_unsafe"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_cache_purge_loc_conf_t, proxy.unsafe),
+      NULL },
 # endif /* NGX_HTTP_PROXY */
 
 # if (NGX_HTTP_SCGI)
@@ -139,6 +794,13 @@ static ngx_command_t  ngx_http_cache_purge_module_commands[] = {
       NGX_HTTP_LOC_CONF_OFFSET,
       0,
       NULL },
+
+    { ngx_string("scgi_cache_purge_on_unsafe"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_cache_purge_loc_conf_t, scgi.unsafe),
+      NULL },
 # endif /* NGX_HTTP_SCGI */
 
 # if (NGX_HTTP_UWSGI)
@@ -148,17 +810,180 @@ static ngx_command_t  ngx_http_cache_purge_module_commands[] = {
       NGX_HTTP_LOC_CONF_OFFSET,
       0,
       NULL },
+
+    { ngx_string("uwsgi_cache_purge_on_unsafe"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_cache_purge_loc_conf_t, uwsgi.unsafe),
+      NULL },
 # endif /* NGX_HTTP_UWSGI */
 
+    { ngx_string("cache_purge_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE12,
+      ngx_http_cache_purge_zone,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("cache_purge_io"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE12,
+      ngx_http_cache_purge_io_conf,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("cache_purge_snapshot"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE12,
+      ngx_http_cache_purge_snapshot_conf,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+#  if (NGX_HAVE_UNIX_DOMAIN)
+    { ngx_string("cache_purge_listen"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE12,
+      ngx_http_cache_purge_listen,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+#  endif
+
+    { ngx_string("cache_purge_coalesce"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_cache_purge_loc_conf_t, coalesce),
+      NULL },
+
+    { ngx_string("cache_purge_fence"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_cache_purge_loc_conf_t, fence),
+      NULL },
+
+    { ngx_string("cache_purge_vary"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_cache_purge_loc_conf_t, vary),
+      NULL },
+
+    { ngx_string("cache_purge_conditional"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_cache_purge_loc_conf_t, conditional),
+      NULL },
+
+    { ngx_string("cache_purge_track_errors"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_cache_purge_loc_conf_t, track_errors),
+      NULL },
+
+    { ngx_string("cache_purge_rewarm"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_cache_purge_rewarm_conf,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("cache_purge_slice"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_cache_purge_slice_conf,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("cache_purge_schedule"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      ngx_http_cache_purge_schedule_conf,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("cache_purge_inspect"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_cache_purge_inspect_conf,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("cache_purge_bulk"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_cache_purge_bulk_conf,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("cache_purge_export"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_cache_purge_export_conf,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("cache_purge_evict"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_cache_purge_evict_conf,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("cache_purge_filter"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_cache_purge_filter_conf,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("cache_purge_errors"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_cache_purge_errors_conf,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("cache_purge_regex"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_TAKE2,
+      ngx_http_cache_purge_regex_conf,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("cache_purge_invalidate"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      ngx_http_cache_purge_invalidate_conf,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("cache_purge_shards"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_cache_purge_loc_conf_t, shards),
+      NULL },
+
+    { ngx_string("cache_purge_rate"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      ngx_http_cache_purge_rate_conf,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
 static ngx_http_module_t  ngx_http_cache_purge_module_ctx = {
-    NULL,                                  /* preconfiguration */
+    ngx_http_cache_purge_add_variables,    /* preconfiguration */
     NULL,                                  /* postconfiguration */
 
-    NULL,                                  /* create main configuration */
-    NULL,                                  /* init main configuration */
+    ngx_http_cache_purge_create_main_conf, /* create main configuration */
+    ngx_http_cache_purge_init_main_conf,   /* init main configuration */
 
     NULL,                                  /* create server configuration */
     NULL,                                  /* merge server configuration */
@@ -173,6 +998,39 @@ ngx_module_t  ngx_http_cache_purge_module = {
     ngx_http_cache_purge_module_commands,  /* module directives */
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
+#  if (NGX_HAVE_UNIX_DOMAIN)
+    ngx_http_cache_purge_init_module,      /* init module */
+#  else
+    NULL,                                  /* init module */
+#  endif
+    ngx_http_cache_purge_init_process,     /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    ngx_http_cache_purge_exit_process,     /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+static ngx_http_module_t  ngx_http_cache_purge_filter_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_http_cache_purge_filter_init,      /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+ngx_module_t  ngx_http_cache_purge_filter_module = {
+    NGX_MODULE_V1,
+    &ngx_http_cache_purge_filter_module_ctx, /* module context */
+    NULL,                                  /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
     NULL,                                  /* init module */
     NULL,                                  /* init process */
     NULL,                                  /* init thread */
@@ -182,6 +1040,64 @@ ngx_module_t  ngx_http_cache_purge_module = {
     NGX_MODULE_V1_PADDING
 };
 
+static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
+static ngx_http_output_body_filter_pt    ngx_http_next_body_filter;
+
+/* rewarm subrequests in flight, per worker process */
+static ngx_uint_t  ngx_http_cache_purge_rewarms;
+
+static ngx_event_t                  ngx_http_cache_purge_timer;
+static u_char                      *ngx_http_cache_purge_timer_keys;
+static ngx_http_cache_purge_job_t  *ngx_http_cache_purge_timer_jobs;
+
+/* snapshots are written by cache helper processes, not to stall workers */
+static ngx_event_t                  ngx_http_cache_purge_snapshot_event;
+
+/* shard of a sharded purge walked by this worker process */
+static ngx_event_t                     ngx_http_cache_purge_shard_event;
+static ngx_http_cache_purge_sweep_t   *ngx_http_cache_purge_shard;
+static ngx_http_cache_purge_shared_t  *ngx_http_cache_purge_shard_job;
+static ngx_uint_t                      ngx_http_cache_purge_shard_id;
+static ngx_uint_t                      ngx_http_cache_purge_shard_index;
+static time_t                          ngx_http_cache_purge_shard_alive;
+
+#  if (NGX_HAVE_UNIX_DOMAIN)
+/* one datagram of the purge socket, up to the socket buffer size */
+#define NGX_HTTP_CACHE_PURGE_DATAGRAM  65536
+
+static u_char      *ngx_http_cache_purge_ingest_buf;
+static u_char      *ngx_http_cache_purge_ingest_keys;
+#  endif
+
+#  if (NGX_PCRE && NGX_HAVE_PCRE_JIT && !(NGX_PCRE2))
+/* pool for pcre_study() of regexes compiled at runtime */
+static ngx_pool_t  *ngx_http_cache_purge_pcre_pool;
+#  endif
+
+static ngx_http_variable_t  ngx_http_cache_purge_vars[] = {
+
+    { ngx_string("cache_purge_pending"), NULL,
+      ngx_http_cache_purge_pending_variable, 0,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("cache_purge_ingest_keys"), NULL,
+      ngx_http_cache_purge_counter_variable,
+      offsetof(ngx_http_cache_purge_shctx_t, ingest_keys),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("cache_purge_ingest_purged"), NULL,
+      ngx_http_cache_purge_counter_variable,
+      offsetof(ngx_http_cache_purge_shctx_t, ingest_purged),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("cache_purge_ingest_errors"), NULL,
+      ngx_http_cache_purge_counter_variable,
+      offsetof(ngx_http_cache_purge_shctx_t, ingest_errors),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_null_string, NULL, NULL, 0, 0, 0 }
+};
+
 static char ngx_http_cache_purge_success_page_top[] =
 "<html>" CRLF
 "<head><title>Successful purge</title></head>" CRLF
@@ -189,6 +1105,13 @@ static char ngx_http_cache_purge_success_page_top[] =
 "<center><h1>Successful purge</h1>" CRLF
 ;
 
+static char ngx_http_cache_purge_accepted_page_top[] =
+"<html>" CRLF
+"<head><title>Purge accepted</title></head>" CRLF
+"<body bgcolor=\"white\">" CRLF
+"<center><h1>Purge accepted</h1>" CRLF
+;
+
 static char ngx_http_cache_purge_success_page_tail[] =
 CRLF "</center>" CRLF
 "<hr><center>" NGINX_VER "</center>" CRLF
@@ -1151,9 +2074,10 @@ ngx_http_cache_purge_access_handler(ngx_http_request_t *r)
 
     cplcf = ngx_http_get_module_loc_conf(r, ngx_http_cache_purge_module);
 
-    if (r->method_name.len != cplcf->conf->method.len
-        || (ngx_strncmp(r->method_name.data, cplcf->conf->method.data,
-                        r->method_name.len)))
+    if ((r->method_name.len != cplcf->conf->method.len
+         || (ngx_strncmp(r->method_name.data, cplcf->conf->method.data,
+                         r->method_name.len)))
+        && ngx_http_cache_purge_is_inspect(r, cplcf) != NGX_OK)
     {
         return cplcf->original_handler(r);
     }
@@ -1248,25 +2172,46 @@ ngx_http_cache_purge_access(ngx_array_t *access, ngx_array_t *access6,
     return NGX_DECLINED;
 }
 
+/*
+ * Sends the key and "info", or the path of the cache file if there is
+ * no "info", with 200 (purged) or 202 (accepted to be purged later).
+ */
 ngx_int_t
-ngx_http_cache_purge_send_response(ngx_http_request_t *r)
+ngx_http_cache_purge_send_response(ngx_http_request_t *r, ngx_uint_t status,
+    ngx_str_t *info)
 {
     ngx_chain_t   out;
     ngx_buf_t    *b;
-    ngx_str_t    *key;
+    ngx_str_t    *key, top, path;
     ngx_int_t     rc;
     size_t        len;
 
     key = r->cache->keys.elts;
 
-    len = sizeof(ngx_http_cache_purge_success_page_top) - 1
-          + sizeof(ngx_http_cache_purge_success_page_tail) - 1
-          + sizeof("<br>Key : ") - 1 + sizeof(CRLF "<br>Path: ") - 1
-          + key[0].len + r->cache->file.name.len;
+    if (status == NGX_HTTP_ACCEPTED) {
+        top.data = (u_char *) ngx_http_cache_purge_accepted_page_top;
+        top.len = sizeof(ngx_http_cache_purge_accepted_page_top) - 1;
 
-    r->headers_out.content_type.len = sizeof("text/html") - 1;
+    } else {
+        top.data = (u_char *) ngx_http_cache_purge_success_page_top;
+        top.len = sizeof(ngx_http_cache_purge_success_page_top) - 1;
+    }
+
+    if (info == NULL) {
+        ngx_str_set(&path, "Path: ");
+        info = &r->cache->file.name;
+
+    } else {
+        ngx_str_null(&path);
+    }
+
+    len = top.len + sizeof(ngx_http_cache_purge_success_page_tail) - 1
+          + sizeof("<br>Key : ") - 1 + sizeof(CRLF "<br>") - 1
+          + key[0].len + path.len + info->len;
+
+    r->headers_out.content_type.len = sizeof("text/html") - 1;
     r->headers_out.content_type.data = (u_char *) "text/html";
-    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.status = status;
     r->headers_out.content_length_n = len;
 
     if (r->method == NGX_HTTP_HEAD) {
@@ -1284,14 +2229,12 @@ ngx_http_cache_purge_send_response(ngx_http_request_t *r)
     out.buf = b;
     out.next = NULL;
 
-    b->last = ngx_cpymem(b->last, ngx_http_cache_purge_success_page_top,
-                         sizeof(ngx_http_cache_purge_success_page_top) - 1);
+    b->last = ngx_cpymem(b->last, top.data, top.len);
     b->last = ngx_cpymem(b->last, "<br>Key : ", sizeof("<br>Key : ") - 1);
     b->last = ngx_cpymem(b->last, key[0].data, key[0].len);
-    b->last = ngx_cpymem(b->last, CRLF "<br>Path: ",
-                         sizeof(CRLF "<br>Path: ") - 1);
-    b->last = ngx_cpymem(b->last, r->cache->file.name.data,
-                         r->cache->file.name.len);
+    b->last = ngx_cpymem(b->last, CRLF "<br>", sizeof(CRLF "<br>") - 1);
+    b->last = ngx_cpymem(b->last, path.data, path.len);
+    b->last = ngx_cpymem(b->last, info->data, info->len);
     b->last = ngx_cpymem(b->last, ngx_http_cache_purge_success_page_tail,
                          sizeof(ngx_http_cache_purge_success_page_tail) - 1);
     b->last_buf = 1;
@@ -1401,7 +2344,19 @@ ngx_http_cache_purge_init(ngx_http_request_t *r, ngx_http_file_cache_t *cache,
 void
 ngx_http_cache_purge_handler(ngx_http_request_t *r)
 {
-    ngx_int_t  rc;
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_loc_conf_t   *cplcf;
+    ngx_http_cache_purge_zone_t       *zone;
+    ngx_http_cache_t                  *c;
+    uint32_t                           cache;
+    ngx_uint_t                         purged, conditional;
+    ngx_int_t                          rc;
+    ngx_str_t                          info;
+    ngx_msec_t                         delay;
+    time_t                             due;
+    u_char                            *key, *p;
+    u_char                             buf[sizeof("Due : Mon, 28 Sep 1970"
+                                                  " 06:00:00 GMT")];
 
 #  if (NGX_HAVE_FILE_AIO)
     if (r->aio) {
@@ -1409,8 +2364,165 @@ ngx_http_cache_purge_handler(ngx_http_request_t *r)
     }
 #  endif
 
+    cplcf = ngx_http_get_module_loc_conf(r, ngx_http_cache_purge_module);
+
+    if (ngx_http_cache_purge_is_inspect(r, cplcf) == NGX_OK) {
+        r->write_event_handler = ngx_http_request_empty_handler;
+        ngx_http_finalize_request(r, ngx_http_cache_purge_inspect(r));
+        return;
+    }
+
+    if (cplcf->schedule) {
+        rc = ngx_http_cache_purge_schedule(r, &due);
+
+        if (rc == NGX_OK) {
+            p = ngx_cpymem(buf, "Due : ", sizeof("Due : ") - 1);
+            p = ngx_http_time(p, due);
+
+            info.data = buf;
+            info.len = p - buf;
+
+            r->write_event_handler = ngx_http_request_empty_handler;
+
+            rc = ngx_http_cache_purge_send_response(r, NGX_HTTP_ACCEPTED,
+                                                    &info);
+
+            ngx_http_finalize_request(r, rc);
+            return;
+        }
+
+        if (rc != NGX_DECLINED) {
+            ngx_http_finalize_request(r, rc);
+            return;
+        }
+    }
+
+    cpmcf = ngx_http_get_module_main_conf(r, ngx_http_cache_purge_module);
+
+    c = r->cache;
+    zone = cpmcf->shm_zone ? cpmcf->shm_zone->data : NULL;
+    cache = ngx_http_cache_purge_cache_id(c->file_cache);
+
+    /* key of the request, c->key might switch to a secondary one */
+
+#  if (nginx_version >= 1007007)
+    key = c->main;
+#  else
+    key = c->key;
+#  endif
+
+    /* conditional purges depend on the entry, they can't be coalesced */
+
+    conditional = cplcf->conditional
+                  && (r->headers_in.if_unmodified_since
+                      || r->headers_in.if_match);
+
+    if (cplcf->coalesce && !cplcf->slice && !conditional
+        && ngx_http_cache_purge_recent_lookup(zone, cache, key,
+                                              cplcf->coalesce, &rc)
+           == NGX_OK)
+    {
+        /*
+         * duplicate of a recent purge, answered without touching the cache,
+         * so it isn't admitted against the disk budget either
+         */
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache purge coalesced: %i", rc);
+
+        if (ngx_http_cache_purge_file_name(r->pool, c->file_cache, key,
+                                           &c->file.name)
+            != NGX_OK)
+        {
+            rc = NGX_ERROR;
+        }
+
+        goto done;
+    }
+
+    switch (ngx_http_cache_purge_admit(r)) {
+    case NGX_OK:
+        break;
+    case NGX_AGAIN:
+        return;
+    default:
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+
+    if (cplcf->slice) {
+        rc = ngx_http_cache_purge_slices(r, &purged);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache purge slices: %i, %ui", rc, purged);
+
+        if (rc != NGX_OK) {
+            ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        if (purged == 0) {
+            ngx_http_finalize_request(r, NGX_HTTP_NOT_FOUND);
+            return;
+        }
+
+        /* one operation was taken on admission */
+
+        if (!cplcf->rate && purged > 1 && cpmcf->io_rate) {
+            (void) ngx_http_cache_purge_io_take(cpmcf, cache, purged - 1, 1,
+                                                &delay);
+        }
+
+        info.data = buf;
+        info.len = ngx_sprintf(buf, "Entries: %ui", purged) - buf;
+
+        r->write_event_handler = ngx_http_request_empty_handler;
+
+        /* rate limited purges are queued and executed later */
+
+        rc = ngx_http_cache_purge_send_response(r,
+                                                cplcf->rate ? NGX_HTTP_ACCEPTED
+                                                            : NGX_HTTP_OK,
+                                                &info);
+
+        ngx_http_finalize_request(r, rc);
+        return;
+    }
+
     rc = ngx_http_file_cache_purge(r);
 
+#  if (nginx_version >= 1007007)
+
+    if (cplcf->vary && (rc == NGX_OK || rc == NGX_DECLINED)) {
+
+        switch (ngx_http_cache_purge_variants(r, zone)) {
+        case NGX_OK:
+            rc = NGX_OK;
+            break;
+        case NGX_DECLINED:
+            break;
+        default:
+            rc = NGX_ERROR;
+        }
+    }
+
+#  endif /* nginx_version >= 1007007 */
+
+    /*
+     * the fence is recorded for missing entries too,
+     * their responses might still be on the way from upstream
+     */
+
+    if ((cplcf->coalesce || cplcf->fence)
+        && (rc == NGX_OK || rc == NGX_DECLINED))
+    {
+        ngx_http_cache_purge_recent_add(zone, cache, key, rc,
+                                        ngx_max(cplcf->coalesce, cplcf->fence),
+                                        r->connection->log);
+    }
+
+done:
+
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http file cache purge: %i, \"%s\"",
                    rc, r->cache->file.name.data);
@@ -1418,11 +2530,27 @@ ngx_http_cache_purge_handler(ngx_http_request_t *r)
     switch (rc) {
     case NGX_OK:
         r->write_event_handler = ngx_http_request_empty_handler;
-        ngx_http_finalize_request(r, ngx_http_cache_purge_send_response(r));
+
+        rc = ngx_http_cache_purge_send_response(r, NGX_HTTP_OK, NULL);
+
+        /* coalesced purges don't hold a node and don't rewarm */
+
+        if (cplcf->rewarm
+            && (rc == NGX_OK || rc == NGX_AGAIN)
+            && r->cache->node
+            && r->cache->node->uses >= cplcf->rewarm_min_uses)
+        {
+            (void) ngx_http_cache_purge_rewarm(r);
+        }
+
+        ngx_http_finalize_request(r, rc);
         return;
     case NGX_DECLINED:
         ngx_http_finalize_request(r, NGX_HTTP_NOT_FOUND);
         return;
+    case NGX_HTTP_PRECONDITION_FAILED:
+        ngx_http_finalize_request(r, NGX_HTTP_PRECONDITION_FAILED);
+        return;
 #  if (NGX_HAVE_FILE_AIO)
     case NGX_AGAIN:
         r->write_event_handler = ngx_http_cache_purge_handler;
@@ -1434,175 +2562,7792 @@ ngx_http_cache_purge_handler(ngx_http_request_t *r)
 }
 
 ngx_int_t
-ngx_http_file_cache_purge(ngx_http_request_t *r)
+ngx_http_cache_purge_rewarm(ngx_http_request_t *r)
 {
-    ngx_http_file_cache_t  *cache;
-    ngx_http_cache_t       *c;
+    ngx_http_cache_purge_loc_conf_t  *cplcf;
+    ngx_http_cache_purge_ctx_t       *ctx;
+    ngx_http_post_subrequest_t       *psr;
+    ngx_http_request_t               *sr;
+    ngx_pool_cleanup_t               *cln;
+    ngx_str_t                         uri, args;
+    ngx_uint_t                        flags;
+    u_char                           *p;
 
-    switch (ngx_http_file_cache_open(r)) {
-    case NGX_OK:
-    case NGX_HTTP_CACHE_STALE:
-#  if (nginx_version >= 8001) \
-       || ((nginx_version < 8000) && (nginx_version >= 7060))
-    case NGX_HTTP_CACHE_UPDATING:
-#  endif
-        break;
-    case NGX_DECLINED:
+    cplcf = ngx_http_get_module_loc_conf(r, ngx_http_cache_purge_module);
+
+    if (ngx_http_cache_purge_rewarms >= cplcf->rewarm_concurrency) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache rewarm skipped, %ui in flight",
+                       ngx_http_cache_purge_rewarms);
         return NGX_DECLINED;
-#  if (NGX_HAVE_FILE_AIO)
-    case NGX_AGAIN:
-        return NGX_AGAIN;
-#  endif
-    default:
+    }
+
+    if (cplcf->rewarm_uri == NULL) {
+        uri = r->uri;
+        args = r->args;
+
+    } else {
+        if (ngx_http_complex_value(r, cplcf->rewarm_uri, &uri) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ngx_str_null(&args);
+
+        p = ngx_strlchr(uri.data, uri.data + uri.len, '?');
+
+        if (p) {
+            args.data = p + 1;
+            args.len = uri.data + uri.len - args.data;
+            uri.len = p - uri.data;
+        }
+
+        flags = NGX_HTTP_LOG_UNSAFE;
+
+        if (ngx_http_parse_unsafe_uri(r, &uri, &args, &flags) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    psr = ngx_palloc(r->pool, sizeof(ngx_http_post_subrequest_t));
+    if (psr == NULL) {
         return NGX_ERROR;
     }
 
-    c = r->cache;
-    cache = c->file_cache;
+    psr->handler = ngx_http_cache_purge_rewarm_done;
+    psr->data = NULL;
+
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_cache_purge_ctx_t));
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->rewarm = 1;
 
     /*
-     * delete file from disk but *keep* in-memory node,
-     * because other requests might still point to it.
+     * The post subrequest handler isn't called if the main request
+     * is terminated, the cleanup gives the slot back in that case.
      */
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
 
-    if (!c->node->exists) {
-        /* race between concurrent purges, backoff */
-        ngx_shmtx_unlock(&cache->shpool->mutex);
-        return NGX_DECLINED;
+    if (ngx_http_subrequest(r, &uri, &args, &sr, psr, 0) != NGX_OK) {
+        return NGX_ERROR;
     }
 
-#  if (nginx_version >= 1000001)
-    cache->sh->size -= c->node->fs_size;
-    c->node->fs_size = 0;
-#  else
-    cache->sh->size -= (c->node->length + cache->bsize - 1) / cache->bsize;
-    c->node->length = 0;
-#  endif
+    /* response to the subrequest is dropped by the filters below */
 
-    c->node->exists = 0;
-#  if (nginx_version >= 8001) \
-       || ((nginx_version < 8000) && (nginx_version >= 7060))
-    c->node->updating = 0;
-#  endif
+    ngx_http_set_ctx(sr, ctx, ngx_http_cache_purge_module);
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    cln->handler = ngx_http_cache_purge_rewarm_cleanup;
+    cln->data = ctx;
 
-    if (ngx_delete_file(c->file.name.data) == NGX_FILE_ERROR) {
-        /* entry in error log is enough, don't notice client */
-        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
-                      ngx_delete_file_n " \"%s\" failed", c->file.name.data);
-    }
+    ngx_http_cache_purge_rewarms++;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache rewarm: \"%V?%V\"", &uri, &args);
 
-    /* file deleted from cache */
     return NGX_OK;
 }
 
-char *
-ngx_http_cache_purge_conf(ngx_conf_t *cf, ngx_http_cache_purge_conf_t *cpcf)
+ngx_int_t
+ngx_http_cache_purge_rewarm_done(ngx_http_request_t *r, void *data,
+    ngx_int_t rc)
 {
-    ngx_cidr_t       cidr;
-    ngx_in_cidr_t   *access;
-# if (NGX_HAVE_INET6)
-    ngx_in6_cidr_t  *access6;
-# endif /* NGX_HAVE_INET6 */
-    ngx_str_t       *value;
-    ngx_int_t        rc;
-    ngx_uint_t       i;
-
-    value = cf->args->elts;
+    ngx_http_cache_purge_ctx_t  *ctx;
 
-    if (ngx_strcmp(value[1].data, "off") == 0) {
-        cpcf->enable = 0;
-        return NGX_CONF_OK;
+    if (rc == NGX_DONE || rc == NGX_AGAIN) {
+        return rc;
+    }
 
-    } else if (ngx_strcmp(value[1].data, "on") == 0) {
-        ngx_str_set(&cpcf->method, "PURGE");
+    ctx = ngx_http_get_module_ctx(r, ngx_http_cache_purge_module);
 
-    } else {
-        cpcf->method = value[1];
+    if (ctx == NULL || ctx->done) {
+        return rc;
     }
 
-    if (cf->args->nelts < 4) {
-        cpcf->enable = 1;
-        return NGX_CONF_OK;
-    }
+    ctx->done = 1;
+    ngx_http_cache_purge_rewarms--;
 
-    /* sanity check */
-    if (ngx_strcmp(value[2].data, "from") != 0) {
-        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                           "invalid parameter \"%V\", expected"
-                           " \"from\" keyword", &value[2]);
-        return NGX_CONF_ERROR;
-    }
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache rewarm done: %i", rc);
 
-    if (ngx_strcmp(value[3].data, "all") == 0) {
-        cpcf->enable = 1;
-        return NGX_CONF_OK;
+    return rc;
+}
+
+void
+ngx_http_cache_purge_rewarm_cleanup(void *data)
+{
+    ngx_http_cache_purge_ctx_t  *ctx = data;
+
+    if (ctx->done) {
+        return;
     }
 
-    for (i = 3; i < cf->args->nelts; i++) {
-        rc = ngx_ptocidr(&value[i], &cidr);
+    ctx->done = 1;
+    ngx_http_cache_purge_rewarms--;
+}
 
-        if (rc == NGX_ERROR) {
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                               "invalid parameter \"%V\"", &value[i]);
-            return NGX_CONF_ERROR;
-        }
+ngx_int_t
+ngx_http_cache_purge_header_filter(ngx_http_request_t *r)
+{
+    ngx_http_cache_purge_loc_conf_t  *cplcf;
+    ngx_http_cache_purge_ctx_t       *ctx;
 
-        if (rc == NGX_DONE) {
-            ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
-                               "low address bits of %V are meaningless",
-                               &value[i]);
-        }
+    /* responses served from cache already did their invalidation */
 
-        switch (cidr.family) {
-        case AF_INET:
-            if (cpcf->access == NULL) {
-                cpcf->access = ngx_array_create(cf->pool, cf->args->nelts - 3,
-                                                sizeof(ngx_in_cidr_t));
-                if (cpcf->access == NULL) {
-                    return NGX_CONF_ERROR;
-                }
-            }
+    if (r->upstream && !r->cached) {
+        cplcf = ngx_http_get_module_loc_conf(r, ngx_http_cache_purge_module);
 
-            access = ngx_array_push(cpcf->access);
-            if (access == NULL) {
-                return NGX_CONF_ERROR;
-            }
+        if (cplcf->invalidate.len
+            && ngx_http_cache_purge_invalidate(r) == NGX_ERROR)
+        {
+            return NGX_ERROR;
+        }
 
-            access->mask = cidr.u.in.mask;
-            access->addr = cidr.u.in.addr;
+        /* RFC 7234, 4.4: invalidation by unsafe methods */
 
-            break;
+        if ((r->method & (NGX_HTTP_POST|NGX_HTTP_PUT|NGX_HTTP_PATCH
+                          |NGX_HTTP_DELETE))
+            && r->headers_out.status >= NGX_HTTP_OK
+            && r->headers_out.status < NGX_HTTP_SPECIAL_RESPONSE
+            && ngx_http_cache_purge_unsafe(r) == NGX_ERROR)
+        {
+            return NGX_ERROR;
+        }
+    }
 
-# if (NGX_HAVE_INET6)
-        case AF_INET6:
-            if (cpcf->access6 == NULL) {
-                cpcf->access6 = ngx_array_create(cf->pool, cf->args->nelts - 3,
-                                                 sizeof(ngx_in6_cidr_t));
-                if (cpcf->access6 == NULL) {
-                    return NGX_CONF_ERROR;
-                }
-            }
+    /* the upstream module decides to store the response after this */
 
-            access6 = ngx_array_push(cpcf->access6);
-            if (access6 == NULL) {
-                return NGX_CONF_ERROR;
-            }
+    if (r->cache && r->upstream && r->upstream->cacheable) {
+        cplcf = ngx_http_get_module_loc_conf(r, ngx_http_cache_purge_module);
 
-            access6->mask = cidr.u.in6.mask;
-            access6->addr = cidr.u.in6.addr;
+        if (cplcf->fence && ngx_http_cache_purge_fenced(r) == NGX_OK) {
+            ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                          "not caching response requested before purge");
 
-            break;
-# endif /* NGX_HAVE_INET6 */
+            r->upstream->cacheable = 0;
         }
     }
 
-    cpcf->enable = 1;
+    ctx = ngx_http_get_module_ctx(r, ngx_http_cache_purge_module);
 
-    return NGX_CONF_OK;
+    if (ctx && ctx->rewarm) {
+        return NGX_OK;
+    }
+
+    return ngx_http_next_header_filter(r);
+}
+
+ngx_int_t
+ngx_http_cache_purge_invalidate(ngx_http_request_t *r)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_loc_conf_t   *cplcf;
+    ngx_http_file_cache_t             *cache;
+    ngx_table_elt_t                   *h;
+    ngx_list_part_t                   *part;
+    ngx_array_t                        keys;
+    ngx_uint_t                         i, purged;
+    ngx_msec_t                         delay;
+    ngx_md5_t                          md5;
+    uint32_t                           id;
+    u_char                            *start, *end, *last, *p, *key;
+
+    cplcf = ngx_http_get_module_loc_conf(r, ngx_http_cache_purge_module);
+
+    if (ngx_array_init(&keys, r->pool, 4, NGX_HTTP_CACHE_KEY_LEN) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    part = &r->upstream->headers_in.headers.part;
+    h = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            h = part->elts;
+            i = 0;
+        }
+
+        if (h[i].key.len != cplcf->invalidate.len
+            || ngx_strncasecmp(h[i].key.data, cplcf->invalidate.data,
+                               cplcf->invalidate.len)
+               != 0)
+        {
+            continue;
+        }
+
+        /* comma separated list of cache keys */
+
+        start = h[i].value.data;
+        end = h[i].value.data + h[i].value.len;
+
+        for ( ;; ) {
+
+            while (start < end && (*start == ' ' || *start == ',')) {
+                start++;
+            }
+
+            if (start == end) {
+                break;
+            }
+
+            p = ngx_strlchr(start, end, ',');
+            if (p == NULL) {
+                p = end;
+            }
+
+            last = p;
+
+            while (last[-1] == ' ') {
+                last--;
+            }
+
+            key = ngx_array_push(&keys);
+            if (key == NULL) {
+                return NGX_ERROR;
+            }
+
+            ngx_md5_init(&md5);
+            ngx_md5_update(&md5, start, last - start);
+            ngx_md5_final(key, &md5);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http file cache invalidate: \"%*s\"",
+                           (size_t) (last - start), start);
+
+            start = p;
+        }
+    }
+
+    if (keys.nelts == 0) {
+        return NGX_OK;
+    }
+
+    if (cplcf->invalidate_cache) {
+        cache = ngx_http_cache_purge_file_cache((ngx_cycle_t *) ngx_cycle,
+                                                cplcf->invalidate_cache);
+
+    } else {
+        cache = r->cache ? r->cache->file_cache : NULL;
+    }
+
+    if (cache == NULL) {
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                      "no cache zone to invalidate \"%V\" in",
+                      &cplcf->invalidate);
+        return NGX_DECLINED;
+    }
+
+    cpmcf = ngx_http_get_module_main_conf(r, ngx_http_cache_purge_module);
+
+    if (ngx_http_cache_purge_hashes(&cplcf->post, cpmcf->shm_zone
+                                                  ? cpmcf->shm_zone->data
+                                                  : NULL,
+                                    r->pool, cache, keys.elts, keys.nelts,
+                                    &purged, NULL, r->connection->log)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache invalidated: %ui of %ui",
+                   purged, keys.nelts);
+
+    if (cpmcf->io_rate && purged) {
+        id = ngx_http_cache_purge_cache_id(cache);
+        (void) ngx_http_cache_purge_io_take(cpmcf, id, purged, 1, &delay);
+    }
+
+    return NGX_OK;
+}
+
+ngx_int_t
+ngx_http_cache_purge_unsafe(ngx_http_request_t *r)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_loc_conf_t   *cplcf;
+    ngx_http_complex_value_t          *cache_key;
+    ngx_http_file_cache_t             *cache;
+    ngx_http_upstream_t               *u;
+    ngx_http_cache_t                  *c;
+    ngx_str_t                          method_name;
+    ngx_uint_t                         method, purged;
+    ngx_msec_t                         delay;
+    ngx_int_t                          rc;
+    uint32_t                           id;
+    u_char                            *key;
+# if (NGX_HTTP_FASTCGI)
+    ngx_http_fastcgi_loc_conf_t       *flcf;
+# endif /* NGX_HTTP_FASTCGI */
+# if (NGX_HTTP_PROXY)
+    ngx_http_proxy_loc_conf_t         *plcf;
+# endif /* NGX_HTTP_PROXY */
+# if (NGX_HTTP_SCGI)
+    ngx_http_scgi_loc_conf_t          *slcf;
+# endif /* NGX_HTTP_SCGI */
+# if (NGX_HTTP_UWSGI)
+    ngx_http_uwsgi_loc_conf_t         *ulcf;
+# endif /* NGX_HTTP_UWSGI */
+
+    u = r->upstream;
+    cplcf = ngx_http_get_module_loc_conf(r, ngx_http_cache_purge_module);
+    cache_key = NULL;
+
+    /* cache key of the upstream module handling the request */
+
+# if (NGX_HTTP_FASTCGI)
+    flcf = ngx_http_get_module_loc_conf(r, ngx_http_fastcgi_module);
+
+    if (cplcf->fastcgi.unsafe && u->conf == &flcf->upstream) {
+        cache_key = &flcf->cache_key;
+    }
+# endif /* NGX_HTTP_FASTCGI */
+
+# if (NGX_HTTP_PROXY)
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_proxy_module);
+
+    if (cplcf->proxy.unsafe && u->conf == &plcf->upstream) {
+        cache_key = &plcf->cache_key;
+    }
+# endif /* NGX_HTTP_PROXY */
+
+# if (NGX_HTTP_SCGI)
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_scgi_module);
+
+    if (cplcf->scgi.unsafe && u->conf == &slcf->upstream) {
+        cache_key = &slcf->cache_key;
+    }
+# endif /* NGX_HTTP_SCGI */
+
+# if (NGX_HTTP_UWSGI)
+    ulcf = ngx_http_get_module_loc_conf(r, ngx_http_uwsgi_module);
+
+    if (cplcf->uwsgi.unsafe && u->conf == &ulcf->upstream) {
+        cache_key = &ulcf->cache_key;
+    }
+# endif /* NGX_HTTP_UWSGI */
+
+    if (cache_key == NULL) {
+        return NGX_DECLINED;
+    }
+
+#  if (nginx_version >= 1007009)
+
+    if (u->conf->cache <= 0) {
+        return NGX_DECLINED;
+    }
+
+    rc = ngx_http_cache_purge_cache_get(r, u, &cache);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+#  else
+
+    if (u->conf->cache == NULL) {
+        return NGX_DECLINED;
+    }
+
+    cache = u->conf->cache->data;
+
+#  endif /* nginx_version >= 1007009 */
+
+    /* evaluate cache key as if for a GET request of the same resource */
+
+    c = r->cache;
+    method = r->method;
+    method_name = r->method_name;
+
+    r->method = NGX_HTTP_GET;
+    ngx_str_set(&r->method_name, "GET");
+
+    rc = ngx_http_cache_purge_init(r, cache, cache_key);
+
+    r->method = method;
+    r->method_name = method_name;
+
+    if (rc != NGX_OK) {
+        r->cache = c;
+        return NGX_ERROR;
+    }
+
+#  if (nginx_version >= 1007007)
+    key = r->cache->main;
+#  else
+    key = r->cache->key;
+#  endif
+
+    r->cache = c;
+
+    /*
+     * the entry isn't opened, its header might need
+     * an aio read which can't be waited for here
+     */
+
+    cpmcf = ngx_http_get_module_main_conf(r, ngx_http_cache_purge_module);
+
+    if (ngx_http_cache_purge_hashes(&cplcf->post, cpmcf->shm_zone
+                                                  ? cpmcf->shm_zone->data
+                                                  : NULL,
+                                    r->pool, cache, key, 1, &purged, NULL,
+                                    r->connection->log)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache purge on unsafe method: %ui", purged);
+
+    id = ngx_http_cache_purge_cache_id(cache);
+
+    if (cpmcf->io_rate && purged) {
+        (void) ngx_http_cache_purge_io_take(cpmcf, id, purged, 1, &delay);
+    }
+
+    return NGX_OK;
+}
+
+ngx_int_t
+ngx_http_cache_purge_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
+{
+    ngx_http_cache_purge_ctx_t        *ctx;
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_loc_conf_t   *cplcf;
+    ngx_chain_t                       *cl;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_cache_purge_module);
+
+    if (ctx && ctx->rewarm) {
+
+        /* rewarm only needs the upstream module to store the response */
+
+        for (cl = in; cl; cl = cl->next) {
+            cl->buf->pos = cl->buf->last;
+            cl->buf->file_pos = cl->buf->file_last;
+        }
+
+        return NGX_OK;
+    }
+
+    /*
+     * by the time the body is sent, response header is already written
+     * to the cache buffer and c->key is set to the variant being stored
+     */
+
+    if (r->cache && r->upstream && r->upstream->cacheable
+        && (ctx == NULL || !ctx->stored))
+    {
+        cplcf = ngx_http_get_module_loc_conf(r, ngx_http_cache_purge_module);
+
+        if (cplcf->vary || cplcf->track_errors) {
+            if (ctx == NULL) {
+                ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_cache_purge_ctx_t));
+                if (ctx == NULL) {
+                    return NGX_ERROR;
+                }
+
+                ngx_http_set_ctx(r, ctx, ngx_http_cache_purge_module);
+            }
+
+            ctx->stored = 1;
+
+            cpmcf = ngx_http_get_module_main_conf(r,
+                                                  ngx_http_cache_purge_module);
+
+#  if (nginx_version >= 1007007)
+            if (cplcf->vary
+                && ngx_memcmp(r->cache->key, r->cache->main,
+                              NGX_HTTP_CACHE_KEY_LEN)
+                   != 0)
+            {
+                ngx_http_cache_purge_variant_add(r, cpmcf->shm_zone->data);
+            }
+#  endif /* nginx_version >= 1007007 */
+
+            if (cplcf->track_errors) {
+                ngx_http_cache_purge_error_add(r, cpmcf->shm_zone->data);
+            }
+        }
+    }
+
+    return ngx_http_next_body_filter(r, in);
+}
+
+ngx_int_t
+ngx_http_cache_purge_is_inspect(ngx_http_request_t *r,
+    ngx_http_cache_purge_loc_conf_t *cplcf)
+{
+    if (cplcf->inspect.len == 0
+        || r->method_name.len != cplcf->inspect.len
+        || ngx_strncmp(r->method_name.data, cplcf->inspect.data,
+                       cplcf->inspect.len)
+           != 0)
+    {
+        return NGX_DECLINED;
+    }
+
+    return NGX_OK;
+}
+
+ngx_int_t
+ngx_http_cache_purge_inspect(ngx_http_request_t *r)
+{
+    ngx_http_file_cache_node_t  *fcn;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_cache_t            *c;
+    ngx_chain_t                  out;
+    ngx_str_t                   *key, name;
+    ngx_buf_t                   *b;
+    ngx_uint_t                   exists, cold, uses, updating;
+    ngx_int_t                    rc;
+    time_t                       valid_sec, expire;
+    off_t                        fs_size;
+    size_t                       len;
+
+    c = r->cache;
+    cache = c->file_cache;
+    key = c->keys.elts;
+
+    exists = 0;
+    uses = 0;
+    updating = 0;
+    valid_sec = 0;
+    expire = 0;
+    fs_size = 0;
+
+    /* only the node is looked up, the file isn't touched */
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    cold = cache->sh->cold;
+
+    fcn = ngx_http_cache_purge_lookup(cache, c->key);
+
+    if (fcn) {
+        exists = fcn->exists;
+        uses = fcn->uses;
+#  if (nginx_version >= 8001) \
+       || ((nginx_version < 8000) && (nginx_version >= 7060))
+        updating = fcn->updating;
+#  endif
+        valid_sec = fcn->valid_sec;
+        expire = fcn->expire;
+#  if (nginx_version >= 1000001)
+        fs_size = fcn->fs_size * cache->bsize;
+#  else
+        fs_size = fcn->length;
+#  endif
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (ngx_http_cache_purge_file_name(r->pool, cache, c->key, &name)
+        != NGX_OK)
+    {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    len = sizeof("{\"key\":\"\",\"hash\":\"\",\"node\":false,"
+                 "\"exists\":false,\"cold\":false,\"fs_size\":,"
+                 "\"valid_sec\":,\"expire\":,\"uses\":,"
+                 "\"updating\":false,\"path\":\"\"}\n") - 1
+          + key[0].len + ngx_http_cache_purge_escape_json(NULL, key[0].data,
+                                                          key[0].len)
+          + 2 * NGX_HTTP_CACHE_KEY_LEN
+          + NGX_OFF_T_LEN + 2 * NGX_TIME_T_LEN + NGX_INT_T_LEN
+          + name.len + ngx_http_cache_purge_escape_json(NULL, name.data,
+                                                        name.len);
+
+    b = ngx_create_temp_buf(r->pool, len);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->last = ngx_cpymem(b->last, "{\"key\":\"", sizeof("{\"key\":\"") - 1);
+    b->last = (u_char *) ngx_http_cache_purge_escape_json(b->last, key[0].data,
+                                                          key[0].len);
+    b->last = ngx_cpymem(b->last, "\",\"hash\":\"",
+                         sizeof("\",\"hash\":\"") - 1);
+    b->last = ngx_hex_dump(b->last, c->key, NGX_HTTP_CACHE_KEY_LEN);
+
+    b->last = ngx_sprintf(b->last,
+                          "\",\"node\":%s,\"exists\":%s,\"cold\":%s,"
+                          "\"fs_size\":%O,\"valid_sec\":%T,\"expire\":%T,"
+                          "\"uses\":%ui,\"updating\":%s,\"path\":\"",
+                          fcn ? "true" : "false", exists ? "true" : "false",
+                          cold ? "true" : "false", fs_size, valid_sec, expire,
+                          uses, updating ? "true" : "false");
+
+    b->last = (u_char *) ngx_http_cache_purge_escape_json(b->last, name.data,
+                                                          name.len);
+    b->last = ngx_cpymem(b->last, "\"}\n", sizeof("\"}\n") - 1);
+    b->last_buf = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    r->headers_out.content_type.len = sizeof("application/json") - 1;
+    r->headers_out.content_type.data = (u_char *) "application/json";
+    r->headers_out.status = exists ? NGX_HTTP_OK : NGX_HTTP_NOT_FOUND;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    rc = ngx_http_send_header(r);
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+ngx_int_t
+ngx_http_file_cache_purge(ngx_http_request_t *r)
+{
+#  if (nginx_version >= 1007003)
+    ngx_http_cache_purge_loc_conf_t  *cplcf;
+#  endif /* nginx_version >= 1007003 */
+    ngx_http_file_cache_t            *cache;
+    ngx_http_cache_t                 *c;
+
+    switch (ngx_http_file_cache_open(r)) {
+    case NGX_OK:
+    case NGX_HTTP_CACHE_STALE:
+#  if (nginx_version >= 8001) \
+       || ((nginx_version < 8000) && (nginx_version >= 7060))
+    case NGX_HTTP_CACHE_UPDATING:
+#  endif
+        break;
+    case NGX_DECLINED:
+        return NGX_DECLINED;
+#  if (NGX_HAVE_FILE_AIO)
+    case NGX_AGAIN:
+        return NGX_AGAIN;
+#  endif
+    default:
+        return NGX_ERROR;
+    }
+
+    c = r->cache;
+    cache = c->file_cache;
+
+#  if (nginx_version >= 1007003)
+    cplcf = ngx_http_get_module_loc_conf(r, ngx_http_cache_purge_module);
+
+    if (cplcf->conditional
+        && ngx_http_cache_purge_precondition(r) != NGX_OK)
+    {
+        return NGX_HTTP_PRECONDITION_FAILED;
+    }
+#  endif /* nginx_version >= 1007003 */
+
+    /*
+     * delete file from disk but *keep* in-memory node,
+     * because other requests might still point to it.
+     */
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (!c->node->exists) {
+        /* race between concurrent purges, backoff */
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    ngx_http_cache_purge_retire(cache, c->node);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (ngx_delete_file(c->file.name.data) == NGX_FILE_ERROR) {
+        /* entry in error log is enough, don't notice client */
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", c->file.name.data);
+    }
+
+    /* file deleted from cache */
+    return NGX_OK;
+}
+
+#  if (nginx_version >= 1007003)
+
+ngx_int_t
+ngx_http_cache_purge_precondition(ngx_http_request_t *r)
+{
+    ngx_http_cache_t  *c;
+    ngx_table_elt_t   *h;
+    time_t             iums;
+
+    c = r->cache;
+
+    /* cached entry is "modified" when it's stored */
+
+    h = r->headers_in.if_unmodified_since;
+
+    if (h) {
+        iums = ngx_parse_http_time(h->value.data, h->value.len);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache purge ius:%T d:%T", iums, c->date);
+
+        if (iums == NGX_ERROR || c->date > iums) {
+            return NGX_DECLINED;
+        }
+    }
+
+    if (r->headers_in.if_match
+        && !ngx_http_cache_purge_test_if_match(&c->etag,
+                                               &r->headers_in.if_match->value))
+    {
+        return NGX_DECLINED;
+    }
+
+    return NGX_OK;
+}
+
+/*
+ * Based on: ngx_http_not_modified_filter_module.c/ngx_http_test_if_match
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+ngx_uint_t
+ngx_http_cache_purge_test_if_match(ngx_str_t *etag, ngx_str_t *list)
+{
+    u_char     *start, *end, ch;
+    ngx_str_t   tag;
+
+    if (list->len == 1 && list->data[0] == '*') {
+        return 1;
+    }
+
+    if (etag->len == 0) {
+        return 0;
+    }
+
+    /* weak comparison, purge doesn't care about byte-for-byte identity */
+
+    tag = *etag;
+
+    if (tag.len > 2 && tag.data[0] == 'W' && tag.data[1] == '/') {
+        tag.len -= 2;
+        tag.data += 2;
+    }
+
+    start = list->data;
+    end = list->data + list->len;
+
+    while (start < end) {
+
+        if (end - start > 2 && start[0] == 'W' && start[1] == '/') {
+            start += 2;
+        }
+
+        if (tag.len > (size_t) (end - start)) {
+            return 0;
+        }
+
+        if (ngx_strncmp(start, tag.data, tag.len) != 0) {
+            goto skip;
+        }
+
+        start += tag.len;
+
+        while (start < end) {
+            ch = *start;
+
+            if (ch == ' ' || ch == '\t') {
+                start++;
+                continue;
+            }
+
+            break;
+        }
+
+        if (start == end || *start == ',') {
+            return 1;
+        }
+
+    skip:
+
+        while (start < end && *start != ',') { start++; }
+        while (start < end) {
+            ch = *start;
+
+            if (ch == ' ' || ch == '\t' || ch == ',') {
+                start++;
+                continue;
+            }
+
+            break;
+        }
+    }
+
+    return 0;
+}
+
+#  endif /* nginx_version >= 1007003 */
+
+/*
+ * Based on: ngx_http_file_cache.c/ngx_http_file_cache_name
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+ngx_int_t
+ngx_http_cache_purge_file_name(ngx_pool_t *pool, ngx_http_file_cache_t *cache,
+    u_char *key, ngx_str_t *name)
+{
+    u_char      *p;
+    ngx_path_t  *path;
+
+    path = cache->path;
+
+    name->len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    name->data = ngx_pnalloc(pool, name->len + 1);
+    if (name->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(name->data, path->name.data, path->name.len);
+
+    p = name->data + path->name.len + 1 + path->len;
+    p = ngx_hex_dump(p, key, NGX_HTTP_CACHE_KEY_LEN);
+    *p = '\0';
+
+    ngx_create_hashed_filename(path, name->data, name->len);
+
+    return NGX_OK;
+}
+
+uintptr_t
+ngx_http_cache_purge_escape_json(u_char *dst, u_char *src, size_t size)
+{
+    u_char      ch;
+    ngx_uint_t  len;
+
+    static u_char  hex[] = "0123456789abcdef";
+
+    if (dst == NULL) {
+        len = 0;
+
+        while (size) {
+            ch = *src++;
+
+            if (ch == '\\' || ch == '"') {
+                len++;
+
+            } else if (ch < 0x20) {
+                len += sizeof("\\u0000") - 2;
+            }
+
+            size--;
+        }
+
+        return (uintptr_t) len;
+    }
+
+    while (size) {
+        ch = *src++;
+
+        if (ch < 0x20) {
+            *dst++ = '\\';
+            *dst++ = 'u';
+            *dst++ = '0';
+            *dst++ = '0';
+            *dst++ = hex[ch >> 4];
+            *dst++ = hex[ch & 0xf];
+
+        } else {
+            if (ch == '\\' || ch == '"') {
+                *dst++ = '\\';
+            }
+
+            *dst++ = ch;
+        }
+
+        size--;
+    }
+
+    return (uintptr_t) dst;
+}
+
+ngx_msec_t
+ngx_http_cache_purge_msec(void)
+{
+    ngx_time_t  *tp;
+
+    /* wall clock, comparable between worker processes */
+
+    tp = ngx_timeofday();
+
+    return (ngx_msec_t) (tp->sec * 1000 + tp->msec);
+}
+
+uint32_t
+ngx_http_cache_purge_cache_id(ngx_http_file_cache_t *cache)
+{
+    return ngx_crc32_short(cache->shm_zone->shm.name.data,
+                           cache->shm_zone->shm.name.len);
+}
+
+ngx_int_t
+ngx_http_cache_purge_recent_lookup(ngx_http_cache_purge_zone_t *zone,
+    uint32_t cache, u_char *key, ngx_msec_t window, ngx_int_t *rc)
+{
+    ngx_http_cache_purge_recent_t  *rp;
+    ngx_msec_int_t                  age;
+    ngx_int_t                       found;
+
+    found = NGX_DECLINED;
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    rp = (ngx_http_cache_purge_recent_t *)
+             ngx_http_cache_purge_find(&zone->sh->rbtree, cache, key);
+
+    if (rp) {
+        age = (ngx_msec_int_t) (ngx_http_cache_purge_msec() - rp->purged);
+
+        if (age >= 0 && (ngx_msec_t) age < window) {
+            *rc = rp->rc;
+            found = NGX_OK;
+        }
+    }
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    return found;
+}
+
+void
+ngx_http_cache_purge_recent_add(ngx_http_cache_purge_zone_t *zone,
+    uint32_t cache, u_char *key, ngx_int_t rc, ngx_msec_t retain,
+    ngx_log_t *log)
+{
+    ngx_http_cache_purge_recent_t  *rp;
+    ngx_msec_t                      now;
+
+    now = ngx_http_cache_purge_msec();
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    ngx_http_cache_purge_recent_expire(zone, 0);
+
+    rp = (ngx_http_cache_purge_recent_t *)
+             ngx_http_cache_purge_find(&zone->sh->rbtree, cache, key);
+
+    if (rp == NULL) {
+        rp = ngx_slab_alloc_locked(zone->shpool,
+                                   sizeof(ngx_http_cache_purge_recent_t));
+
+        if (rp == NULL) {
+            ngx_http_cache_purge_recent_expire(zone, 1);
+
+            rp = ngx_slab_alloc_locked(zone->shpool,
+                                       sizeof(ngx_http_cache_purge_recent_t));
+            if (rp == NULL) {
+                ngx_shmtx_unlock(&zone->shpool->mutex);
+
+                /* recent purges are only a hint, don't fail the purge */
+                ngx_log_error(NGX_LOG_WARN, log, 0,
+                              "could not allocate recent purge node%s",
+                              zone->shpool->log_ctx);
+                return;
+            }
+        }
+
+        ngx_memcpy((u_char *) &rp->sn.node.key, key,
+                   sizeof(ngx_rbtree_key_t));
+        ngx_memcpy(rp->sn.key, key, NGX_HTTP_CACHE_KEY_LEN);
+        rp->sn.cache = cache;
+        rp->expire = now;
+
+        ngx_rbtree_insert(&zone->sh->rbtree, &rp->sn.node);
+
+    } else {
+        ngx_queue_remove(&rp->sn.queue);
+    }
+
+    rp->purged = now;
+    rp->sequence = ngx_atomic_fetch_add(&zone->sh->sequence, 1) + 1;
+    rp->rc = rc;
+
+    if ((ngx_msec_int_t) (now + retain - rp->expire) > 0) {
+        rp->expire = now + retain;
+    }
+
+    ngx_queue_insert_head(&zone->sh->queue, &rp->sn.queue);
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+}
+
+ngx_int_t
+ngx_http_cache_purge_fenced(ngx_http_request_t *r)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_recent_t     *rp;
+    ngx_http_cache_purge_zone_t       *zone;
+    ngx_http_cache_purge_ctx_t        *ctx;
+    ngx_http_cache_t                  *c;
+    ngx_msec_t                         started;
+    ngx_int_t                          fenced;
+    uint32_t                           cache;
+    u_char                            *key;
+
+    cpmcf = ngx_http_get_module_main_conf(r, ngx_http_cache_purge_module);
+    ctx = ngx_http_get_module_ctx(r, ngx_http_cache_purge_module);
+
+    c = r->cache;
+    zone = cpmcf->shm_zone->data;
+    cache = ngx_http_cache_purge_cache_id(c->file_cache);
+
+#  if (nginx_version >= 1007007)
+    key = c->main;
+#  else
+    key = c->key;
+#  endif
+
+    started = (ngx_msec_t) (r->start_sec * 1000 + r->start_msec);
+
+    fenced = NGX_DECLINED;
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    rp = (ngx_http_cache_purge_recent_t *)
+             ngx_http_cache_purge_find(&zone->sh->rbtree, cache, key);
+
+    /*
+     * purges are ordered exactly against requests by their sequence;
+     * the start time, of the same millisecond as many purges, only serves
+     * requests which didn't get a sequence, and counts them as later
+     */
+
+    if (rp) {
+        if (ctx && ctx->sequenced) {
+            if ((ngx_atomic_int_t) (rp->sequence - ctx->sequence) > 0) {
+                fenced = NGX_OK;
+            }
+
+        } else if ((ngx_msec_int_t) (rp->purged - started) > 0) {
+            fenced = NGX_OK;
+        }
+    }
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    return fenced;
+}
+
+ngx_int_t
+ngx_http_cache_purge_fence_handler(ngx_http_request_t *r)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_loc_conf_t   *cplcf;
+    ngx_http_cache_purge_zone_t       *zone;
+    ngx_http_cache_purge_ctx_t        *ctx;
+
+    cplcf = ngx_http_get_module_loc_conf(r, ngx_http_cache_purge_module);
+
+    if (cplcf->fence == 0) {
+        return NGX_DECLINED;
+    }
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_cache_purge_module);
+
+    if (ctx == NULL) {
+        ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_cache_purge_ctx_t));
+        if (ctx == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        ngx_http_set_ctx(r, ctx, ngx_http_cache_purge_module);
+
+    } else if (ctx->sequenced) {
+        return NGX_DECLINED;
+    }
+
+    /* purges after this one are after the request started */
+
+    cpmcf = ngx_http_get_module_main_conf(r, ngx_http_cache_purge_module);
+    zone = cpmcf->shm_zone->data;
+
+    ctx->sequence = zone->sh->sequence;
+    ctx->sequenced = 1;
+
+    return NGX_DECLINED;
+}
+
+void
+ngx_http_cache_purge_recent_expire(ngx_http_cache_purge_zone_t *zone,
+    ngx_uint_t force)
+{
+    ngx_msec_t                      now;
+    ngx_queue_t                    *q;
+    ngx_uint_t                      n;
+    ngx_http_cache_purge_recent_t  *rp;
+
+    now = ngx_http_cache_purge_msec();
+
+    /*
+     * force == 0 deletes one or two expired entries,
+     * force == 1 deletes the oldest entry by force
+     * and one or two expired entries
+     */
+
+    for (n = 0; n < 3; n++) {
+
+        if (ngx_queue_empty(&zone->sh->queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&zone->sh->queue);
+
+        rp = (ngx_http_cache_purge_recent_t *)
+                 ngx_queue_data(q, ngx_http_cache_purge_node_t, queue);
+
+        if ((!force || n) && (ngx_msec_int_t) (now - rp->expire) < 0) {
+            return;
+        }
+
+        ngx_queue_remove(q);
+
+        ngx_rbtree_delete(&zone->sh->rbtree, &rp->sn.node);
+
+        ngx_slab_free_locked(zone->shpool, rp);
+    }
+}
+
+ngx_http_cache_purge_node_t *
+ngx_http_cache_purge_find(ngx_rbtree_t *rbtree, uint32_t cache, u_char *key)
+{
+    ngx_int_t                     rc;
+    ngx_rbtree_key_t              node_key;
+    ngx_rbtree_node_t            *node, *sentinel;
+    ngx_http_cache_purge_node_t  *sn;
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = rbtree->root;
+    sentinel = rbtree->sentinel;
+
+    while (node != sentinel) {
+
+        if (node_key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* node_key == node->key */
+
+        sn = (ngx_http_cache_purge_node_t *) node;
+
+        if (cache != sn->cache) {
+            node = (cache < sn->cache) ? node->left : node->right;
+            continue;
+        }
+
+        rc = ngx_memcmp(key, sn->key, NGX_HTTP_CACHE_KEY_LEN);
+
+        if (rc == 0) {
+            return sn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    /* not found */
+
+    return NULL;
+}
+
+ngx_rbtree_node_t *
+ngx_http_cache_purge_find_next(ngx_rbtree_t *rbtree, uint32_t cache,
+    u_char *key)
+{
+    ngx_int_t                     rc;
+    ngx_rbtree_key_t              node_key;
+    ngx_rbtree_node_t            *node, *sentinel, *next;
+    ngx_http_cache_purge_node_t  *sn;
+
+    /* first node ordered after the key, as in lookup_next() */
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = rbtree->root;
+    sentinel = rbtree->sentinel;
+    next = NULL;
+
+    while (node != sentinel) {
+
+        sn = (ngx_http_cache_purge_node_t *) node;
+
+        if (node_key != node->key) {
+            rc = (node_key < node->key) ? -1 : 1;
+
+        } else if (cache != sn->cache) {
+            rc = (cache < sn->cache) ? -1 : 1;
+
+        } else {
+            rc = ngx_memcmp(key, sn->key, NGX_HTTP_CACHE_KEY_LEN);
+        }
+
+        if (rc < 0) {
+            next = node;
+            node = node->left;
+
+        } else {
+            node = node->right;
+        }
+    }
+
+    return next;
+}
+
+/*
+ * Based on: ngx_http_file_cache.c/ngx_http_file_cache_rbtree_insert_value
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+void
+ngx_http_cache_purge_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t            **p;
+    ngx_http_cache_purge_node_t   *sn, *snt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            sn = (ngx_http_cache_purge_node_t *) node;
+            snt = (ngx_http_cache_purge_node_t *) temp;
+
+            if (sn->cache != snt->cache) {
+                p = (sn->cache < snt->cache) ? &temp->left : &temp->right;
+
+            } else {
+                p = (ngx_memcmp(sn->key, snt->key, NGX_HTTP_CACHE_KEY_LEN)
+                     < 0) ? &temp->left : &temp->right;
+            }
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+/*
+ * Based on: ngx_http_file_cache.c/ngx_http_file_cache_lookup
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+ngx_http_file_cache_node_t *
+ngx_http_cache_purge_lookup(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_int_t                    rc;
+    ngx_rbtree_key_t             node_key;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_http_file_cache_node_t  *fcn;
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (node_key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* node_key == node->key */
+
+        fcn = (ngx_http_file_cache_node_t *) node;
+
+        rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                        NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        if (rc == 0) {
+            return fcn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    /* not found */
+
+    return NULL;
+}
+
+ngx_rbtree_node_t *
+ngx_http_cache_purge_lookup_first(ngx_http_file_cache_t *cache,
+    ngx_rbtree_key_t node_key)
+{
+    ngx_rbtree_node_t  *node, *sentinel, *first;
+
+    /* first node with the node key given or greater */
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+    first = NULL;
+
+    while (node != sentinel) {
+
+        if (node_key <= node->key) {
+            first = node;
+            node = node->left;
+
+        } else {
+            node = node->right;
+        }
+    }
+
+    return first;
+}
+
+ngx_rbtree_node_t *
+ngx_http_cache_purge_lookup_next(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_int_t                    rc;
+    ngx_rbtree_key_t             node_key;
+    ngx_rbtree_node_t           *node, *sentinel, *next;
+    ngx_http_file_cache_node_t  *fcn;
+
+    /* first node ordered after the key, which doesn't have to exist */
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+    next = NULL;
+
+    while (node != sentinel) {
+
+        if (node_key != node->key) {
+            rc = (node_key < node->key) ? -1 : 1;
+
+        } else {
+            fcn = (ngx_http_file_cache_node_t *) node;
+
+            rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                            NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+        }
+
+        if (rc < 0) {
+            next = node;
+            node = node->left;
+
+        } else {
+            node = node->right;
+        }
+    }
+
+    return next;
+}
+
+/*
+ * Based on: ngx_rbtree.c/ngx_rbtree_next
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+ngx_rbtree_node_t *
+ngx_http_cache_purge_rbtree_next(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
+{
+    ngx_rbtree_node_t  *root, *sentinel, *parent;
+
+    sentinel = tree->sentinel;
+
+    if (node->right != sentinel) {
+        return ngx_rbtree_min(node->right, sentinel);
+    }
+
+    root = tree->root;
+
+    for ( ;; ) {
+        parent = node->parent;
+
+        if (node == root) {
+            return NULL;
+        }
+
+        if (node == parent->left) {
+            return parent;
+        }
+
+        node = parent;
+    }
+}
+
+ngx_int_t
+ngx_http_cache_purge_hex_key(u_char *key, u_char *p, size_t len)
+{
+    ngx_int_t   n;
+    ngx_uint_t  i;
+
+    if (len != 2 * NGX_HTTP_CACHE_KEY_LEN) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < NGX_HTTP_CACHE_KEY_LEN; i++) {
+        n = ngx_hextoi(&p[2 * i], 2);
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        key[i] = (u_char) n;
+    }
+
+    return NGX_OK;
+}
+
+void
+ngx_http_cache_purge_retire(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    /* cache zone must be locked by the caller */
+
+#  if (nginx_version >= 1000001)
+    cache->sh->size -= fcn->fs_size;
+    fcn->fs_size = 0;
+#  else
+    cache->sh->size -= (fcn->length + cache->bsize - 1) / cache->bsize;
+    fcn->length = 0;
+#  endif
+
+    fcn->exists = 0;
+#  if (nginx_version >= 8001) \
+       || ((nginx_version < 8000) && (nginx_version >= 7060))
+    fcn->updating = 0;
+#  endif
+}
+
+ngx_int_t
+ngx_http_cache_purge_entries(ngx_pool_t *pool, ngx_http_file_cache_t *cache,
+    u_char *keys, ngx_uint_t n, ngx_uint_t *purged, u_char *results,
+    ngx_log_t *log)
+{
+    ngx_http_file_cache_node_t  *fcn;
+    ngx_str_t                    name;
+    ngx_uint_t                   i, b, cold, probe;
+    u_char                      *key;
+    u_char                       state[NGX_HTTP_CACHE_PURGE_BATCH];
+
+    *purged = 0;
+
+    if (n == 0) {
+        return NGX_OK;
+    }
+
+    if (results) {
+        ngx_memzero(results, n);
+    }
+
+    /* all names share the path and the length, only the hash differs */
+
+    if (ngx_http_cache_purge_file_name(pool, cache, keys, &name) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    for ( /* void */ ; n; n -= b, keys += b * NGX_HTTP_CACHE_KEY_LEN) {
+
+        b = ngx_min(n, NGX_HTTP_CACHE_PURGE_BATCH);
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        cold = cache->sh->cold;
+
+        for (i = 0; i < b; i++) {
+            key = &keys[i * NGX_HTTP_CACHE_KEY_LEN];
+
+            fcn = ngx_http_cache_purge_lookup(cache, key);
+
+            if (fcn == NULL) {
+                /*
+                 * without a node, the file might still be on disk
+                 * only if the cache loader didn't get to it yet
+                 */
+
+                state[i] = cold ? NGX_HTTP_CACHE_PURGE_PROBE
+                                : NGX_HTTP_CACHE_PURGE_MISSING;
+                continue;
+            }
+
+            if (!fcn->exists) {
+                state[i] = NGX_HTTP_CACHE_PURGE_MISSING;
+                continue;
+            }
+
+            ngx_http_cache_purge_retire(cache, fcn);
+
+            state[i] = NGX_HTTP_CACHE_PURGE_RETIRED;
+        }
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        for (i = 0; i < b; i++) {
+
+            if (state[i] == NGX_HTTP_CACHE_PURGE_MISSING) {
+                continue;
+            }
+
+            key = &keys[i * NGX_HTTP_CACHE_KEY_LEN];
+            probe = (state[i] == NGX_HTTP_CACHE_PURGE_PROBE);
+
+            if (ngx_http_cache_purge_unlink(cache, &name, key, probe, log)
+                == NGX_DECLINED)
+            {
+                continue;
+            }
+
+            if (results) {
+                results[i] = 1;
+            }
+
+            (*purged)++;
+        }
+
+        if (results) {
+            results += b;
+        }
+    }
+
+    return NGX_OK;
+}
+
+/*
+ * Purges entries stored under the hashes of cache keys, followed by
+ * the same steps as purges of single keys do: variants of the entries
+ * are purged too and the keys are recorded for coalescing and fencing,
+ * as set in "post".  Whether anything was purged for each key is set
+ * in "results", if given.
+ */
+ngx_int_t
+ngx_http_cache_purge_hashes(ngx_http_cache_purge_post_t *post,
+    ngx_http_cache_purge_zone_t *zone, ngx_pool_t *pool,
+    ngx_http_file_cache_t *cache, u_char *keys, ngx_uint_t n,
+    ngx_uint_t *purged, u_char *results, ngx_log_t *log)
+{
+    ngx_uint_t   i;
+    uint32_t     id;
+#  if (nginx_version >= 1007007)
+    ngx_array_t  variants;
+    ngx_uint_t   m;
+#  endif
+
+    *purged = 0;
+
+    if (n == 0) {
+        return NGX_OK;
+    }
+
+    if (results == NULL) {
+        results = ngx_pnalloc(pool, n);
+        if (results == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (ngx_http_cache_purge_entries(pool, cache, keys, n, purged, results,
+                                     log)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    /* the rest is kept in the purge zone */
+
+    if (zone == NULL) {
+        return NGX_OK;
+    }
+
+    id = ngx_http_cache_purge_cache_id(cache);
+
+#  if (nginx_version >= 1007007)
+
+    if (post->vary) {
+        if (ngx_array_init(&variants, pool, 4, NGX_HTTP_CACHE_KEY_LEN)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        for (i = 0; i < n; i++) {
+            variants.nelts = 0;
+
+            ngx_http_cache_purge_variant_keys(zone, id,
+                                              &keys[i * NGX_HTTP_CACHE_KEY_LEN],
+                                              NULL, &variants);
+
+            if (ngx_http_cache_purge_entries(pool, cache, variants.elts,
+                                             variants.nelts, &m, NULL, log)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            if (m) {
+                results[i] = 1;
+                *purged += m;
+            }
+        }
+    }
+
+#  endif /* nginx_version >= 1007007 */
+
+    /*
+     * the fence is recorded for missing entries too,
+     * their responses might still be on the way from upstream
+     */
+
+    if (post->retain) {
+        for (i = 0; i < n; i++) {
+            ngx_http_cache_purge_recent_add(zone, id,
+                                            &keys[i * NGX_HTTP_CACHE_KEY_LEN],
+                                            results[i] ? NGX_OK : NGX_DECLINED,
+                                            post->retain, log);
+        }
+    }
+
+    return NGX_OK;
+}
+
+ngx_int_t
+ngx_http_cache_purge_unlink(ngx_http_file_cache_t *cache, ngx_str_t *name,
+    u_char *key, ngx_uint_t probe, ngx_log_t *log)
+{
+    ngx_path_t  *path;
+    u_char      *p;
+
+    path = cache->path;
+
+    p = name->data + path->name.len + 1 + path->len;
+    (void) ngx_hex_dump(p, key, NGX_HTTP_CACHE_KEY_LEN);
+
+    ngx_create_hashed_filename(path, name->data, name->len);
+
+    if (ngx_delete_file(name->data) == NGX_FILE_ERROR) {
+
+        if (ngx_errno == NGX_ENOENT && probe) {
+            return NGX_DECLINED;
+        }
+
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", name->data);
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "http file cache purge entry: \"%s\"", name->data);
+
+    return NGX_OK;
+}
+
+ngx_int_t
+ngx_http_cache_purge_slices(ngx_http_request_t *r, ngx_uint_t *purged)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_loc_conf_t   *cplcf;
+    ngx_http_cache_t                  *c;
+    ngx_str_t                         *key, val;
+    ngx_md5_t                          base, md5;
+    ngx_uint_t                         i, j, n, b, count, discover;
+    off_t                              start, length;
+    size_t                             len;
+    u_char                            *keys;
+    u_char                             range[sizeof("bytes=-") - 1
+                                             + 2 * NGX_OFF_T_LEN];
+
+    cplcf = ngx_http_get_module_loc_conf(r, ngx_http_cache_purge_module);
+    cpmcf = ngx_http_get_module_main_conf(r, ngx_http_cache_purge_module);
+
+    c = r->cache;
+    key = c->keys.elts;
+
+    *purged = 0;
+
+    if (cplcf->slice_length) {
+        if (ngx_http_complex_value(r, cplcf->slice_length, &val) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        length = ngx_atoof(val.data, val.len);
+
+        if (length == NGX_ERROR) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "invalid cache purge slice length \"%V\"", &val);
+            return NGX_ERROR;
+        }
+
+        n = (length + cplcf->slice - 1) / cplcf->slice;
+        n = ngx_min(n, cplcf->slice_max);
+        discover = 0;
+
+    } else {
+        /* walk the slices until a whole batch of them is missing */
+        n = cplcf->slice_max;
+        discover = 1;
+    }
+
+    keys = ngx_pnalloc(r->pool,
+                       NGX_HTTP_CACHE_PURGE_BATCH * NGX_HTTP_CACHE_KEY_LEN);
+    if (keys == NULL) {
+        return NGX_ERROR;
+    }
+
+    /*
+     * slice keys are the purged key followed by $slice_range,
+     * hashed the same way ngx_http_file_cache_create_key() does
+     */
+
+    ngx_md5_init(&base);
+    ngx_md5_update(&base, key[0].data, key[0].len);
+
+    start = 0;
+
+    for (i = 0; i < n; i += b) {
+
+        b = ngx_min(n - i, NGX_HTTP_CACHE_PURGE_BATCH);
+
+        for (j = 0; j < b; j++) {
+            len = ngx_sprintf(range, "bytes=%O-%O",
+                              start, start + (off_t) cplcf->slice - 1)
+                  - range;
+
+            md5 = base;
+            ngx_md5_update(&md5, range, len);
+            ngx_md5_final(&keys[j * NGX_HTTP_CACHE_KEY_LEN], &md5);
+
+            start += cplcf->slice;
+        }
+
+        if (cplcf->rate) {
+            count = *purged;
+
+            /* slice purges aren't fenced, same as the ones done right away */
+
+            if (ngx_http_cache_purge_spread(cplcf, NULL,
+                                            cpmcf->shm_zone->data,
+                                            c->file_cache, keys, b, NULL,
+                                            purged, r->connection->log)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            count = *purged - count;
+
+        } else {
+            if (ngx_http_cache_purge_entries(r->pool, c->file_cache, keys, b,
+                                             &count, NULL, r->connection->log)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            *purged += count;
+        }
+
+        if (discover && count == 0) {
+            break;
+        }
+    }
+
+    return NGX_OK;
+}
+
+ngx_http_file_cache_t *
+ngx_http_cache_purge_file_cache(ngx_cycle_t *cycle, uint32_t id)
+{
+    ngx_shm_zone_t   *shm_zone;
+    ngx_list_part_t  *part;
+    ngx_uint_t        i;
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        if (!ngx_http_cache_purge_is_file_cache(&shm_zone[i])) {
+            continue;
+        }
+
+        if (ngx_crc32_short(shm_zone[i].shm.name.data,
+                            shm_zone[i].shm.name.len)
+            == id)
+        {
+            return shm_zone[i].data;
+        }
+    }
+
+    return NULL;
+}
+
+ngx_uint_t
+ngx_http_cache_purge_is_file_cache(ngx_shm_zone_t *shm_zone)
+{
+    /* cache zones are tagged with the module that defined them */
+
+#  if (NGX_HTTP_FASTCGI)
+    if (shm_zone->tag == &ngx_http_fastcgi_module) {
+        return 1;
+    }
+#  endif /* NGX_HTTP_FASTCGI */
+
+#  if (NGX_HTTP_PROXY)
+    if (shm_zone->tag == &ngx_http_proxy_module) {
+        return 1;
+    }
+#  endif /* NGX_HTTP_PROXY */
+
+#  if (NGX_HTTP_SCGI)
+    if (shm_zone->tag == &ngx_http_scgi_module) {
+        return 1;
+    }
+#  endif /* NGX_HTTP_SCGI */
+
+#  if (NGX_HTTP_UWSGI)
+    if (shm_zone->tag == &ngx_http_uwsgi_module) {
+        return 1;
+    }
+#  endif /* NGX_HTTP_UWSGI */
+
+    return 0;
+}
+
+ngx_int_t
+ngx_http_cache_purge_schedule(ngx_http_request_t *r, time_t *due)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_loc_conf_t   *cplcf;
+    ngx_http_cache_purge_zone_t       *zone;
+    ngx_str_t                          val;
+    ngx_int_t                          rc;
+    uint32_t                           id;
+    time_t                             at;
+
+    cplcf = ngx_http_get_module_loc_conf(r, ngx_http_cache_purge_module);
+
+    if (ngx_http_complex_value(r, cplcf->schedule, &val) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (val.len == 0) {
+        return NGX_DECLINED;
+    }
+
+    /* seconds since the epoch or HTTP date */
+
+    at = ngx_atotm(val.data, val.len);
+
+    if (at == NGX_ERROR) {
+        at = ngx_parse_http_time(val.data, val.len);
+
+        if (at == NGX_ERROR) {
+            ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                          "invalid purge schedule \"%V\"", &val);
+            return NGX_HTTP_BAD_REQUEST;
+        }
+    }
+
+    if (cplcf->schedule_jitter) {
+        at += ngx_random() % (cplcf->schedule_jitter + 1);
+    }
+
+    if (at <= ngx_time()) {
+        /* due already, purge right away */
+        return NGX_DECLINED;
+    }
+
+    cpmcf = ngx_http_get_module_main_conf(r, ngx_http_cache_purge_module);
+
+    zone = cpmcf->shm_zone->data;
+    id = ngx_http_cache_purge_cache_id(r->cache->file_cache);
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    rc = ngx_http_cache_purge_job_add_locked(zone, id, r->cache->key,
+                                             &cplcf->post, &at,
+                                             r->connection->log);
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    if (rc != NGX_OK) {
+        return NGX_HTTP_SERVICE_UNAVAILABLE;
+    }
+
+    *due = at;
+
+    return NGX_OK;
+}
+
+/*
+ * Queues purges of the entries stored under the hashes of cache keys, to
+ * be done from the timer wheel at "cache_purge_rate" of "cplcf" entries
+ * per second.  The rate is a budget of the cache zone kept in the purge
+ * zone, shared by all purges of the cache zone.  Only entries found in the
+ * cache are queued, which is set in "results", if given.
+ */
+ngx_int_t
+ngx_http_cache_purge_spread(ngx_http_cache_purge_loc_conf_t *cplcf,
+    ngx_http_cache_purge_post_t *post, ngx_http_cache_purge_zone_t *zone,
+    ngx_http_file_cache_t *cache, u_char *keys, ngx_uint_t n,
+    u_char *results, ngx_uint_t *queued, ngx_log_t *log)
+{
+    ngx_http_cache_purge_bucket_t  *bucket;
+    ngx_http_file_cache_node_t     *fcn;
+    ngx_uint_t                      i, b;
+    ngx_int_t                       rc;
+    uint32_t                        id;
+    time_t                          now, due;
+    u_char                         *key;
+    u_char                          exists[NGX_HTTP_CACHE_PURGE_BATCH];
+
+    id = ngx_http_cache_purge_cache_id(cache);
+
+    now = ngx_time();
+    rc = NGX_OK;
+
+    for ( /* void */ ; n; n -= b, keys += b * NGX_HTTP_CACHE_KEY_LEN) {
+
+        b = ngx_min(n, NGX_HTTP_CACHE_PURGE_BATCH);
+
+        /* only entries known to the cache are worth a job */
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        for (i = 0; i < b; i++) {
+            key = &keys[i * NGX_HTTP_CACHE_KEY_LEN];
+
+            fcn = ngx_http_cache_purge_lookup(cache, key);
+
+            exists[i] = (fcn && fcn->exists);
+        }
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        if (results) {
+            ngx_memcpy(results, exists, b);
+        }
+
+        ngx_shmtx_lock(&zone->shpool->mutex);
+
+        bucket = ngx_http_cache_purge_bucket_locked(zone, id);
+
+        for (i = 0; i < b; i++) {
+
+            if (!exists[i]) {
+                continue;
+            }
+
+            key = &keys[i * NGX_HTTP_CACHE_KEY_LEN];
+
+            if (bucket == NULL) {
+                /* paced by this purge alone */
+                due = now + 1 + *queued / cplcf->rate;
+
+            } else {
+                if (bucket->rate_due <= now) {
+                    bucket->rate_due = now + 1;
+                    bucket->rate_queued = 0;
+
+                } else if (bucket->rate_queued >= cplcf->rate) {
+                    bucket->rate_due++;
+                    bucket->rate_queued = 0;
+                }
+
+                due = bucket->rate_due;
+                bucket->rate_queued++;
+            }
+
+            if (cplcf->rate_jitter) {
+                due += ngx_random() % (cplcf->rate_jitter + 1);
+            }
+
+            rc = ngx_http_cache_purge_job_add_locked(zone, id, key, post,
+                                                     &due, log);
+            if (rc != NGX_OK) {
+                break;
+            }
+
+            (*queued)++;
+        }
+
+        ngx_shmtx_unlock(&zone->shpool->mutex);
+
+        if (rc != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (results) {
+            results += b;
+        }
+    }
+
+    return NGX_OK;
+}
+
+ngx_int_t
+ngx_http_cache_purge_job_add_locked(ngx_http_cache_purge_zone_t *zone,
+    uint32_t cache, u_char *key, ngx_http_cache_purge_post_t *post,
+    time_t *due, ngx_log_t *log)
+{
+    ngx_http_cache_purge_job_t  *job;
+
+    job = ngx_slab_alloc_locked(zone->shpool,
+                                sizeof(ngx_http_cache_purge_job_t));
+    if (job == NULL) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "could not allocate scheduled purge%s",
+                      zone->shpool->log_ctx);
+        return NGX_ERROR;
+    }
+
+    /* clocks of worker processes might differ a bit */
+
+    if (*due <= zone->sh->wheel_last) {
+        *due = zone->sh->wheel_last + 1;
+    }
+
+    job->due = *due;
+    job->cache = cache;
+
+    if (post) {
+        job->post = *post;
+
+    } else {
+        ngx_memzero(&job->post, sizeof(ngx_http_cache_purge_post_t));
+    }
+
+    ngx_memcpy(job->key, key, NGX_HTTP_CACHE_KEY_LEN);
+
+    ngx_queue_insert_tail(&zone->sh->wheel[*due % NGX_HTTP_CACHE_PURGE_WHEEL],
+                          &job->queue);
+
+    zone->sh->scheduled++;
+
+    return NGX_OK;
+}
+
+#  if (NGX_HAVE_UNIX_DOMAIN)
+
+ngx_int_t
+ngx_http_cache_purge_init_module(ngx_cycle_t *cycle)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_pool_cleanup_t                *cln;
+    struct sockaddr_un                *saun;
+    ngx_socket_t                       s;
+
+    cpmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                                ngx_http_cache_purge_module);
+
+    if (cpmcf == NULL || cpmcf->listen == NULL) {
+        return NGX_OK;
+    }
+
+    /* the socket of the running configuration must not be touched */
+
+    if (ngx_test_config) {
+        return NGX_OK;
+    }
+
+    saun = (struct sockaddr_un *) cpmcf->listen->sockaddr;
+
+    s = ngx_socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (s == (ngx_socket_t) -1) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_socket_errno,
+                      ngx_socket_n " %V failed", &cpmcf->listen->name);
+        return NGX_ERROR;
+    }
+
+    if (ngx_nonblocking(s) == -1) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_socket_errno,
+                      ngx_nonblocking_n " %V failed", &cpmcf->listen->name);
+        goto failed;
+    }
+
+    /* socket of the previous configuration or of a crashed master */
+
+    if (ngx_delete_file(saun->sun_path) == NGX_FILE_ERROR
+        && ngx_errno != NGX_ENOENT)
+    {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      ngx_delete_file_n " %s failed", saun->sun_path);
+        goto failed;
+    }
+
+    if (bind(s, cpmcf->listen->sockaddr, cpmcf->listen->socklen) == -1) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_socket_errno,
+                      "bind() to %V failed", &cpmcf->listen->name);
+        goto failed;
+    }
+
+    if (chmod(saun->sun_path, (mode_t) cpmcf->listen_mode) == -1) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "chmod() \"%s\" failed", saun->sun_path);
+        goto failed;
+    }
+
+    cln = ngx_pool_cleanup_add(cycle->pool, 0);
+    if (cln == NULL) {
+        goto failed;
+    }
+
+    cpmcf->fd = s;
+
+    cln->handler = ngx_http_cache_purge_close_listen;
+    cln->data = cpmcf;
+
+    return NGX_OK;
+
+failed:
+
+    if (ngx_close_socket(s) == -1) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_socket_errno,
+                      ngx_close_socket_n " %V failed", &cpmcf->listen->name);
+    }
+
+    return NGX_ERROR;
+}
+
+void
+ngx_http_cache_purge_close_listen(void *data)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf = data;
+
+    /* the path is left to the socket of the next configuration */
+
+    (void) ngx_close_socket(cpmcf->fd);
+}
+
+#  endif /* NGX_HAVE_UNIX_DOMAIN */
+
+ngx_int_t
+ngx_http_cache_purge_init_process(ngx_cycle_t *cycle)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_event_t                       *ev;
+#  if (NGX_HAVE_UNIX_DOMAIN)
+    ngx_connection_t                  *c;
+#  endif
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE
+        && ngx_process != NGX_PROCESS_HELPER)
+    {
+        return NGX_OK;
+    }
+
+    cpmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                                ngx_http_cache_purge_module);
+
+    if (cpmcf == NULL || cpmcf->shm_zone == NULL) {
+        return NGX_OK;
+    }
+
+    if (ngx_process == NGX_PROCESS_HELPER) {
+
+        /* the cache manager and loader only write snapshots */
+
+        if (cpmcf->snapshot.data) {
+            ev = &ngx_http_cache_purge_snapshot_event;
+
+            ev->handler = ngx_http_cache_purge_snapshot_handler;
+            ev->data = cpmcf;
+            ev->log = cycle->log;
+#  if (nginx_version >= 1007011)
+            ev->cancelable = 1;
+#  endif
+
+            ngx_add_timer(ev, 1000);
+        }
+
+        return NGX_OK;
+    }
+
+    ngx_http_cache_purge_timer_keys = ngx_palloc(cycle->pool,
+                                           cpmcf->batch
+                                           * NGX_HTTP_CACHE_KEY_LEN);
+    if (ngx_http_cache_purge_timer_keys == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_http_cache_purge_timer_jobs = ngx_palloc(cycle->pool,
+                                  cpmcf->batch
+                                  * sizeof(ngx_http_cache_purge_job_t));
+    if (ngx_http_cache_purge_timer_jobs == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_http_cache_purge_timer.handler = ngx_http_cache_purge_timer_handler;
+    ngx_http_cache_purge_timer.data = cpmcf;
+    ngx_http_cache_purge_timer.log = cycle->log;
+#  if (nginx_version >= 1007011)
+    ngx_http_cache_purge_timer.cancelable = 1;
+#  endif
+
+    ngx_add_timer(&ngx_http_cache_purge_timer, 1000);
+
+    ngx_http_cache_purge_shard = ngx_pcalloc(cycle->pool,
+                                          sizeof(ngx_http_cache_purge_sweep_t));
+    if (ngx_http_cache_purge_shard == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_http_cache_purge_shard_event.handler =
+                                            ngx_http_cache_purge_shard_handler;
+    ngx_http_cache_purge_shard_event.data = cpmcf;
+    ngx_http_cache_purge_shard_event.log = cycle->log;
+
+#  if (NGX_HAVE_UNIX_DOMAIN)
+
+    if (cpmcf->listen) {
+        ngx_http_cache_purge_ingest_buf = ngx_palloc(cycle->pool,
+                                               NGX_HTTP_CACHE_PURGE_DATAGRAM);
+        if (ngx_http_cache_purge_ingest_buf == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_http_cache_purge_ingest_keys = ngx_palloc(cycle->pool,
+                                                      cpmcf->batch
+                                                      * NGX_HTTP_CACHE_KEY_LEN);
+        if (ngx_http_cache_purge_ingest_keys == NULL) {
+            return NGX_ERROR;
+        }
+
+        /* the socket is shared by all workers, whoever is first reads */
+
+        c = ngx_get_connection(cpmcf->fd, cycle->log);
+        if (c == NULL) {
+            return NGX_ERROR;
+        }
+
+        c->data = cpmcf;
+        c->log = cycle->log;
+        c->idle = 1;
+
+        c->read->handler = ngx_http_cache_purge_ingest_handler;
+        c->read->log = cycle->log;
+
+        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+#  endif /* NGX_HAVE_UNIX_DOMAIN */
+
+    return NGX_OK;
+}
+
+void
+ngx_http_cache_purge_exit_process(ngx_cycle_t *cycle)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+
+    cpmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                                ngx_http_cache_purge_module);
+
+    if (cpmcf == NULL || cpmcf->shm_zone == NULL) {
+        return;
+    }
+
+    if (ngx_http_cache_purge_shard_job) {
+        /* the rest of the shard is left as is, not to hold the purge up */
+        ngx_http_cache_purge_shard_done(cpmcf->shm_zone->data);
+    }
+
+    if (cpmcf->snapshot.data) {
+        /* the first worker process to exit saves keys for the restart */
+        ngx_http_cache_purge_snapshot_save(cpmcf, 1, cycle->log);
+    }
+}
+
+ngx_int_t
+ngx_http_cache_purge_key(ngx_str_t *zone, ngx_str_t *key,
+    ngx_http_cache_purge_handler_pt handler, void *data)
+{
+    return ngx_http_cache_purge_keys(zone, key, 1, handler, data);
+}
+
+ngx_int_t
+ngx_http_cache_purge_keys(ngx_str_t *zone, ngx_str_t *keys, ngx_uint_t n,
+    ngx_http_cache_purge_handler_pt handler, void *data)
+{
+    ngx_http_cache_purge_op_t  *op;
+    ngx_pool_t                 *pool;
+    ngx_uint_t                  i;
+    ngx_md5_t                   md5;
+    uint32_t                    cache;
+
+    cache = ngx_crc32_short(zone->data, zone->len);
+
+    if (ngx_http_cache_purge_file_cache((ngx_cycle_t *) ngx_cycle, cache)
+        == NULL)
+    {
+        return NGX_DECLINED;
+    }
+
+    /* the caller's log might be gone by the time the purge is done */
+
+    pool = ngx_create_pool(ngx_pagesize, ngx_cycle->log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    op = ngx_pcalloc(pool, sizeof(ngx_http_cache_purge_op_t));
+    if (op == NULL) {
+        goto failed;
+    }
+
+    op->keys = ngx_palloc(pool, n * NGX_HTTP_CACHE_KEY_LEN);
+    if (op->keys == NULL) {
+        goto failed;
+    }
+
+    for (i = 0; i < n; i++) {
+        ngx_md5_init(&md5);
+        ngx_md5_update(&md5, keys[i].data, keys[i].len);
+        ngx_md5_final(&op->keys[i * NGX_HTTP_CACHE_KEY_LEN], &md5);
+    }
+
+    op->pool = pool;
+    op->cache = cache;
+    op->n = n;
+    op->handler = handler;
+    op->data = data;
+
+    op->event.handler = ngx_http_cache_purge_op_handler;
+    op->event.data = op;
+    op->event.log = pool->log;
+
+    ngx_http_cache_purge_op_run(op);
+
+    return NGX_OK;
+
+failed:
+
+    ngx_destroy_pool(pool);
+
+    return NGX_ERROR;
+}
+
+void
+ngx_http_cache_purge_op_handler(ngx_event_t *ev)
+{
+    ngx_http_cache_purge_op_run(ev->data);
+}
+
+void
+ngx_http_cache_purge_op_run(ngx_http_cache_purge_op_t *op)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_loc_conf_t   *cplcf;
+    ngx_http_conf_ctx_t               *ctx;
+    ngx_http_file_cache_t             *cache;
+    ngx_uint_t                         n, purged;
+    ngx_msec_t                         delay;
+    ngx_int_t                          rc;
+
+    /* zones are looked up again, a reload might have replaced them */
+
+    cache = ngx_http_cache_purge_file_cache((ngx_cycle_t *) ngx_cycle,
+                                            op->cache);
+    if (cache == NULL) {
+        rc = NGX_ERROR;
+        goto done;
+    }
+
+    cpmcf = ngx_http_cycle_get_module_main_conf(ngx_cycle,
+                                                ngx_http_cache_purge_module);
+
+    /* purges without a location follow settings of the http block */
+
+    ctx = (ngx_http_conf_ctx_t *) ngx_cycle->conf_ctx[ngx_http_module.index];
+    cplcf = ctx->loc_conf[ngx_http_cache_purge_module.ctx_index];
+
+    n = op->n;
+    delay = 0;
+
+    if (cplcf->rate) {
+        /* queued at once, the timer wheel paces them */
+
+        purged = 0;
+
+        if (ngx_http_cache_purge_spread(cplcf, &cplcf->post,
+                                        cpmcf->shm_zone->data, cache,
+                                        op->keys, n, NULL, &purged,
+                                        op->event.log)
+            != NGX_OK)
+        {
+            rc = NGX_ERROR;
+            goto done;
+        }
+
+        op->purged += purged;
+        op->n = 0;
+
+        rc = NGX_OK;
+        goto done;
+    }
+
+    if (cpmcf->io_rate) {
+        n = ngx_http_cache_purge_io_take(cpmcf, op->cache, n, 0, &delay);
+    }
+
+    if (ngx_http_cache_purge_hashes(&cplcf->post, cpmcf->shm_zone
+                                                  ? cpmcf->shm_zone->data
+                                                  : NULL,
+                                    op->pool, cache, op->keys, n, &purged,
+                                    NULL, op->event.log)
+        != NGX_OK)
+    {
+        rc = NGX_ERROR;
+        goto done;
+    }
+
+    op->purged += purged;
+    op->keys += n * NGX_HTTP_CACHE_KEY_LEN;
+    op->n -= n;
+
+    if (op->n) {
+        /* not cancelable, the handler is always called */
+        ngx_add_timer(&op->event, ngx_max(delay, 1));
+        return;
+    }
+
+    rc = NGX_OK;
+
+done:
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, op->event.log, 0,
+                   "http file cache purge api: %i, %ui purged",
+                   rc, op->purged);
+
+    if (op->handler) {
+        op->handler(op->data, rc, op->purged);
+    }
+
+    ngx_destroy_pool(op->pool);
+}
+
+#  if (nginx_version >= 1007011)
+
+ngx_int_t
+ngx_http_cache_purge_bulk_handler(ngx_http_request_t *r)
+{
+    ngx_http_cache_purge_loc_conf_t  *cplcf;
+    ngx_http_cache_purge_bulk_t      *bulk;
+    ngx_http_cache_purge_ctx_t       *ctx;
+    ngx_pool_cleanup_t               *cln;
+    ngx_int_t                         rc;
+
+    cplcf = ngx_http_get_module_loc_conf(r, ngx_http_cache_purge_module);
+
+    bulk = ngx_pcalloc(r->pool, sizeof(ngx_http_cache_purge_bulk_t));
+    if (bulk == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    bulk->cache = ngx_crc32_short(cplcf->bulk.data, cplcf->bulk.len);
+
+    if (ngx_http_cache_purge_file_cache((ngx_cycle_t *) ngx_cycle,
+                                        bulk->cache)
+        == NULL)
+    {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "cache \"%V\" not found", &cplcf->bulk);
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    bulk->pool = ngx_create_pool(ngx_pagesize, r->connection->log);
+    if (bulk->pool == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    cln->handler = ngx_http_cache_purge_bulk_cleanup;
+    cln->data = bulk;
+
+    bulk->stream.last_out = &bulk->stream.out;
+
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_cache_purge_ctx_t));
+    if (ctx == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ctx->bulk = bulk;
+
+    ngx_http_set_ctx(r, ctx, ngx_http_cache_purge_module);
+
+    /* keys are purged while reading, the body is never kept as a whole */
+
+    r->request_body_no_buffering = 1;
+
+    rc = ngx_http_read_client_request_body(r, ngx_http_cache_purge_bulk_start);
+
+    if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
+        return rc;
+    }
+
+    return NGX_DONE;
+}
+
+void
+ngx_http_cache_purge_bulk_start(ngx_http_request_t *r)
+{
+    ngx_http_cache_purge_loc_conf_t  *cplcf;
+    ngx_int_t                         rc;
+
+    cplcf = ngx_http_get_module_loc_conf(r, ngx_http_cache_purge_module);
+
+    /* rate limited purges are queued and executed later */
+
+    r->headers_out.content_type.len = sizeof("application/x-ndjson") - 1;
+    r->headers_out.content_type.data = (u_char *) "application/x-ndjson";
+    r->headers_out.status = cplcf->rate ? NGX_HTTP_ACCEPTED : NGX_HTTP_OK;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        ngx_http_finalize_request(r, rc);
+        return;
+    }
+
+    r->read_event_handler = ngx_http_cache_purge_bulk_process;
+    r->write_event_handler = ngx_http_cache_purge_bulk_process;
+
+    ngx_http_cache_purge_bulk_process(r);
+}
+
+void
+ngx_http_cache_purge_bulk_process(ngx_http_request_t *r)
+{
+    ngx_http_cache_purge_bulk_t  *bulk;
+    ngx_http_cache_purge_ctx_t   *ctx;
+    ngx_chain_t                  *cl;
+    ngx_buf_t                    *b;
+    ngx_int_t                     rc;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_cache_purge_module);
+    bulk = ctx->bulk;
+
+    for ( ;; ) {
+
+        /* results are sent before more keys are read */
+
+        if (bulk->stream.busy) {
+            if (ngx_http_cache_purge_stream_send(r, &bulk->stream)
+                == NGX_ERROR)
+            {
+                ngx_http_finalize_request(r, NGX_ERROR);
+                return;
+            }
+
+            if (bulk->stream.busy) {
+                if (ngx_handle_write_event(r->connection->write, 0)
+                    != NGX_OK)
+                {
+                    ngx_http_finalize_request(r, NGX_ERROR);
+                }
+
+                return;
+            }
+        }
+
+        for (cl = r->request_body->bufs; cl; cl = cl->next) {
+            if (ngx_http_cache_purge_bulk_parse(r, bulk, cl->buf) != NGX_OK) {
+                ngx_http_finalize_request(r, NGX_ERROR);
+                return;
+            }
+        }
+
+        r->request_body->bufs = NULL;
+
+        if (!r->reading_body) {
+            break;
+        }
+
+        if (bulk->n && ngx_http_cache_purge_bulk_flush(r, bulk) != NGX_OK) {
+            ngx_http_finalize_request(r, NGX_ERROR);
+            return;
+        }
+
+        if (bulk->stream.out
+            && ngx_http_cache_purge_stream_send(r, &bulk->stream) == NGX_ERROR)
+        {
+            ngx_http_finalize_request(r, NGX_ERROR);
+            return;
+        }
+
+        rc = ngx_http_read_unbuffered_request_body(r);
+
+        if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
+            /* the response is already on the way */
+            ngx_http_finalize_request(r, NGX_ERROR);
+            return;
+        }
+
+        if (r->request_body->bufs == NULL && r->reading_body) {
+            return;
+        }
+    }
+
+    /* the last key might have no LF */
+
+    if (bulk->len && !bulk->skip) {
+        if (ngx_http_cache_purge_bulk_key(r, bulk, bulk->line, bulk->len)
+            != NGX_OK)
+        {
+            ngx_http_finalize_request(r, NGX_ERROR);
+            return;
+        }
+    }
+
+    if (bulk->n && ngx_http_cache_purge_bulk_flush(r, bulk) != NGX_OK) {
+        ngx_http_finalize_request(r, NGX_ERROR);
+        return;
+    }
+
+    b = ngx_http_cache_purge_stream_reserve(r, &bulk->stream,
+                                          sizeof("{\"keys\":,\"purged\":,"
+                                                 "\"errors\":}\n") - 1
+                                          + 3 * NGX_INT_T_LEN);
+    if (b == NULL) {
+        ngx_http_finalize_request(r, NGX_ERROR);
+        return;
+    }
+
+    b->last = ngx_sprintf(b->last,
+                          "{\"keys\":%ui,\"purged\":%ui,\"errors\":%ui}\n",
+                          bulk->keys, bulk->purged, bulk->errors);
+    b->last_buf = 1;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache bulk purge: %ui keys, %ui purged, "
+                   "%ui errors", bulk->keys, bulk->purged, bulk->errors);
+
+    r->read_event_handler = ngx_http_block_reading;
+    r->write_event_handler = ngx_http_request_empty_handler;
+
+    rc = ngx_http_cache_purge_stream_send(r, &bulk->stream);
+
+    ngx_http_finalize_request(r, rc);
+}
+
+ngx_int_t
+ngx_http_cache_purge_bulk_parse(ngx_http_request_t *r,
+    ngx_http_cache_purge_bulk_t *bulk, ngx_buf_t *b)
+{
+    size_t   len;
+    u_char  *p, *eol;
+
+    for (p = b->pos; p < b->last; p = eol + 1) {
+
+        eol = ngx_strlchr(p, b->last, LF);
+
+        if (eol == NULL) {
+            /* start of a line split between buffers */
+
+            len = b->last - p;
+
+            if (!bulk->skip && bulk->len + len > NGX_HTTP_CACHE_PURGE_LINE) {
+                if (ngx_http_cache_purge_bulk_error(r, bulk) != NGX_OK) {
+                    return NGX_ERROR;
+                }
+
+                bulk->skip = 1;
+            }
+
+            if (!bulk->skip) {
+                ngx_memcpy(bulk->line + bulk->len, p, len);
+                bulk->len += len;
+            }
+
+            break;
+        }
+
+        len = eol - p;
+
+        if (bulk->skip) {
+            bulk->skip = 0;
+            bulk->len = 0;
+            continue;
+        }
+
+        if (bulk->len) {
+            if (bulk->len + len > NGX_HTTP_CACHE_PURGE_LINE) {
+                bulk->len = 0;
+
+                if (ngx_http_cache_purge_bulk_error(r, bulk) != NGX_OK) {
+                    return NGX_ERROR;
+                }
+
+                continue;
+            }
+
+            ngx_memcpy(bulk->line + bulk->len, p, len);
+
+            p = bulk->line;
+            len += bulk->len;
+
+            bulk->len = 0;
+        }
+
+        if (ngx_http_cache_purge_bulk_key(r, bulk, p, len) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    b->pos = b->last;
+
+    return NGX_OK;
+}
+
+ngx_int_t
+ngx_http_cache_purge_bulk_key(ngx_http_request_t *r,
+    ngx_http_cache_purge_bulk_t *bulk, u_char *key, size_t len)
+{
+    ngx_md5_t   md5;
+    ngx_buf_t  *b;
+    size_t      size;
+
+    while (len && (key[len - 1] == CR || key[len - 1] == ' ')) {
+        len--;
+    }
+
+    if (len == 0) {
+        return NGX_OK;
+    }
+
+    if (len > NGX_HTTP_CACHE_PURGE_LINE) {
+        return ngx_http_cache_purge_bulk_error(r, bulk);
+    }
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, key, len);
+    ngx_md5_final(&bulk->hashes[bulk->n * NGX_HTTP_CACHE_KEY_LEN], &md5);
+
+    size = sizeof("{\"key\":\"\",\"result\":\"absent\"}\n") - 1 + len
+           + ngx_http_cache_purge_escape_json(NULL, key, len);
+
+    b = ngx_http_cache_purge_stream_reserve(r, &bulk->stream, size);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* "absent" is overwritten in place once the key is purged */
+
+    b->last = ngx_cpymem(b->last, "{\"key\":\"", sizeof("{\"key\":\"") - 1);
+    b->last = (u_char *) ngx_http_cache_purge_escape_json(b->last, key, len);
+    b->last = ngx_cpymem(b->last, "\",\"result\":\"",
+                         sizeof("\",\"result\":\"") - 1);
+
+    bulk->results[bulk->n] = b->last;
+
+    b->last = ngx_cpymem(b->last, "absent\"}\n", sizeof("absent\"}\n") - 1);
+
+    bulk->keys++;
+
+    if (++bulk->n == NGX_HTTP_CACHE_PURGE_BATCH) {
+        return ngx_http_cache_purge_bulk_flush(r, bulk);
+    }
+
+    return NGX_OK;
+}
+
+ngx_int_t
+ngx_http_cache_purge_bulk_error(ngx_http_request_t *r,
+    ngx_http_cache_purge_bulk_t *bulk)
+{
+    ngx_buf_t  *b;
+
+    b = ngx_http_cache_purge_stream_reserve(r, &bulk->stream,
+                                          sizeof("{\"error\":\"key is too"
+                                                 " long\"}\n") - 1);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->last = ngx_cpymem(b->last, "{\"error\":\"key is too long\"}\n",
+                         sizeof("{\"error\":\"key is too long\"}\n") - 1);
+
+    bulk->errors++;
+
+    return NGX_OK;
+}
+
+ngx_int_t
+ngx_http_cache_purge_bulk_flush(ngx_http_request_t *r,
+    ngx_http_cache_purge_bulk_t *bulk)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_loc_conf_t   *cplcf;
+    ngx_http_file_cache_t             *cache;
+    ngx_uint_t                         i, purged;
+    ngx_msec_t                         delay;
+
+    cache = ngx_http_cache_purge_file_cache((ngx_cycle_t *) ngx_cycle,
+                                            bulk->cache);
+    if (cache == NULL) {
+        return NGX_ERROR;
+    }
+
+    cpmcf = ngx_http_get_module_main_conf(r, ngx_http_cache_purge_module);
+    cplcf = ngx_http_get_module_loc_conf(r, ngx_http_cache_purge_module);
+
+    if (cplcf->rate) {
+        purged = 0;
+
+        if (ngx_http_cache_purge_spread(cplcf, &cplcf->post,
+                                        cpmcf->shm_zone->data, cache,
+                                        bulk->hashes, bulk->n, bulk->states,
+                                        &purged, r->connection->log)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        for (i = 0; i < bulk->n; i++) {
+            if (bulk->states[i]) {
+                ngx_memcpy(bulk->results[i], "queued", sizeof("queued") - 1);
+            }
+        }
+
+        bulk->purged += purged;
+        bulk->n = 0;
+
+        return NGX_OK;
+    }
+
+    if (ngx_http_cache_purge_hashes(&cplcf->post, cpmcf->shm_zone
+                                                  ? cpmcf->shm_zone->data
+                                                  : NULL,
+                                    bulk->pool, cache, bulk->hashes, bulk->n,
+                                    &purged, bulk->states, r->connection->log)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    ngx_reset_pool(bulk->pool);
+
+    for (i = 0; i < bulk->n; i++) {
+        if (bulk->states[i]) {
+            ngx_memcpy(bulk->results[i], "purged", sizeof("purged") - 1);
+        }
+    }
+
+    bulk->purged += purged;
+    bulk->n = 0;
+
+    if (cpmcf->io_rate && purged) {
+        (void) ngx_http_cache_purge_io_take(cpmcf, bulk->cache, purged, 1,
+                                            &delay);
+    }
+
+    return NGX_OK;
+}
+
+void
+ngx_http_cache_purge_bulk_cleanup(void *data)
+{
+    ngx_http_cache_purge_bulk_t  *bulk = data;
+
+    ngx_destroy_pool(bulk->pool);
+}
+
+#  endif /* nginx_version >= 1007011 */
+
+ngx_int_t
+ngx_http_cache_purge_export_handler(ngx_http_request_t *r)
+{
+    ngx_http_cache_purge_loc_conf_t  *cplcf;
+    ngx_http_cache_purge_export_t    *exp;
+    ngx_http_cache_purge_ctx_t       *ctx;
+    ngx_int_t                         rc, n;
+    ngx_str_t                         value;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    cplcf = ngx_http_get_module_loc_conf(r, ngx_http_cache_purge_module);
+
+    exp = ngx_pcalloc(r->pool, sizeof(ngx_http_cache_purge_export_t));
+    if (exp == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    exp->cache = ngx_crc32_short(cplcf->export.data, cplcf->export.len);
+
+    if (ngx_http_cache_purge_file_cache((ngx_cycle_t *) ngx_cycle,
+                                        exp->cache)
+        == NULL)
+    {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "cache \"%V\" not found", &cplcf->export);
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    /* "cursor" is the hash of the last entry of an earlier export */
+
+    if (ngx_http_arg(r, (u_char *) "cursor", sizeof("cursor") - 1, &value)
+        == NGX_OK)
+    {
+        if (ngx_http_cache_purge_hex_key(exp->cursor, value.data, value.len)
+            != NGX_OK)
+        {
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        exp->started = 1;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "limit", sizeof("limit") - 1, &value)
+        == NGX_OK)
+    {
+        n = ngx_atoi(value.data, value.len);
+        if (n == NGX_ERROR || n == 0) {
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        exp->limit = n;
+    }
+
+    exp->stream.last_out = &exp->stream.out;
+
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_cache_purge_ctx_t));
+    if (ctx == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ctx->export = exp;
+
+    ngx_http_set_ctx(r, ctx, ngx_http_cache_purge_module);
+
+    r->headers_out.content_type.len = sizeof("application/x-ndjson") - 1;
+    r->headers_out.content_type.data = (u_char *) "application/x-ndjson";
+    r->headers_out.status = NGX_HTTP_OK;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    r->main->count++;
+
+    r->write_event_handler = ngx_http_cache_purge_export_process;
+
+    ngx_http_cache_purge_export_process(r);
+
+    return NGX_DONE;
+}
+
+void
+ngx_http_cache_purge_export_process(ngx_http_request_t *r)
+{
+    ngx_http_cache_purge_export_t  *exp;
+    ngx_http_cache_purge_entry_t   *e;
+    ngx_http_cache_purge_ctx_t     *ctx;
+    ngx_http_core_loc_conf_t       *clcf;
+    ngx_http_file_cache_t          *cache;
+    ngx_event_t                    *wev;
+    ngx_uint_t                      i, n;
+    ngx_buf_t                      *b;
+    ngx_int_t                       rc;
+    size_t                          len;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_cache_purge_module);
+    exp = ctx->export;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+    wev = r->connection->write;
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, NGX_ETIMEDOUT,
+                      "client timed out");
+        r->connection->timedout = 1;
+        ngx_http_finalize_request(r, NGX_HTTP_REQUEST_TIME_OUT);
+        return;
+    }
+
+    /* entries already read are sent before reading more */
+
+    if (exp->stream.busy) {
+        if (ngx_http_cache_purge_stream_send(r, &exp->stream) == NGX_ERROR) {
+            ngx_http_finalize_request(r, NGX_ERROR);
+            return;
+        }
+
+        if (exp->stream.busy) {
+            goto again;
+        }
+    }
+
+    if (wev->timer_set) {
+        ngx_del_timer(wev);
+    }
+
+    /* the cache zone might be gone after a reload */
+
+    cache = ngx_http_cache_purge_file_cache((ngx_cycle_t *) ngx_cycle,
+                                            exp->cache);
+    if (cache == NULL) {
+        ngx_http_finalize_request(r, NGX_ERROR);
+        return;
+    }
+
+    rc = ngx_http_cache_purge_export_page(cache, exp, &n);
+
+    len = sizeof("{\"hash\":\"\",\"fs_size\":,\"valid_sec\":,\"uses\":}\n") - 1
+          + 2 * NGX_HTTP_CACHE_KEY_LEN + NGX_OFF_T_LEN + NGX_TIME_T_LEN
+          + NGX_INT_T_LEN;
+
+    for (i = 0; i < n; i++) {
+        e = &exp->page[i];
+
+        b = ngx_http_cache_purge_stream_reserve(r, &exp->stream, len);
+        if (b == NULL) {
+            ngx_http_finalize_request(r, NGX_ERROR);
+            return;
+        }
+
+        b->last = ngx_cpymem(b->last, "{\"hash\":\"",
+                             sizeof("{\"hash\":\"") - 1);
+        b->last = ngx_hex_dump(b->last, e->key, NGX_HTTP_CACHE_KEY_LEN);
+        b->last = ngx_sprintf(b->last,
+                              "\",\"fs_size\":%O,\"valid_sec\":%T,"
+                              "\"uses\":%ui}\n",
+                              e->fs_size, e->valid_sec, e->uses);
+    }
+
+    if (rc == NGX_AGAIN) {
+        if (exp->stream.out
+            && ngx_http_cache_purge_stream_send(r, &exp->stream)
+               == NGX_ERROR)
+        {
+            ngx_http_finalize_request(r, NGX_ERROR);
+            return;
+        }
+
+        if (exp->stream.busy) {
+            goto again;
+        }
+
+        /* let other events in between pages */
+
+        ngx_post_event(wev, &ngx_posted_events);
+        return;
+    }
+
+    b = ngx_http_cache_purge_stream_reserve(r, &exp->stream,
+                                            sizeof("{\"entries\":,\"cursor\":"
+                                                   "\"\"}\n") - 1
+                                            + NGX_INT_T_LEN
+                                            + 2 * NGX_HTTP_CACHE_KEY_LEN);
+    if (b == NULL) {
+        ngx_http_finalize_request(r, NGX_ERROR);
+        return;
+    }
+
+    /* the cursor is only given when entries are left after the limit */
+
+    if (rc == NGX_DONE) {
+        b->last = ngx_sprintf(b->last, "{\"entries\":%ui,\"cursor\":\"",
+                              exp->entries);
+        b->last = ngx_hex_dump(b->last, exp->cursor, NGX_HTTP_CACHE_KEY_LEN);
+        b->last = ngx_cpymem(b->last, "\"}\n", sizeof("\"}\n") - 1);
+
+    } else {
+        b->last = ngx_sprintf(b->last, "{\"entries\":%ui}\n", exp->entries);
+    }
+
+    b->last_buf = 1;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache export: %ui entries", exp->entries);
+
+    r->write_event_handler = ngx_http_request_empty_handler;
+
+    rc = ngx_http_cache_purge_stream_send(r, &exp->stream);
+
+    ngx_http_finalize_request(r, rc);
+    return;
+
+again:
+
+    if (!wev->timer_set) {
+        ngx_add_timer(wev, clcf->send_timeout);
+    }
+
+    if (ngx_handle_write_event(wev, clcf->send_lowat) != NGX_OK) {
+        ngx_http_finalize_request(r, NGX_ERROR);
+    }
+}
+
+ngx_int_t
+ngx_http_cache_purge_export_page(ngx_http_file_cache_t *cache,
+    ngx_http_cache_purge_export_t *exp, ngx_uint_t *n)
+{
+    ngx_http_cache_purge_entry_t  *e;
+    ngx_http_file_cache_node_t    *fcn;
+    ngx_rbtree_node_t             *node, *sentinel;
+    ngx_uint_t                     i, k;
+
+    /*
+     * Nodes are walked in the order of the cache rbtree, so that the walk
+     * can be continued from the last hash whatever changed in between.
+     */
+
+    k = 0;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    sentinel = cache->sh->rbtree.sentinel;
+
+    if (exp->started) {
+        node = ngx_http_cache_purge_lookup_next(cache, exp->cursor);
+
+    } else {
+        node = cache->sh->rbtree.root;
+        node = (node != sentinel) ? ngx_rbtree_min(node, sentinel) : NULL;
+    }
+
+    for (i = 0; node && i < NGX_HTTP_CACHE_PURGE_BATCH; i++) {
+
+        if (exp->limit && exp->entries + k == exp->limit) {
+            break;
+        }
+
+        fcn = (ngx_http_file_cache_node_t *) node;
+
+        ngx_memcpy(exp->cursor, (u_char *) &node->key,
+                   sizeof(ngx_rbtree_key_t));
+        ngx_memcpy(&exp->cursor[sizeof(ngx_rbtree_key_t)], fcn->key,
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        exp->started = 1;
+
+        node = ngx_http_cache_purge_rbtree_next(&cache->sh->rbtree, node);
+
+        /* nodes of entries being stored or already gone aren't exported */
+
+        if (!fcn->exists) {
+            continue;
+        }
+
+        e = &exp->page[k++];
+
+        ngx_memcpy(e->key, exp->cursor, NGX_HTTP_CACHE_KEY_LEN);
+#  if (nginx_version >= 1000001)
+        e->fs_size = fcn->fs_size * cache->bsize;
+#  else
+        e->fs_size = fcn->length;
+#  endif
+        e->valid_sec = fcn->valid_sec;
+        e->uses = fcn->uses;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    exp->entries += k;
+    *n = k;
+
+    if (node == NULL) {
+        return NGX_OK;
+    }
+
+    if (exp->limit && exp->entries == exp->limit) {
+        return NGX_DONE;
+    }
+
+    return NGX_AGAIN;
+}
+
+ngx_int_t
+ngx_http_cache_purge_evict_handler(ngx_http_request_t *r)
+{
+    ngx_http_cache_purge_loc_conf_t  *cplcf;
+    ngx_http_cache_purge_sweep_t     *sw;
+    ngx_http_file_cache_t            *cache;
+    ngx_int_t                         rc, percent;
+    ngx_str_t                         value;
+
+    cplcf = ngx_http_get_module_loc_conf(r, ngx_http_cache_purge_module);
+
+    rc = ngx_http_cache_purge_sweep_init(r, &cplcf->evict, &sw, &cache);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    /* "bytes=N" (with optional k, m or g), or "percent=N" of max_size */
+
+    if (ngx_http_arg(r, (u_char *) "bytes", sizeof("bytes") - 1, &value)
+        == NGX_OK)
+    {
+        sw->target = ngx_parse_offset(&value);
+        if (sw->target == NGX_ERROR || sw->target == 0) {
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+    } else if (ngx_http_arg(r, (u_char *) "percent", sizeof("percent") - 1,
+                            &value)
+               == NGX_OK)
+    {
+        percent = ngx_atoi(value.data, value.len);
+        if (percent == NGX_ERROR || percent == 0 || percent > 100) {
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        /* max_size is kept in blocks */
+
+        if (cache->max_size == NGX_MAX_OFF_T_VALUE / (off_t) cache->bsize) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "cache \"%V\" has no max_size", &cplcf->evict);
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        sw->target = cache->max_size / 100 * percent * cache->bsize;
+
+    } else {
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    sw->batch = ngx_http_cache_purge_evict_batch;
+
+    return ngx_http_cache_purge_sweep_start(r, sw);
+}
+
+ngx_int_t
+ngx_http_cache_purge_evict_batch(ngx_http_file_cache_t *cache,
+    ngx_http_cache_purge_sweep_t *sw, ngx_uint_t max, ngx_log_t *log)
+{
+    ngx_http_file_cache_node_t  *fcn, *mark;
+    ngx_queue_t                 *q;
+    ngx_uint_t                   i, n, exhausted;
+    u_char                      *key;
+
+    n = 0;
+    exhausted = 0;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    /* the least recently used entries are at the tail, as for max_size */
+
+    for (i = 0; i < NGX_HTTP_CACHE_PURGE_BATCH; i++) {
+
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            exhausted = 1;
+            break;
+        }
+
+        if (n == max || sw->freed >= sw->target) {
+            break;
+        }
+
+        q = ngx_queue_last(&cache->sh->queue);
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+        sw->scanned++;
+
+        if (fcn->count) {
+
+            /*
+             * nodes in use by requests or by the cache manager are moved
+             * to the head, as ngx_http_file_cache_forced_expire() does;
+             * the first one moved marks where the queue wraps around
+             * to nodes which were all in use
+             */
+
+            if (sw->started
+                && ngx_memcmp(sw->cursor, (u_char *) &fcn->node.key,
+                              sizeof(ngx_rbtree_key_t)) == 0
+                && ngx_memcmp(&sw->cursor[sizeof(ngx_rbtree_key_t)], fcn->key,
+                              NGX_HTTP_CACHE_KEY_LEN
+                              - sizeof(ngx_rbtree_key_t)) == 0)
+            {
+                exhausted = 1;
+                break;
+            }
+
+            mark = sw->started ? ngx_http_cache_purge_lookup(cache, sw->cursor)
+                               : NULL;
+
+            if (mark == NULL) {
+                /* the node marked before is gone, this one is marked */
+
+                ngx_memcpy(sw->cursor, (u_char *) &fcn->node.key,
+                           sizeof(ngx_rbtree_key_t));
+                ngx_memcpy(&sw->cursor[sizeof(ngx_rbtree_key_t)], fcn->key,
+                           NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+                sw->started = 1;
+            }
+
+            ngx_queue_remove(q);
+            ngx_queue_insert_head(&cache->sh->queue, q);
+
+            continue;
+        }
+
+        if (fcn->exists) {
+            key = &sw->keys[n++ * NGX_HTTP_CACHE_KEY_LEN];
+
+            ngx_memcpy(key, (u_char *) &fcn->node.key,
+                       sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+#  if (nginx_version >= 1000001)
+            sw->freed += fcn->fs_size * cache->bsize;
+#  else
+            sw->freed += fcn->length;
+#  endif
+
+            ngx_http_cache_purge_retire(cache, fcn);
+        }
+
+        /* nodes are freed as well, as ngx_http_file_cache_delete() does */
+
+        ngx_queue_remove(&fcn->queue);
+        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
+        ngx_slab_free_locked(cache->shpool, fcn);
+#  if (nginx_version >= 1019001)
+        cache->sh->count--;
+#  endif
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    for (i = 0; i < n; i++) {
+        key = &sw->keys[i * NGX_HTTP_CACHE_KEY_LEN];
+        (void) ngx_http_cache_purge_unlink(cache, &sw->name, key, 0, log);
+    }
+
+    sw->entries += n;
+
+    if (sw->freed >= sw->target || exhausted) {
+        /* done, or only entries in use are left */
+        return NGX_OK;
+    }
+
+    return NGX_AGAIN;
+}
+
+ngx_int_t
+ngx_http_cache_purge_filter_handler(ngx_http_request_t *r)
+{
+    ngx_http_cache_purge_loc_conf_t  *cplcf;
+    ngx_http_cache_purge_sweep_t     *sw;
+    ngx_http_file_cache_t            *cache;
+    ngx_uint_t                        filters;
+    ngx_int_t                         rc;
+    ngx_str_t                         value;
+    ssize_t                           size;
+    time_t                            sec;
+
+    cplcf = ngx_http_get_module_loc_conf(r, ngx_http_cache_purge_module);
+
+    rc = ngx_http_cache_purge_sweep_init(r, &cplcf->filter, &sw, &cache);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    filters = 0;
+
+    if (ngx_http_arg(r, (u_char *) "min_size", sizeof("min_size") - 1,
+                     &value)
+        == NGX_OK)
+    {
+        sw->filter.min_size = ngx_parse_offset(&value);
+        if (sw->filter.min_size == NGX_ERROR) {
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        filters++;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "max_size", sizeof("max_size") - 1,
+                     &value)
+        == NGX_OK)
+    {
+        sw->filter.max_size = ngx_parse_offset(&value);
+        if (sw->filter.max_size == NGX_ERROR) {
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        filters++;
+    }
+
+    /* stale for at least the given time */
+
+    if (ngx_http_arg(r, (u_char *) "stale", sizeof("stale") - 1, &value)
+        == NGX_OK)
+    {
+        sec = ngx_parse_time(&value, 1);
+        if (sec == (time_t) NGX_ERROR) {
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        sw->filter.stale = ngx_time() - sec;
+        filters++;
+    }
+
+    /* not used for at least the given time, nodes expire after "inactive" */
+
+    if (ngx_http_arg(r, (u_char *) "idle", sizeof("idle") - 1, &value)
+        == NGX_OK)
+    {
+        sec = ngx_parse_time(&value, 1);
+        if (sec == (time_t) NGX_ERROR) {
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        sw->filter.idle = ngx_time() - sec + cache->inactive;
+        filters++;
+    }
+
+    /* size of the headers stored in cache files before the body */
+
+    if (ngx_http_arg(r, (u_char *) "min_header", sizeof("min_header") - 1,
+                     &value)
+        == NGX_OK)
+    {
+        size = ngx_parse_size(&value);
+        if (size == NGX_ERROR) {
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        sw->filter.min_header = size;
+        filters++;
+    }
+
+    /* a whole zone is never purged by an empty query */
+
+    if (filters == 0) {
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    sw->batch = ngx_http_cache_purge_filter_batch;
+
+    if (cplcf->rate) {
+        /* queued entries are paced by the timer wheel, not by shards */
+        sw->rated = cplcf;
+
+        return ngx_http_cache_purge_sweep_start(r, sw);
+    }
+
+    if (cplcf->shards > 1) {
+        return ngx_http_cache_purge_shared_start(r, sw, cplcf->shards);
+    }
+
+    return ngx_http_cache_purge_sweep_start(r, sw);
+}
+
+ngx_int_t
+ngx_http_cache_purge_filter_batch(ngx_http_file_cache_t *cache,
+    ngx_http_cache_purge_sweep_t *sw, ngx_uint_t max, ngx_log_t *log)
+{
+    ngx_http_cache_purge_filter_t  *f;
+    ngx_http_file_cache_node_t     *fcn;
+    ngx_rbtree_node_t              *node;
+    ngx_uint_t                      i, n, done;
+    u_char                         *key;
+    off_t                           size;
+
+    f = &sw->filter;
+    n = 0;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    /* walked in the order of the rbtree, as for exports */
+
+    if (sw->started) {
+        node = ngx_http_cache_purge_lookup_next(cache, sw->cursor);
+
+    } else {
+        node = ngx_http_cache_purge_lookup_first(cache, sw->first);
+    }
+
+    for (i = 0;
+         node && node->key <= sw->last
+         && i < NGX_HTTP_CACHE_PURGE_BATCH && n < max;
+         i++)
+    {
+
+        fcn = (ngx_http_file_cache_node_t *) node;
+
+        ngx_memcpy(sw->cursor, (u_char *) &node->key,
+                   sizeof(ngx_rbtree_key_t));
+        ngx_memcpy(&sw->cursor[sizeof(ngx_rbtree_key_t)], fcn->key,
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        sw->started = 1;
+        sw->scanned++;
+
+        node = ngx_http_cache_purge_rbtree_next(&cache->sh->rbtree, node);
+
+        if (!fcn->exists) {
+            continue;
+        }
+
+#  if (nginx_version >= 1000001)
+        size = fcn->fs_size * cache->bsize;
+#  else
+        size = fcn->length;
+#  endif
+
+        /*
+         * all filters given have to match; nodes added by the cache loader,
+         * or found on disk after a restart, have neither the validity nor
+         * the header size set until stored again, and never match those
+         */
+
+        if ((f->min_size && size < f->min_size)
+            || (f->max_size && size > f->max_size)
+            || (f->stale
+                && (fcn->valid_sec == 0 || fcn->valid_sec >= f->stale))
+            || (f->idle && fcn->expire >= f->idle)
+            || (f->min_header
+                && (fcn->body_start == 0 || fcn->body_start < f->min_header)))
+        {
+            continue;
+        }
+
+        key = &sw->keys[n++ * NGX_HTTP_CACHE_KEY_LEN];
+        ngx_memcpy(key, sw->cursor, NGX_HTTP_CACHE_KEY_LEN);
+
+        sw->freed += size;
+
+        if (sw->rated == NULL) {
+            ngx_http_cache_purge_retire(cache, fcn);
+        }
+    }
+
+    done = (node == NULL || node->key > sw->last);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_http_cache_purge_sweep_flush(cache, sw, n, log);
+
+    return done ? NGX_OK : NGX_AGAIN;
+}
+
+ngx_int_t
+ngx_http_cache_purge_shared_start(ngx_http_request_t *r,
+    ngx_http_cache_purge_sweep_t *sw, ngx_uint_t shards)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_shared_t     *job;
+    ngx_http_cache_purge_zone_t       *zone;
+    ngx_http_cache_purge_ctx_t        *ctx;
+    ngx_pool_cleanup_t                *cln;
+    size_t                             size;
+
+    cpmcf = ngx_http_get_module_main_conf(r, ngx_http_cache_purge_module);
+    zone = cpmcf->shm_zone->data;
+
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_cache_purge_ctx_t));
+    if (ctx == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    size = sizeof(ngx_http_cache_purge_shared_t)
+           + (shards - 1) * sizeof(ngx_http_cache_purge_claim_t);
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    job = ngx_slab_alloc_locked(zone->shpool, size);
+    if (job == NULL) {
+        ngx_shmtx_unlock(&zone->shpool->mutex);
+
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                      "could not allocate sharded purge%s",
+                      zone->shpool->log_ctx);
+
+        /* walked by this worker process alone */
+
+        return ngx_http_cache_purge_sweep_start(r, sw);
+    }
+
+    /* all shards are NGX_HTTP_CACHE_PURGE_SHARD_FREE */
+
+    ngx_memzero(job, size);
+
+    job->id = zone->sh->shared_id++;
+    job->cache = sw->cache;
+    job->filter = sw->filter;
+    job->shards = shards;
+    job->free = shards;
+    job->alive = ngx_time();
+
+    ngx_queue_insert_tail(&zone->sh->shared, &job->queue);
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    ctx->sweep = sw;
+    ctx->shared = job;
+
+    ngx_http_set_ctx(r, ctx, ngx_http_cache_purge_module);
+
+    cln->handler = ngx_http_cache_purge_shared_cleanup;
+    cln->data = r;
+
+    r->main->count++;
+
+    r->read_event_handler = ngx_http_test_reading;
+    r->write_event_handler = ngx_http_cache_purge_shared_wait;
+
+    /* other worker processes join on their next timer tick */
+
+    ngx_http_cache_purge_shard_post(zone);
+
+    ngx_add_timer(r->connection->write, NGX_HTTP_CACHE_PURGE_POLL);
+
+    return NGX_DONE;
+}
+
+void
+ngx_http_cache_purge_shared_wait(ngx_http_request_t *r)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_shared_t     *job;
+    ngx_http_cache_purge_sweep_t      *sw;
+    ngx_http_cache_purge_zone_t       *zone;
+    ngx_http_cache_purge_ctx_t        *ctx;
+    ngx_http_file_cache_t             *cache;
+    ngx_event_t                       *wev;
+    ngx_uint_t                         done, expired;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_cache_purge_module);
+    sw = ctx->sweep;
+    job = ctx->shared;
+
+    wev = r->connection->write;
+
+    if (wev->timer_set) {
+        if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+            ngx_http_finalize_request(r, NGX_ERROR);
+        }
+
+        return;
+    }
+
+    wev->timedout = 0;
+
+    cpmcf = ngx_http_get_module_main_conf(r, ngx_http_cache_purge_module);
+    zone = cpmcf->shm_zone->data;
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    job->alive = ngx_time();
+
+    expired = ngx_http_cache_purge_shared_expire_locked(job, job->alive);
+
+    done = (job->free == 0 && job->active == 0);
+
+    if (done) {
+        sw->scanned = job->scanned;
+        sw->entries = job->entries;
+        sw->freed = job->freed;
+
+        ngx_queue_remove(&job->queue);
+        ngx_slab_free_locked(zone->shpool, job);
+
+        ctx->shared = NULL;
+    }
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    if (expired) {
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                      "%ui shards of sharded purge taken over"
+                      " from stalled worker processes", expired);
+
+        ngx_http_cache_purge_shard_post(zone);
+    }
+
+    if (!done) {
+        ngx_add_timer(wev, NGX_HTTP_CACHE_PURGE_POLL);
+        return;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache purge shared: %ui of %ui entries, %O bytes",
+                   sw->entries, sw->scanned, sw->freed);
+
+    r->read_event_handler = ngx_http_block_reading;
+    r->write_event_handler = ngx_http_request_empty_handler;
+
+    cache = ngx_http_cache_purge_file_cache((ngx_cycle_t *) ngx_cycle,
+                                            sw->cache);
+    if (cache == NULL) {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+
+    ngx_http_finalize_request(r, ngx_http_cache_purge_sweep_report(r, cache));
+}
+
+void
+ngx_http_cache_purge_shared_cleanup(void *data)
+{
+    ngx_http_request_t  *r = data;
+
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_shared_t     *job;
+    ngx_http_cache_purge_zone_t       *zone;
+    ngx_http_cache_purge_ctx_t        *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_cache_purge_module);
+    job = ctx->shared;
+
+    if (job == NULL) {
+        return;
+    }
+
+    cpmcf = ngx_http_get_module_main_conf(r, ngx_http_cache_purge_module);
+    zone = cpmcf->shm_zone->data;
+
+    /* shards not claimed yet are dropped, the rest finish on their own */
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    ngx_http_cache_purge_shared_abandon_locked(job);
+
+    if (job->active == 0) {
+        ngx_queue_remove(&job->queue);
+        ngx_slab_free_locked(zone->shpool, job);
+    }
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    ctx->shared = NULL;
+}
+
+ngx_int_t
+ngx_http_cache_purge_errors_handler(ngx_http_request_t *r)
+{
+    ngx_http_cache_purge_loc_conf_t  *cplcf;
+    ngx_http_cache_purge_sweep_t     *sw;
+    ngx_http_file_cache_t            *cache;
+    ngx_int_t                         rc, n;
+    ngx_str_t                         value;
+
+    cplcf = ngx_http_get_module_loc_conf(r, ngx_http_cache_purge_module);
+
+    rc = ngx_http_cache_purge_sweep_init(r, &cplcf->errors, &sw, &cache);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    sw->status_min = NGX_HTTP_BAD_REQUEST;
+    sw->status_max = 599;
+
+    /* either a status code or its class, i.e. "404" or "5xx" */
+
+    if (ngx_http_arg(r, (u_char *) "status", sizeof("status") - 1, &value)
+        == NGX_OK)
+    {
+        if (value.len == 3
+            && (value.data[1] | 0x20) == 'x'
+            && (value.data[2] | 0x20) == 'x')
+        {
+            n = ngx_atoi(value.data, 1);
+            if (n == NGX_ERROR) {
+                return NGX_HTTP_BAD_REQUEST;
+            }
+
+            sw->status_min = n * 100;
+            sw->status_max = n * 100 + 99;
+
+        } else {
+            n = ngx_atoi(value.data, value.len);
+            if (n == NGX_ERROR) {
+                return NGX_HTTP_BAD_REQUEST;
+            }
+
+            sw->status_min = n;
+            sw->status_max = n;
+        }
+
+        if (sw->status_min < NGX_HTTP_BAD_REQUEST || sw->status_max > 599) {
+            return NGX_HTTP_BAD_REQUEST;
+        }
+    }
+
+    sw->batch = ngx_http_cache_purge_errors_batch;
+
+    if (cplcf->rate) {
+        sw->rated = cplcf;
+    }
+
+    return ngx_http_cache_purge_sweep_start(r, sw);
+}
+
+ngx_int_t
+ngx_http_cache_purge_errors_batch(ngx_http_file_cache_t *cache,
+    ngx_http_cache_purge_sweep_t *sw, ngx_uint_t max, ngx_log_t *log)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_error_t      *en;
+    ngx_http_cache_purge_zone_t       *zone;
+    ngx_http_file_cache_node_t        *fcn;
+    ngx_rbtree_node_t                 *node, *next, *sentinel;
+    ngx_uint_t                         i, k, n;
+    u_char                            *key;
+    off_t                              size;
+
+    cpmcf = ngx_http_cycle_get_module_main_conf(ngx_cycle,
+                                                ngx_http_cache_purge_module);
+
+    if (cpmcf->shm_zone == NULL) {
+        /* errors aren't tracked anymore after a reload */
+        return NGX_OK;
+    }
+
+    zone = cpmcf->shm_zone->data;
+
+    n = 0;
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    /* errors of all caches are walked in the order of the rbtree */
+
+    sentinel = zone->sh->errors.sentinel;
+
+    if (sw->started) {
+        node = ngx_http_cache_purge_find_next(&zone->sh->errors,
+                                              sw->cursor_cache, sw->cursor);
+
+    } else {
+        node = zone->sh->errors.root;
+        node = (node != sentinel) ? ngx_rbtree_min(node, sentinel) : NULL;
+    }
+
+    for (i = 0; node && i < NGX_HTTP_CACHE_PURGE_BATCH && n < max; i++) {
+
+        en = (ngx_http_cache_purge_error_t *) node;
+
+        ngx_memcpy(sw->cursor, en->sn.key, NGX_HTTP_CACHE_KEY_LEN);
+        sw->cursor_cache = en->sn.cache;
+        sw->started = 1;
+
+        next = ngx_http_cache_purge_rbtree_next(&zone->sh->errors, node);
+
+        if (en->sn.cache == sw->cache) {
+            sw->scanned++;
+
+            if (en->status >= sw->status_min && en->status <= sw->status_max) {
+                key = &sw->keys[n++ * NGX_HTTP_CACHE_KEY_LEN];
+                ngx_memcpy(key, en->sn.key, NGX_HTTP_CACHE_KEY_LEN);
+
+                /* the error is forgotten even if the entry is gone */
+
+                ngx_http_cache_purge_error_free(zone, en);
+            }
+        }
+
+        node = next;
+    }
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    k = 0;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    for (i = 0; i < n; i++) {
+        key = &sw->keys[i * NGX_HTTP_CACHE_KEY_LEN];
+
+        fcn = ngx_http_cache_purge_lookup(cache, key);
+
+        if (fcn == NULL || !fcn->exists) {
+            continue;
+        }
+
+#  if (nginx_version >= 1000001)
+        size = fcn->fs_size * cache->bsize;
+#  else
+        size = fcn->length;
+#  endif
+
+        sw->freed += size;
+
+        if (sw->rated == NULL) {
+            ngx_http_cache_purge_retire(cache, fcn);
+        }
+
+        if (k != i) {
+            ngx_memcpy(&sw->keys[k * NGX_HTTP_CACHE_KEY_LEN], key,
+                       NGX_HTTP_CACHE_KEY_LEN);
+        }
+
+        k++;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_http_cache_purge_sweep_flush(cache, sw, k, log);
+
+    return (node == NULL) ? NGX_OK : NGX_AGAIN;
+}
+
+#  if (NGX_PCRE)
+
+ngx_int_t
+ngx_http_cache_purge_regex_handler(ngx_http_request_t *r)
+{
+    ngx_http_cache_purge_loc_conf_t  *cplcf;
+    ngx_http_cache_purge_sweep_t     *sw;
+    ngx_http_file_cache_t            *cache;
+    ngx_regex_compile_t               rc;
+    ngx_int_t                         n;
+    ngx_str_t                         value;
+    u_char                           *src, *dst;
+    u_char                            errstr[NGX_MAX_CONF_ERRSTR];
+#    if (NGX_HAVE_PCRE_JIT && !(NGX_PCRE2))
+    ngx_pool_cleanup_t               *cln;
+    void                           *(*old_malloc)(size_t);
+    const char                       *err;
+#    endif
+
+    cplcf = ngx_http_get_module_loc_conf(r, ngx_http_cache_purge_module);
+
+    n = ngx_http_cache_purge_sweep_init(r, &cplcf->regex, &sw, &cache);
+    if (n != NGX_OK) {
+        return n;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "pattern", sizeof("pattern") - 1, &value)
+        != NGX_OK
+        || value.len == 0)
+    {
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    ngx_memzero(&rc, sizeof(ngx_regex_compile_t));
+
+    rc.pattern.data = ngx_pnalloc(r->pool, value.len);
+    if (rc.pattern.data == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    src = value.data;
+    dst = rc.pattern.data;
+
+    ngx_unescape_uri(&dst, &src, value.len, 0);
+
+    rc.pattern.len = dst - rc.pattern.data;
+    rc.pool = r->pool;
+    rc.err.len = NGX_MAX_CONF_ERRSTR;
+    rc.err.data = errstr;
+
+    if (ngx_regex_compile(&rc) != NGX_OK) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0, "%V", &rc.err);
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    sw->regex = rc.regex;
+
+#    if (NGX_HAVE_PCRE_JIT && !(NGX_PCRE2))
+
+    /*
+     * regexes compiled at runtime aren't studied by nginx, and its
+     * allocator for PCRE only works during ngx_regex_compile();
+     * with PCRE2 (nginx-1.21.5+), pcre2_jit_compile() would allocate
+     * through the same allocator and fail, such regexes aren't JIT
+     * compiled
+     */
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ngx_http_cache_purge_pcre_pool = r->pool;
+    old_malloc = pcre_malloc;
+    pcre_malloc = ngx_http_cache_purge_pcre_malloc;
+
+    err = NULL;
+    sw->regex->extra = pcre_study(sw->regex->code, PCRE_STUDY_JIT_COMPILE,
+                                  &err);
+
+    pcre_malloc = old_malloc;
+    ngx_http_cache_purge_pcre_pool = NULL;
+
+    if (sw->regex->extra) {
+        cln->handler = ngx_http_cache_purge_pcre_free_study;
+        cln->data = sw->regex->extra;
+
+    } else if (err) {
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                      "pcre_study() failed: %s in \"%V\"", err, &rc.pattern);
+    }
+
+#    endif /* NGX_HAVE_PCRE_JIT */
+
+    if (ngx_http_arg(r, (u_char *) "dry_run", sizeof("dry_run") - 1, &value)
+        == NGX_OK)
+    {
+        sw->dry_run = !(value.len == 1 && value.data[0] == '0');
+    }
+
+    sw->index = ngx_pcalloc(r->pool, sizeof(ngx_http_cache_purge_index_t));
+    if (sw->index == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (ngx_http_cache_purge_index_map(r->pool, &cplcf->regex_index,
+                                       sw->index, r->connection->log)
+        != NGX_OK)
+    {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    sw->batch = ngx_http_cache_purge_regex_batch;
+
+    if (cplcf->rate && !sw->dry_run) {
+        sw->rated = cplcf;
+    }
+
+    return ngx_http_cache_purge_sweep_start(r, sw);
+}
+
+ngx_int_t
+ngx_http_cache_purge_regex_batch(ngx_http_file_cache_t *cache,
+    ngx_http_cache_purge_sweep_t *sw, ngx_uint_t max, ngx_log_t *log)
+{
+    ngx_http_cache_purge_index_entry_t  *e;
+    ngx_http_cache_purge_index_t        *index;
+    ngx_http_file_cache_node_t          *fcn;
+    ngx_uint_t                           i, k, n;
+    ngx_int_t                            rc;
+    ngx_str_t                            key;
+    u_char                              *hash;
+    off_t                                size;
+
+    index = sw->index;
+
+    n = 0;
+
+    /* keys are matched without locks, only matches are looked up */
+
+    for (i = 0;
+         sw->scanned < index->header->entries
+         && i < NGX_HTTP_CACHE_PURGE_MATCH && n < max;
+         i++)
+    {
+        e = &index->entries[sw->scanned++];
+
+        if (e->key > index->header->keys
+            || e->key_len > index->header->keys - e->key)
+        {
+            ngx_log_error(NGX_LOG_ERR, log, 0,
+                          "invalid key in cache key index");
+            return NGX_ERROR;
+        }
+
+        key.len = e->key_len;
+        key.data = index->keys + e->key;
+
+        rc = ngx_regex_exec(sw->regex, &key, NULL, 0);
+
+        if (rc == NGX_REGEX_NO_MATCHED) {
+            continue;
+        }
+
+        if (rc < 0) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          ngx_regex_exec_n " failed: %i on \"%V\"",
+                          rc, &key);
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(&sw->keys[n++ * NGX_HTTP_CACHE_KEY_LEN], e->hash,
+                   NGX_HTTP_CACHE_KEY_LEN);
+    }
+
+    k = 0;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    for (i = 0; i < n; i++) {
+        hash = &sw->keys[i * NGX_HTTP_CACHE_KEY_LEN];
+
+        /* the index might be older than the cache */
+
+        fcn = ngx_http_cache_purge_lookup(cache, hash);
+
+        if (fcn == NULL || !fcn->exists) {
+            continue;
+        }
+
+#    if (nginx_version >= 1000001)
+        size = fcn->fs_size * cache->bsize;
+#    else
+        size = fcn->length;
+#    endif
+
+        sw->freed += size;
+
+        if (!sw->dry_run && sw->rated == NULL) {
+            ngx_http_cache_purge_retire(cache, fcn);
+        }
+
+        if (k != i) {
+            ngx_memcpy(&sw->keys[k * NGX_HTTP_CACHE_KEY_LEN], hash,
+                       NGX_HTTP_CACHE_KEY_LEN);
+        }
+
+        k++;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (sw->dry_run) {
+        sw->entries += k;
+
+    } else {
+        ngx_http_cache_purge_sweep_flush(cache, sw, k, log);
+    }
+
+    return (sw->scanned == index->header->entries) ? NGX_OK : NGX_AGAIN;
+}
+
+#    if (NGX_HAVE_PCRE_JIT && !(NGX_PCRE2))
+
+void *
+ngx_http_cache_purge_pcre_malloc(size_t size)
+{
+    return ngx_palloc(ngx_http_cache_purge_pcre_pool, size);
+}
+
+void
+ngx_http_cache_purge_pcre_free_study(void *data)
+{
+    pcre_free_study(data);
+}
+
+#    endif /* NGX_HAVE_PCRE_JIT */
+
+#  endif /* NGX_PCRE */
+
+ngx_int_t
+ngx_http_cache_purge_index_map(ngx_pool_t *pool, ngx_str_t *name,
+    ngx_http_cache_purge_index_t *index, ngx_log_t *log)
+{
+    ngx_pool_cleanup_t                   *cln;
+    ngx_http_cache_purge_index_header_t  *h;
+    ngx_file_info_t                       fi;
+    ngx_fd_t                              fd;
+    size_t                                size;
+    u_char                               *addr;
+
+    cln = ngx_pool_cleanup_add(pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    fd = ngx_open_file(name->data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ERR, log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", name->data);
+        return NGX_ERROR;
+    }
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", name->data);
+        goto failed;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+
+    if (size < sizeof(ngx_http_cache_purge_index_header_t)) {
+        goto invalid;
+    }
+
+    /* a new index is renamed over the old one, which stays mapped */
+
+    addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (addr == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_ERR, log, ngx_errno,
+                      "mmap(%uz) \"%s\" failed", size, name->data);
+        goto failed;
+    }
+
+    index->addr = addr;
+    index->size = size;
+
+    cln->handler = ngx_http_cache_purge_index_unmap;
+    cln->data = index;
+
+    h = (ngx_http_cache_purge_index_header_t *) addr;
+
+    size -= sizeof(ngx_http_cache_purge_index_header_t);
+
+    if (ngx_memcmp(h->magic, NGX_HTTP_CACHE_PURGE_INDEX_MAGIC,
+                   sizeof(h->magic))
+        != 0
+        || h->version != NGX_HTTP_CACHE_PURGE_INDEX_VERSION
+        || h->entries > size / sizeof(ngx_http_cache_purge_index_entry_t)
+        || h->keys
+           != size - h->entries * sizeof(ngx_http_cache_purge_index_entry_t))
+    {
+        goto invalid;
+    }
+
+    index->header = h;
+    index->entries = (ngx_http_cache_purge_index_entry_t *)
+                         (addr + sizeof(ngx_http_cache_purge_index_header_t));
+    index->keys = (u_char *) &index->entries[h->entries];
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name->data);
+    }
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ERR, log, 0,
+                  "\"%s\" is not a valid cache key index", name->data);
+
+failed:
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name->data);
+    }
+
+    return NGX_ERROR;
+}
+
+void
+ngx_http_cache_purge_index_unmap(void *data)
+{
+    ngx_http_cache_purge_index_t  *index = data;
+
+    if (munmap(index->addr, index->size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "munmap(%uz) failed", index->size);
+    }
+}
+
+ngx_int_t
+ngx_http_cache_purge_sweep_init(ngx_http_request_t *r, ngx_str_t *zone,
+    ngx_http_cache_purge_sweep_t **sw, ngx_http_file_cache_t **cache)
+{
+    ngx_http_cache_purge_sweep_t  *j;
+    ngx_int_t                      rc;
+
+    if (!(r->method & (NGX_HTTP_POST|NGX_HTTP_DELETE))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    j = ngx_pcalloc(r->pool, sizeof(ngx_http_cache_purge_sweep_t));
+    if (j == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    j->cache = ngx_crc32_short(zone->data, zone->len);
+    j->last = (ngx_rbtree_key_t) -1;
+
+    *cache = ngx_http_cache_purge_file_cache((ngx_cycle_t *) ngx_cycle,
+                                             j->cache);
+    if (*cache == NULL) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "cache \"%V\" not found", zone);
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    *sw = j;
+
+    return NGX_OK;
+}
+
+ngx_int_t
+ngx_http_cache_purge_sweep_start(ngx_http_request_t *r,
+    ngx_http_cache_purge_sweep_t *sw)
+{
+    ngx_http_cache_purge_ctx_t  *ctx;
+
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_cache_purge_ctx_t));
+    if (ctx == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ctx->sweep = sw;
+
+    ngx_http_set_ctx(r, ctx, ngx_http_cache_purge_module);
+
+    r->main->count++;
+
+    r->read_event_handler = ngx_http_test_reading;
+    r->write_event_handler = ngx_http_cache_purge_sweep_process;
+
+    ngx_http_cache_purge_sweep_process(r);
+
+    return NGX_DONE;
+}
+
+void
+ngx_http_cache_purge_sweep_process(ngx_http_request_t *r)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_sweep_t      *sw;
+    ngx_http_cache_purge_ctx_t        *ctx;
+    ngx_http_file_cache_t             *cache;
+    ngx_event_t                       *wev;
+    ngx_uint_t                         n;
+    ngx_msec_t                         delay;
+    ngx_int_t                          rc;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_cache_purge_module);
+    sw = ctx->sweep;
+
+    wev = r->connection->write;
+
+    if (wev->timer_set) {
+        /* still waiting for disk operations to be allowed */
+
+        if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+            ngx_http_finalize_request(r, NGX_ERROR);
+        }
+
+        return;
+    }
+
+    wev->timedout = 0;
+
+    /* the cache zone might be gone after a reload */
+
+    cache = ngx_http_cache_purge_file_cache((ngx_cycle_t *) ngx_cycle,
+                                            sw->cache);
+    if (cache == NULL) {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+
+    if (cache != sw->file_cache) {
+        if (ngx_http_cache_purge_file_name(r->pool, cache, sw->keys,
+                                           &sw->name)
+            != NGX_OK)
+        {
+            ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        sw->file_cache = cache;
+    }
+
+    cpmcf = ngx_http_get_module_main_conf(r, ngx_http_cache_purge_module);
+
+    n = NGX_HTTP_CACHE_PURGE_BATCH;
+
+    /* dry runs don't touch the disk, queued purges are paced by the rate */
+
+    if (cpmcf->io_rate && !sw->dry_run && sw->rated == NULL) {
+        n = ngx_http_cache_purge_io_take(cpmcf, sw->cache, n, 0, &delay);
+
+        if (n == 0) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http file cache purge sweep delayed: %M", delay);
+
+            ngx_add_timer(wev, delay);
+            return;
+        }
+    }
+
+    rc = sw->batch(cache, sw, n, r->connection->log);
+
+    if (rc == NGX_AGAIN) {
+        /* let other events in between batches */
+        ngx_post_event(wev, &ngx_posted_events);
+        return;
+    }
+
+    if (rc == NGX_ERROR) {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache purge sweep: %ui of %ui entries, %O bytes",
+                   sw->entries, sw->scanned, sw->freed);
+
+    r->read_event_handler = ngx_http_block_reading;
+    r->write_event_handler = ngx_http_request_empty_handler;
+
+    ngx_http_finalize_request(r, ngx_http_cache_purge_sweep_report(r, cache));
+}
+
+void
+ngx_http_cache_purge_sweep_flush(ngx_http_file_cache_t *cache,
+    ngx_http_cache_purge_sweep_t *sw, ngx_uint_t n, ngx_log_t *log)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_uint_t                         i, queued;
+    u_char                            *key;
+
+    cpmcf = ngx_http_cycle_get_module_main_conf(ngx_cycle,
+                                                ngx_http_cache_purge_module);
+
+    /* the purge zone might be gone after a reload */
+
+    if (sw->rated && cpmcf->shm_zone) {
+        queued = 0;
+
+        (void) ngx_http_cache_purge_spread(sw->rated, &sw->rated->post,
+                                           cpmcf->shm_zone->data, cache,
+                                           sw->keys, n, NULL, &queued, log);
+
+        sw->entries += queued;
+
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        key = &sw->keys[i * NGX_HTTP_CACHE_KEY_LEN];
+        (void) ngx_http_cache_purge_unlink(cache, &sw->name, key, 0, log);
+    }
+
+    sw->entries += n;
+}
+
+ngx_int_t
+ngx_http_cache_purge_sweep_report(ngx_http_request_t *r,
+    ngx_http_file_cache_t *cache)
+{
+    ngx_http_cache_purge_sweep_t  *sw;
+    ngx_http_cache_purge_ctx_t    *ctx;
+    ngx_chain_t                    out;
+    ngx_buf_t                     *b;
+    ngx_int_t                      rc;
+    off_t                          size;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_cache_purge_module);
+    sw = ctx->sweep;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+    size = cache->sh->size * cache->bsize;
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    b = ngx_create_temp_buf(r->pool,
+                            sizeof("{\"scanned\":,\"freed\":,\"entries\":,"
+                                   "\"size\":,\"dry_run\":true}\n") - 1
+                            + 3 * NGX_OFF_T_LEN + 2 * NGX_INT_T_LEN);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    /* evictions have a target, sweeps report what they looked at */
+
+    if (sw->target) {
+        b->last = ngx_sprintf(b->last, "{\"target\":%O,", sw->target);
+
+    } else {
+        b->last = ngx_sprintf(b->last, "{\"scanned\":%ui,", sw->scanned);
+    }
+
+    b->last = ngx_sprintf(b->last, "\"freed\":%O,\"entries\":%ui,\"size\":%O",
+                          sw->freed, sw->entries, size);
+
+    /* entries matched and bytes to be freed */
+
+    if (sw->dry_run) {
+        b->last = ngx_cpymem(b->last, ",\"dry_run\":true",
+                             sizeof(",\"dry_run\":true") - 1);
+    }
+
+    /* entries queued and freed later, never with a dry run */
+
+    if (sw->rated) {
+        b->last = ngx_cpymem(b->last, ",\"queued\":true",
+                             sizeof(",\"queued\":true") - 1);
+    }
+
+    *b->last++ = '}';
+    *b->last++ = LF;
+    b->last_buf = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    r->headers_out.content_type.len = sizeof("application/json") - 1;
+    r->headers_out.content_type.data = (u_char *) "application/json";
+    r->headers_out.status = sw->rated ? NGX_HTTP_ACCEPTED : NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    rc = ngx_http_send_header(r);
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+ngx_buf_t *
+ngx_http_cache_purge_stream_reserve(ngx_http_request_t *r,
+    ngx_http_cache_purge_stream_t *st, size_t size)
+{
+    ngx_chain_t  *cl;
+    ngx_buf_t    *b;
+    size_t        len;
+
+    b = st->buf;
+
+    if (b && (size_t) (b->end - b->last) >= size) {
+        return b;
+    }
+
+    cl = ngx_chain_get_free_buf(r->pool, &st->free);
+    if (cl == NULL) {
+        return NULL;
+    }
+
+    b = cl->buf;
+
+    if (b->start == NULL || (size_t) (b->end - b->start) < size) {
+        len = ngx_max(size, (size_t) ngx_pagesize);
+
+        b->start = ngx_palloc(r->pool, len);
+        if (b->start == NULL) {
+            return NULL;
+        }
+
+        b->end = b->start + len;
+    }
+
+    b->pos = b->start;
+    b->last = b->start;
+    b->temporary = 1;
+    b->tag = (ngx_buf_tag_t) &ngx_http_cache_purge_module;
+
+    *st->last_out = cl;
+    st->last_out = &cl->next;
+
+    st->buf = b;
+
+    return b;
+}
+
+ngx_int_t
+ngx_http_cache_purge_stream_send(ngx_http_request_t *r,
+    ngx_http_cache_purge_stream_t *st)
+{
+    ngx_int_t  rc;
+
+    if (st->buf) {
+        st->buf->flush = 1;
+    }
+
+    rc = ngx_http_output_filter(r, st->out);
+
+    ngx_chain_update_chains(r->pool, &st->free, &st->busy, &st->out,
+                            (ngx_buf_tag_t) &ngx_http_cache_purge_module);
+
+    st->last_out = &st->out;
+    st->buf = NULL;
+
+    return rc;
+}
+
+#  if (NGX_HAVE_UNIX_DOMAIN)
+
+void
+ngx_http_cache_purge_ingest_handler(ngx_event_t *rev)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_zone_t       *zone;
+    ngx_connection_t                  *c;
+    ngx_pool_t                        *pool;
+    ngx_uint_t                         i, n, errors;
+    ngx_err_t                          err;
+    ssize_t                            size;
+    uint32_t                           cache, id;
+    u_char                            *p, *last, *eol, *keys, *key;
+
+    c = rev->data;
+    cpmcf = c->data;
+
+    if (c->close) {
+        ngx_close_connection(c);
+        return;
+    }
+
+    pool = ngx_create_pool(ngx_pagesize, c->log);
+    if (pool == NULL) {
+        return;
+    }
+
+    zone = cpmcf->shm_zone->data;
+    keys = ngx_http_cache_purge_ingest_keys;
+
+    cache = 0;
+    n = 0;
+    errors = 0;
+
+    /* up to a batch of datagrams per event, not to starve requests */
+
+    for (i = 0; i < cpmcf->batch; i++) {
+
+        size = recv(c->fd, ngx_http_cache_purge_ingest_buf,
+                    NGX_HTTP_CACHE_PURGE_DATAGRAM, 0);
+
+        if (size == -1) {
+            err = ngx_socket_errno;
+
+            if (err == NGX_EAGAIN) {
+                break;
+            }
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            ngx_log_error(NGX_LOG_ALERT, c->log, err,
+                          "recv() on %V failed", &cpmcf->listen->name);
+            break;
+        }
+
+        p = ngx_http_cache_purge_ingest_buf;
+        last = p + size;
+
+        for ( /* void */ ; p < last; p = eol + 1) {
+
+            eol = ngx_strlchr(p, last, LF);
+            if (eol == NULL) {
+                eol = last;
+            }
+
+            if (eol == p) {
+                continue;
+            }
+
+            key = &keys[n * NGX_HTTP_CACHE_KEY_LEN];
+
+            if (ngx_http_cache_purge_ingest_line(p, eol, &id, key) != NGX_OK)
+            {
+                ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                              "invalid cache purge message \"%*s\"",
+                              (size_t) (eol - p), p);
+                errors++;
+                continue;
+            }
+
+            (void) ngx_atomic_fetch_add(&zone->sh->ingest_keys, 1);
+
+            /* keys are purged in batches for the same cache zone */
+
+            if (n && id != cache) {
+                ngx_http_cache_purge_ingest_flush(cpmcf, pool, cache, keys, n,
+                                                  c->log);
+                ngx_memcpy(keys, key, NGX_HTTP_CACHE_KEY_LEN);
+                n = 0;
+            }
+
+            cache = id;
+
+            if (++n == cpmcf->batch) {
+                ngx_http_cache_purge_ingest_flush(cpmcf, pool, cache, keys, n,
+                                                  c->log);
+                n = 0;
+            }
+        }
+    }
+
+    if (n) {
+        ngx_http_cache_purge_ingest_flush(cpmcf, pool, cache, keys, n,
+                                          c->log);
+    }
+
+    if (errors) {
+        (void) ngx_atomic_fetch_add(&zone->sh->ingest_errors, errors);
+    }
+
+    ngx_destroy_pool(pool);
+
+    if (i == cpmcf->batch) {
+        /* more datagrams might be waiting */
+        ngx_post_event(rev, &ngx_posted_events);
+        return;
+    }
+
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        ngx_close_connection(c);
+    }
+}
+
+ngx_int_t
+ngx_http_cache_purge_ingest_line(u_char *p, u_char *last, uint32_t *cache,
+    u_char *key)
+{
+    ngx_md5_t   md5;
+    u_char      type, *name;
+
+    /* "K <zone> <key>" or "H <zone> <md5 of key in hex>" */
+
+    if (last - p < 4 || p[1] != ' ') {
+        return NGX_ERROR;
+    }
+
+    type = p[0];
+    p += 2;
+
+    name = p;
+    p = ngx_strlchr(p, last, ' ');
+
+    if (p == NULL || p == name || p + 1 == last) {
+        return NGX_ERROR;
+    }
+
+    *cache = ngx_crc32_short(name, p - name);
+    p++;
+
+    switch (type) {
+
+    case 'K':
+        ngx_md5_init(&md5);
+        ngx_md5_update(&md5, p, last - p);
+        ngx_md5_final(key, &md5);
+        return NGX_OK;
+
+    case 'H':
+        return ngx_http_cache_purge_hex_key(key, p, last - p);
+
+    default:
+        return NGX_ERROR;
+    }
+}
+
+void
+ngx_http_cache_purge_ingest_flush(ngx_http_cache_purge_main_conf_t *cpmcf,
+    ngx_pool_t *pool, uint32_t cache, u_char *keys, ngx_uint_t n,
+    ngx_log_t *log)
+{
+    ngx_http_cache_purge_loc_conf_t  *cplcf;
+    ngx_http_cache_purge_zone_t      *zone;
+    ngx_http_file_cache_t            *file_cache;
+    ngx_http_conf_ctx_t              *ctx;
+    ngx_uint_t                        purged;
+    ngx_msec_t                        delay;
+
+    zone = cpmcf->shm_zone->data;
+
+    /* purges without a location follow settings of the http block */
+
+    ctx = (ngx_http_conf_ctx_t *) ngx_cycle->conf_ctx[ngx_http_module.index];
+    cplcf = ctx->loc_conf[ngx_http_cache_purge_module.ctx_index];
+
+    file_cache = ngx_http_cache_purge_file_cache((ngx_cycle_t *) ngx_cycle,
+                                                 cache);
+    if (file_cache == NULL
+        || ngx_http_cache_purge_hashes(&cplcf->post, zone, pool, file_cache,
+                                       keys, n, &purged, NULL, log)
+           != NGX_OK)
+    {
+        (void) ngx_atomic_fetch_add(&zone->sh->ingest_errors, n);
+        return;
+    }
+
+    (void) ngx_atomic_fetch_add(&zone->sh->ingest_purged, purged);
+
+    if (cpmcf->io_rate && purged) {
+        (void) ngx_http_cache_purge_io_take(cpmcf, cache, purged, 1, &delay);
+    }
+}
+
+#  endif /* NGX_HAVE_UNIX_DOMAIN */
+
+/*
+ * Based on: ngx_http_limit_req_module.c/ngx_http_limit_req_lookup
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+ngx_uint_t
+ngx_http_cache_purge_io_take(ngx_http_cache_purge_main_conf_t *cpmcf,
+    uint32_t cache, ngx_uint_t n, ngx_uint_t force, ngx_msec_t *delay)
+{
+    ngx_http_cache_purge_bucket_t  *b;
+    ngx_http_cache_purge_zone_t    *zone;
+    ngx_msec_int_t                  ms;
+    ngx_msec_t                      now;
+    ngx_uint_t                      drained, capacity, taken;
+
+    zone = cpmcf->shm_zone->data;
+    now = ngx_http_cache_purge_msec();
+
+    *delay = 0;
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    b = ngx_http_cache_purge_bucket_locked(zone, cache);
+
+    if (b == NULL) {
+        ngx_shmtx_unlock(&zone->shpool->mutex);
+
+        /* admission control is best effort, don't hold purges back */
+        return n;
+    }
+
+    ms = (ngx_msec_int_t) (now - b->last);
+
+    if (ms > 0) {
+        drained = cpmcf->io_rate * ms;
+
+        b->excess = (b->excess > drained) ? b->excess - drained : 0;
+        b->last = now;
+    }
+
+    capacity = cpmcf->io_burst * 1000;
+
+    if (force) {
+        /* operations already done, possibly over the budget */
+        taken = n;
+
+    } else {
+        taken = (b->excess < capacity) ? (capacity - b->excess) / 1000 : 0;
+        taken = ngx_min(taken, n);
+    }
+
+    b->excess += taken * 1000;
+
+    if (taken < n) {
+        *delay = (b->excess + 1000 - capacity + cpmcf->io_rate - 1)
+                 / cpmcf->io_rate;
+    }
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    return taken;
+}
+
+ngx_http_cache_purge_bucket_t *
+ngx_http_cache_purge_bucket_locked(ngx_http_cache_purge_zone_t *zone,
+    uint32_t cache)
+{
+    ngx_http_cache_purge_bucket_t  *b;
+    ngx_queue_t                    *q;
+
+    /* purge zone must be locked by the caller */
+
+    for (q = ngx_queue_head(&zone->sh->buckets);
+         q != ngx_queue_sentinel(&zone->sh->buckets);
+         q = ngx_queue_next(q))
+    {
+        b = ngx_queue_data(q, ngx_http_cache_purge_bucket_t, queue);
+
+        if (b->cache == cache) {
+            return b;
+        }
+    }
+
+    b = ngx_slab_alloc_locked(zone->shpool,
+                              sizeof(ngx_http_cache_purge_bucket_t));
+    if (b == NULL) {
+        return NULL;
+    }
+
+    b->cache = cache;
+    b->last = ngx_http_cache_purge_msec();
+    b->excess = 0;
+    b->rate_due = 0;
+    b->rate_queued = 0;
+
+    ngx_queue_insert_tail(&zone->sh->buckets, &b->queue);
+
+    return b;
+}
+
+ngx_int_t
+ngx_http_cache_purge_admit(ngx_http_request_t *r)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_ctx_t        *ctx;
+    ngx_msec_t                         delay;
+    uint32_t                           cache;
+
+    cpmcf = ngx_http_get_module_main_conf(r, ngx_http_cache_purge_module);
+
+    if (cpmcf->io_rate == 0) {
+        return NGX_OK;
+    }
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_cache_purge_module);
+
+    if (ctx == NULL) {
+        ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_cache_purge_ctx_t));
+        if (ctx == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_http_set_ctx(r, ctx, ngx_http_cache_purge_module);
+    }
+
+    /* purges resumed after AIO were admitted already */
+
+    if (ctx->admitted) {
+        return NGX_OK;
+    }
+
+    cache = ngx_http_cache_purge_cache_id(r->cache->file_cache);
+
+    if (ngx_http_cache_purge_io_take(cpmcf, cache, 1, 0, &delay) == 1) {
+        ctx->admitted = 1;
+        return NGX_OK;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache purge delayed: %M", delay);
+
+    r->read_event_handler = ngx_http_test_reading;
+    r->write_event_handler = ngx_http_cache_purge_delay;
+
+    ngx_add_timer(r->connection->write, delay);
+
+    return NGX_AGAIN;
+}
+
+/*
+ * Based on: ngx_http_limit_req_module.c/ngx_http_limit_req_delay
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+void
+ngx_http_cache_purge_delay(ngx_http_request_t *r)
+{
+    ngx_event_t  *wev;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache purge delay");
+
+    wev = r->connection->write;
+
+    if (!wev->timedout) {
+
+        if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+            ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        }
+
+        return;
+    }
+
+    wev->timedout = 0;
+
+    if (ngx_handle_read_event(r->connection->read, 0) != NGX_OK) {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+
+    r->read_event_handler = ngx_http_block_reading;
+    r->write_event_handler = ngx_http_cache_purge_handler;
+
+    ngx_http_cache_purge_handler(r);
+}
+
+void
+ngx_http_cache_purge_timer_handler(ngx_event_t *ev)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_zone_t       *zone;
+    ngx_http_cache_purge_job_t        *job, *jobs;
+    ngx_http_file_cache_t             *cache;
+    ngx_queue_t                       *q, *next, *slot;
+    ngx_pool_t                        *pool;
+    ngx_uint_t                         i, j, k, n, purged, taken;
+    ngx_msec_t                         delay;
+    time_t                             now, t, due;
+    u_char                            *keys;
+
+    cpmcf = ev->data;
+    zone = cpmcf->shm_zone->data;
+
+    keys = ngx_http_cache_purge_timer_keys;
+    jobs = ngx_http_cache_purge_timer_jobs;
+
+    now = ngx_time();
+    n = 0;
+
+    /*
+     * the first worker to get here after a tick moves the wheel,
+     * so every job is executed by a single worker process
+     */
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    t = zone->sh->wheel_last;
+
+    if (now - t > NGX_HTTP_CACHE_PURGE_WHEEL) {
+        t = now - NGX_HTTP_CACHE_PURGE_WHEEL;
+    }
+
+    while (zone->sh->scheduled && t < now) {
+
+        slot = &zone->sh->wheel[(t + 1) % NGX_HTTP_CACHE_PURGE_WHEEL];
+
+        for (q = ngx_queue_head(slot);
+             q != ngx_queue_sentinel(slot);
+             q = next)
+        {
+            next = ngx_queue_next(q);
+
+            job = ngx_queue_data(q, ngx_http_cache_purge_job_t, queue);
+
+            if (job->due > now) {
+                /* due in one of the next rounds */
+                continue;
+            }
+
+            if (n == cpmcf->batch) {
+                /* over budget, the rest of the slot waits for the next tick */
+                goto full;
+            }
+
+            jobs[n] = *job;
+            ngx_memcpy(&keys[n * NGX_HTTP_CACHE_KEY_LEN], job->key,
+                       NGX_HTTP_CACHE_KEY_LEN);
+            n++;
+
+            ngx_queue_remove(q);
+            ngx_slab_free_locked(zone->shpool, job);
+
+            zone->sh->scheduled--;
+        }
+
+        t++;
+    }
+
+    if (zone->sh->scheduled == 0 && t < now) {
+        t = now;
+    }
+
+full:
+
+    if (t > zone->sh->wheel_last) {
+        zone->sh->wheel_last = t;
+    }
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    if (n) {
+        pool = ngx_create_pool(ngx_pagesize, ev->log);
+        if (pool == NULL) {
+            goto next;
+        }
+
+        /* jobs of the same cache and steps are purged under a single lock */
+
+        for (i = 0; i < n; i = j) {
+
+            for (j = i + 1;
+                 j < n && jobs[j].cache == jobs[i].cache
+                 && jobs[j].post.retain == jobs[i].post.retain
+                 && jobs[j].post.vary == jobs[i].post.vary;
+                 j++)
+            {
+                /* void */
+            }
+
+            cache = ngx_http_cache_purge_file_cache((ngx_cycle_t *) ngx_cycle,
+                                                    jobs[i].cache);
+            if (cache == NULL) {
+                ngx_log_error(NGX_LOG_WARN, ev->log, 0,
+                              "cache zone of %ui scheduled purges not found",
+                              j - i);
+                continue;
+            }
+
+            taken = j - i;
+
+            if (cpmcf->io_rate) {
+                taken = ngx_http_cache_purge_io_take(cpmcf, jobs[i].cache,
+                                                     j - i, 0, &delay);
+            }
+
+            if (taken < j - i) {
+                /* over the disk budget, back to the wheel */
+
+                due = now + 1 + delay / 1000;
+
+                ngx_shmtx_lock(&zone->shpool->mutex);
+
+                for (k = i + taken; k < j; k++) {
+                    if (ngx_http_cache_purge_job_add_locked(zone, jobs[i].cache,
+                                           &keys[k * NGX_HTTP_CACHE_KEY_LEN],
+                                           &jobs[i].post, &due, ev->log)
+                        != NGX_OK)
+                    {
+                        break;
+                    }
+                }
+
+                ngx_shmtx_unlock(&zone->shpool->mutex);
+            }
+
+            if (taken == 0) {
+                continue;
+            }
+
+            if (ngx_http_cache_purge_hashes(&jobs[i].post, zone, pool, cache,
+                                            &keys[i * NGX_HTTP_CACHE_KEY_LEN],
+                                            taken, &purged, NULL, ev->log)
+                != NGX_OK)
+            {
+                break;
+            }
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                           "http file cache scheduled purge: %ui of %ui",
+                           purged, taken);
+        }
+
+        ngx_destroy_pool(pool);
+    }
+
+next:
+
+    if (cpmcf->snapshot.data) {
+
+        /* up to 16 batches of loaded keys are checked on each tick */
+
+        for (i = 0; i < 16; i++) {
+            if (ngx_http_cache_purge_snapshot_reconcile(zone, ev->log)
+                != NGX_AGAIN)
+            {
+                break;
+            }
+        }
+
+        /* without a master process there are no cache helper processes */
+
+        if (ngx_process == NGX_PROCESS_SINGLE) {
+            ngx_http_cache_purge_snapshot_save(cpmcf, 0, ev->log);
+        }
+    }
+
+    /* shards of purges started by other worker processes */
+
+    ngx_http_cache_purge_shard_post(zone);
+
+    if (!ngx_exiting) {
+        ngx_add_timer(ev, 1000);
+    }
+}
+
+void
+ngx_http_cache_purge_shard_post(ngx_http_cache_purge_zone_t *zone)
+{
+    ngx_event_t  *ev;
+
+    ev = &ngx_http_cache_purge_shard_event;
+
+    if (ngx_http_cache_purge_shard_job || ev->posted || ev->timer_set
+        || ev->handler == NULL)
+    {
+        /* busy already */
+        return;
+    }
+
+    /* checked without the lock, claims are made under it */
+
+    if (ngx_queue_empty(&zone->sh->shared)) {
+        return;
+    }
+
+    ngx_post_event(ev, &ngx_posted_events);
+}
+
+void
+ngx_http_cache_purge_shard_handler(ngx_event_t *ev)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_claim_t      *claim;
+    ngx_http_cache_purge_sweep_t      *sw;
+    ngx_http_cache_purge_zone_t       *zone;
+    ngx_http_file_cache_t             *cache;
+    ngx_uint_t                         n;
+    ngx_msec_t                         delay;
+
+    cpmcf = ev->data;
+    zone = cpmcf->shm_zone->data;
+    sw = ngx_http_cache_purge_shard;
+
+    ev->timedout = 0;
+
+    if (ngx_http_cache_purge_shard_job == NULL
+        && ngx_http_cache_purge_shard_claim(zone) != NGX_OK)
+    {
+        return;
+    }
+
+    /* progress is reported once a second, not to be taken over */
+
+    if (ngx_http_cache_purge_shard_alive != ngx_time()) {
+
+        ngx_shmtx_lock(&zone->shpool->mutex);
+
+        claim = ngx_http_cache_purge_shard_find_locked(zone);
+
+        if (claim) {
+            claim->alive = ngx_time();
+        }
+
+        ngx_shmtx_unlock(&zone->shpool->mutex);
+
+        if (claim == NULL) {
+            ngx_log_error(NGX_LOG_WARN, ev->log, 0,
+                          "shard of sharded purge was taken over");
+
+            ngx_http_cache_purge_shard_job = NULL;
+            goto next;
+        }
+
+        ngx_http_cache_purge_shard_alive = ngx_time();
+    }
+
+    cache = ngx_http_cache_purge_file_cache((ngx_cycle_t *) ngx_cycle,
+                                            sw->cache);
+    if (cache == NULL) {
+        /* the cache zone is gone after a reload */
+        goto done;
+    }
+
+    if (cache != sw->file_cache) {
+        if (ngx_http_cache_purge_file_name(ngx_cycle->pool, cache, sw->keys,
+                                           &sw->name)
+            != NGX_OK)
+        {
+            goto done;
+        }
+
+        sw->file_cache = cache;
+    }
+
+    n = NGX_HTTP_CACHE_PURGE_BATCH;
+
+    if (cpmcf->io_rate) {
+        n = ngx_http_cache_purge_io_take(cpmcf, sw->cache, n, 0, &delay);
+
+        if (n == 0) {
+            ngx_add_timer(ev, delay);
+            return;
+        }
+    }
+
+    if (ngx_http_cache_purge_filter_batch(cache, sw, n, ev->log) == NGX_AGAIN)
+    {
+        ngx_post_event(ev, &ngx_posted_events);
+        return;
+    }
+
+done:
+
+    ngx_http_cache_purge_shard_done(zone);
+
+next:
+
+    /* the next shard is taken right away, of this purge or another */
+
+    if (ngx_http_cache_purge_shard_claim(zone) == NGX_OK) {
+        ngx_post_event(ev, &ngx_posted_events);
+    }
+}
+
+ngx_int_t
+ngx_http_cache_purge_shard_claim(ngx_http_cache_purge_zone_t *zone)
+{
+    ngx_http_cache_purge_shared_t  *job;
+    ngx_http_cache_purge_claim_t   *claim;
+    ngx_http_cache_purge_sweep_t   *sw;
+    ngx_rbtree_key_t                step;
+    ngx_queue_t                    *q, *next;
+    ngx_uint_t                      i, expired;
+    time_t                          now;
+
+    if (ngx_exiting) {
+        return NGX_DECLINED;
+    }
+
+    now = ngx_time();
+    expired = 0;
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    for (q = ngx_queue_head(&zone->sh->shared);
+         q != ngx_queue_sentinel(&zone->sh->shared);
+         q = next)
+    {
+        next = ngx_queue_next(q);
+        job = ngx_queue_data(q, ngx_http_cache_purge_shared_t, queue);
+
+        expired += ngx_http_cache_purge_shared_expire_locked(job, now);
+
+        if (job->abandoned) {
+            if (job->active == 0) {
+                ngx_queue_remove(&job->queue);
+                ngx_slab_free_locked(zone->shpool, job);
+            }
+
+            continue;
+        }
+
+        if (job->free) {
+            goto found;
+        }
+    }
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    if (expired) {
+        ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                      "%ui shards of sharded purges taken over"
+                      " from stalled worker processes", expired);
+    }
+
+    return NGX_DECLINED;
+
+found:
+
+    /*
+     * shards are claimed one at a time by whichever worker process is
+     * free, so the ones done early take over shards left to the others
+     */
+
+    for (i = 0; i < job->shards; i++) {
+        if (job->claims[i].state == NGX_HTTP_CACHE_PURGE_SHARD_FREE) {
+            break;
+        }
+    }
+
+    claim = &job->claims[i];
+
+    claim->state = NGX_HTTP_CACHE_PURGE_SHARD_CLAIMED;
+    claim->pid = ngx_pid;
+    claim->alive = now;
+
+    job->free--;
+    job->active++;
+
+    sw = ngx_http_cache_purge_shard;
+    step = ((ngx_rbtree_key_t) -1) / job->shards;
+
+    sw->cache = job->cache;
+    sw->filter = job->filter;
+    sw->first = i * step;
+    sw->last = (i == job->shards - 1) ? (ngx_rbtree_key_t) -1
+                                      : (i + 1) * step - 1;
+
+    ngx_http_cache_purge_shard_job = job;
+    ngx_http_cache_purge_shard_id = job->id;
+    ngx_http_cache_purge_shard_index = i;
+    ngx_http_cache_purge_shard_alive = now;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache purge shard %ui of %ui",
+                   i + 1, job->shards);
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    if (expired) {
+        ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                      "%ui shards of sharded purges taken over"
+                      " from stalled worker processes", expired);
+    }
+
+    sw->started = 0;
+    sw->scanned = 0;
+    sw->freed = 0;
+    sw->entries = 0;
+
+    return NGX_OK;
+}
+
+void
+ngx_http_cache_purge_shard_done(ngx_http_cache_purge_zone_t *zone)
+{
+    ngx_http_cache_purge_shared_t  *job;
+    ngx_http_cache_purge_claim_t   *claim;
+    ngx_http_cache_purge_sweep_t   *sw;
+
+    job = ngx_http_cache_purge_shard_job;
+    sw = ngx_http_cache_purge_shard;
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    /* results of a shard taken over are left to the new owner */
+
+    claim = ngx_http_cache_purge_shard_find_locked(zone);
+
+    if (claim) {
+        claim->state = NGX_HTTP_CACHE_PURGE_SHARD_DONE;
+
+        job->scanned += sw->scanned;
+        job->entries += sw->entries;
+        job->freed += sw->freed;
+
+        job->active--;
+
+        if (job->abandoned && job->active == 0) {
+            ngx_queue_remove(&job->queue);
+            ngx_slab_free_locked(zone->shpool, job);
+        }
+    }
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    ngx_http_cache_purge_shard_job = NULL;
+}
+
+ngx_http_cache_purge_claim_t *
+ngx_http_cache_purge_shard_find_locked(ngx_http_cache_purge_zone_t *zone)
+{
+    ngx_http_cache_purge_shared_t  *job;
+    ngx_http_cache_purge_claim_t   *claim;
+    ngx_queue_t                    *q;
+
+    /* purge zone must be locked by the caller */
+
+    /*
+     * the sharded purge might be gone, and its memory reused, if the shard
+     * was taken over while this worker process was stalled
+     */
+
+    for (q = ngx_queue_head(&zone->sh->shared);
+         q != ngx_queue_sentinel(&zone->sh->shared);
+         q = ngx_queue_next(q))
+    {
+        job = ngx_queue_data(q, ngx_http_cache_purge_shared_t, queue);
+
+        if (job != ngx_http_cache_purge_shard_job
+            || job->id != ngx_http_cache_purge_shard_id)
+        {
+            continue;
+        }
+
+        claim = &job->claims[ngx_http_cache_purge_shard_index];
+
+        if (claim->state == NGX_HTTP_CACHE_PURGE_SHARD_CLAIMED
+            && claim->pid == ngx_pid)
+        {
+            return claim;
+        }
+
+        break;
+    }
+
+    return NULL;
+}
+
+ngx_uint_t
+ngx_http_cache_purge_shared_expire_locked(ngx_http_cache_purge_shared_t *job,
+    time_t now)
+{
+    ngx_http_cache_purge_claim_t  *claim;
+    ngx_uint_t                     i, n;
+
+    /* purge zone must be locked by the caller */
+
+    if (!job->abandoned
+        && now - job->alive >= NGX_HTTP_CACHE_PURGE_SHARD_TIMEOUT)
+    {
+        /* the worker process waiting for the purge is gone */
+        ngx_http_cache_purge_shared_abandon_locked(job);
+    }
+
+    n = 0;
+
+    for (i = 0; i < job->shards; i++) {
+        claim = &job->claims[i];
+
+        if (claim->state != NGX_HTTP_CACHE_PURGE_SHARD_CLAIMED
+            || now - claim->alive < NGX_HTTP_CACHE_PURGE_SHARD_TIMEOUT)
+        {
+            continue;
+        }
+
+        /* the worker process walking the shard died or is stuck */
+
+        if (job->abandoned) {
+            claim->state = NGX_HTTP_CACHE_PURGE_SHARD_DONE;
+
+        } else {
+            claim->state = NGX_HTTP_CACHE_PURGE_SHARD_FREE;
+            job->free++;
+        }
+
+        job->active--;
+        n++;
+    }
+
+    return n;
+}
+
+void
+ngx_http_cache_purge_shared_abandon_locked(ngx_http_cache_purge_shared_t *job)
+{
+    ngx_uint_t  i;
+
+    /* purge zone must be locked by the caller */
+
+    for (i = 0; i < job->shards; i++) {
+        if (job->claims[i].state == NGX_HTTP_CACHE_PURGE_SHARD_FREE) {
+            job->claims[i].state = NGX_HTTP_CACHE_PURGE_SHARD_DONE;
+        }
+    }
+
+    job->free = 0;
+    job->abandoned = 1;
+}
+
+void
+ngx_http_cache_purge_error_add(ngx_http_request_t *r,
+    ngx_http_cache_purge_zone_t *zone)
+{
+    ngx_http_cache_purge_error_t  *en;
+    ngx_http_cache_t              *c;
+    ngx_queue_t                   *q;
+    ngx_uint_t                     status;
+    uint32_t                       cache;
+
+    c = r->cache;
+    status = r->headers_out.status;
+
+    /*
+     * other responses only replace an error stored under the same key,
+     * there is nothing to look up (and lock for) until errors are stored
+     */
+
+    if (status < NGX_HTTP_BAD_REQUEST
+        && zone->sh->errors.root == zone->sh->errors.sentinel)
+    {
+        return;
+    }
+
+    cache = ngx_http_cache_purge_cache_id(c->file_cache);
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    en = (ngx_http_cache_purge_error_t *)
+             ngx_http_cache_purge_find(&zone->sh->errors, cache, c->key);
+
+    if (status < NGX_HTTP_BAD_REQUEST) {
+        if (en) {
+            ngx_http_cache_purge_error_free(zone, en);
+        }
+
+        ngx_shmtx_unlock(&zone->shpool->mutex);
+
+        return;
+    }
+
+    if (en == NULL) {
+        en = ngx_slab_alloc_locked(zone->shpool,
+                                   sizeof(ngx_http_cache_purge_error_t));
+
+        if (en == NULL && !ngx_queue_empty(&zone->sh->errors_queue)) {
+            /* forget the least recently stored error */
+
+            q = ngx_queue_last(&zone->sh->errors_queue);
+
+            ngx_http_cache_purge_error_free(zone,
+                                            (ngx_http_cache_purge_error_t *)
+                    ngx_queue_data(q, ngx_http_cache_purge_node_t, queue));
+
+            en = ngx_slab_alloc_locked(zone->shpool,
+                                       sizeof(ngx_http_cache_purge_error_t));
+        }
+
+        if (en == NULL) {
+            ngx_shmtx_unlock(&zone->shpool->mutex);
+
+            ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                          "could not allocate error node%s",
+                          zone->shpool->log_ctx);
+            return;
+        }
+
+        ngx_memcpy((u_char *) &en->sn.node.key, c->key,
+                   sizeof(ngx_rbtree_key_t));
+        ngx_memcpy(en->sn.key, c->key, NGX_HTTP_CACHE_KEY_LEN);
+        en->sn.cache = cache;
+
+        ngx_rbtree_insert(&zone->sh->errors, &en->sn.node);
+
+    } else {
+        ngx_queue_remove(&en->sn.queue);
+    }
+
+    en->status = (u_short) status;
+
+    ngx_queue_insert_head(&zone->sh->errors_queue, &en->sn.queue);
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache purge error stored: %ui", status);
+}
+
+void
+ngx_http_cache_purge_error_free(ngx_http_cache_purge_zone_t *zone,
+    ngx_http_cache_purge_error_t *en)
+{
+    /* purge zone must be locked by the caller */
+
+    ngx_queue_remove(&en->sn.queue);
+    ngx_rbtree_delete(&zone->sh->errors, &en->sn.node);
+    ngx_slab_free_locked(zone->shpool, en);
+}
+
+#  if (nginx_version >= 1007007)
+
+void
+ngx_http_cache_purge_variant_add(ngx_http_request_t *r,
+    ngx_http_cache_purge_zone_t *zone)
+{
+    ngx_http_cache_purge_primary_t  *pn;
+    ngx_http_cache_purge_variant_t  *vn;
+    ngx_http_cache_t                *c;
+    ngx_queue_t                     *q;
+    uint32_t                         cache;
+
+    c = r->cache;
+    cache = ngx_http_cache_purge_cache_id(c->file_cache);
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    pn = (ngx_http_cache_purge_primary_t *)
+             ngx_http_cache_purge_find(&zone->sh->primaries, cache, c->main);
+
+    if (pn == NULL) {
+        pn = ngx_slab_alloc_locked(zone->shpool,
+                                   sizeof(ngx_http_cache_purge_primary_t));
+
+        if (pn == NULL && !ngx_queue_empty(&zone->sh->primaries_queue)) {
+            /* drop variants of the least recently stored primary key */
+
+            q = ngx_queue_last(&zone->sh->primaries_queue);
+
+            ngx_http_cache_purge_primary_free(zone,
+                                        (ngx_http_cache_purge_primary_t *)
+                    ngx_queue_data(q, ngx_http_cache_purge_node_t, queue));
+
+            pn = ngx_slab_alloc_locked(zone->shpool,
+                                       sizeof(ngx_http_cache_purge_primary_t));
+        }
+
+        if (pn == NULL) {
+            goto failed;
+        }
+
+        ngx_memcpy((u_char *) &pn->sn.node.key, c->main,
+                   sizeof(ngx_rbtree_key_t));
+        ngx_memcpy(pn->sn.key, c->main, NGX_HTTP_CACHE_KEY_LEN);
+        pn->sn.cache = cache;
+        ngx_queue_init(&pn->variants);
+
+        ngx_rbtree_insert(&zone->sh->primaries, &pn->sn.node);
+
+    } else {
+        ngx_queue_remove(&pn->sn.queue);
+
+        for (q = ngx_queue_head(&pn->variants);
+             q != ngx_queue_sentinel(&pn->variants);
+             q = ngx_queue_next(q))
+        {
+            vn = ngx_queue_data(q, ngx_http_cache_purge_variant_t, queue);
+
+            if (ngx_memcmp(vn->key, c->key, NGX_HTTP_CACHE_KEY_LEN) == 0) {
+                goto done;
+            }
+        }
+    }
+
+    vn = ngx_slab_alloc_locked(zone->shpool,
+                               sizeof(ngx_http_cache_purge_variant_t));
+    if (vn == NULL) {
+        ngx_queue_insert_head(&zone->sh->primaries_queue, &pn->sn.queue);
+        goto failed;
+    }
+
+    ngx_memcpy(vn->key, c->key, NGX_HTTP_CACHE_KEY_LEN);
+    ngx_queue_insert_tail(&pn->variants, &vn->queue);
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache purge variant stored");
+
+done:
+
+    ngx_queue_insert_head(&zone->sh->primaries_queue, &pn->sn.queue);
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    return;
+
+failed:
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                  "could not allocate variant node%s",
+                  zone->shpool->log_ctx);
+}
+
+ngx_int_t
+ngx_http_cache_purge_variants(ngx_http_request_t *r,
+    ngx_http_cache_purge_zone_t *zone)
+{
+    ngx_http_cache_t  *c;
+    ngx_array_t        keys;
+    ngx_uint_t         n;
+    ngx_int_t          rc;
+    uint32_t           cache;
+    u_char            *key;
+
+    c = r->cache;
+    cache = ngx_http_cache_purge_cache_id(c->file_cache);
+
+    if (ngx_array_init(&keys, r->pool, 4, NGX_HTTP_CACHE_KEY_LEN) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    /* primary entry, if the purge itself went to a secondary key */
+
+    if (ngx_memcmp(c->key, c->main, NGX_HTTP_CACHE_KEY_LEN) != 0) {
+        key = ngx_array_push(&keys);
+        if (key == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(key, c->main, NGX_HTTP_CACHE_KEY_LEN);
+    }
+
+    ngx_http_cache_purge_variant_keys(zone, cache, c->main, c->key, &keys);
+
+    if (ngx_http_cache_purge_entries(r->pool, c->file_cache, keys.elts,
+                                     keys.nelts, &n, NULL, r->connection->log)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    rc = n ? NGX_OK : NGX_DECLINED;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache purge variants: %ui, %i",
+                   keys.nelts, rc);
+
+    return rc;
+}
+
+void
+ngx_http_cache_purge_variant_keys(ngx_http_cache_purge_zone_t *zone,
+    uint32_t cache, u_char *main, u_char *skip, ngx_array_t *keys)
+{
+    ngx_http_cache_purge_primary_t  *pn;
+    ngx_http_cache_purge_variant_t  *vn;
+    ngx_queue_t                     *q;
+    u_char                          *key;
+
+    /* variants are forgotten, they're about to be purged */
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    pn = (ngx_http_cache_purge_primary_t *)
+             ngx_http_cache_purge_find(&zone->sh->primaries, cache, main);
+
+    if (pn) {
+        for (q = ngx_queue_head(&pn->variants);
+             q != ngx_queue_sentinel(&pn->variants);
+             q = ngx_queue_next(q))
+        {
+            vn = ngx_queue_data(q, ngx_http_cache_purge_variant_t, queue);
+
+            if (skip
+                && ngx_memcmp(vn->key, skip, NGX_HTTP_CACHE_KEY_LEN) == 0)
+            {
+                continue;
+            }
+
+            key = ngx_array_push(keys);
+            if (key == NULL) {
+                break;
+            }
+
+            ngx_memcpy(key, vn->key, NGX_HTTP_CACHE_KEY_LEN);
+        }
+
+        ngx_http_cache_purge_primary_free(zone, pn);
+    }
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+}
+
+void
+ngx_http_cache_purge_primary_free(ngx_http_cache_purge_zone_t *zone,
+    ngx_http_cache_purge_primary_t *pn)
+{
+    ngx_queue_t                     *q;
+    ngx_http_cache_purge_variant_t  *vn;
+
+    /* purge zone must be locked by the caller */
+
+    while (!ngx_queue_empty(&pn->variants)) {
+        q = ngx_queue_head(&pn->variants);
+        ngx_queue_remove(q);
+
+        vn = ngx_queue_data(q, ngx_http_cache_purge_variant_t, queue);
+        ngx_slab_free_locked(zone->shpool, vn);
+    }
+
+    ngx_queue_remove(&pn->sn.queue);
+    ngx_rbtree_delete(&zone->sh->primaries, &pn->sn.node);
+    ngx_slab_free_locked(zone->shpool, pn);
+}
+
+#  endif /* nginx_version >= 1007007 */
+
+void
+ngx_http_cache_purge_snapshot_load(ngx_http_cache_purge_zone_t *zone,
+    ngx_log_t *log)
+{
+    ngx_http_cache_purge_index_header_t  *h;
+    ngx_http_cache_purge_record_t        *rec;
+    ngx_file_info_t                       fi;
+    ngx_fd_t                              fd;
+    ngx_uint_t                            i, n;
+    size_t                                size, len;
+    u_char                               *addr, *name;
+
+    name = zone->snapshot.data;
+
+    fd = ngx_open_file(name, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        if (ngx_errno != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_ERR, log, ngx_errno,
+                          ngx_open_file_n " \"%s\" failed", name);
+        }
+
+        return;
+    }
+
+    addr = NULL;
+    size = 0;
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", name);
+        goto done;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+
+    if (size < sizeof(ngx_http_cache_purge_index_header_t)) {
+        goto invalid;
+    }
+
+    addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (addr == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_ERR, log, ngx_errno,
+                      "mmap(%uz) \"%s\" failed", size, name);
+        addr = NULL;
+        goto done;
+    }
+
+    h = (ngx_http_cache_purge_index_header_t *) addr;
+    rec = (ngx_http_cache_purge_record_t *)
+              (addr + sizeof(ngx_http_cache_purge_index_header_t));
+
+    len = size - sizeof(ngx_http_cache_purge_index_header_t);
+
+    if (ngx_memcmp(h->magic, NGX_HTTP_CACHE_PURGE_SNAPSHOT_MAGIC,
+                   sizeof(h->magic))
+        != 0
+        || h->version != NGX_HTTP_CACHE_PURGE_SNAPSHOT_VERSION
+        || h->keys != 0
+        || len % sizeof(ngx_http_cache_purge_record_t)
+        || h->entries != len / sizeof(ngx_http_cache_purge_record_t)
+        || h->crc32 != ngx_crc32_long((u_char *) rec, len))
+    {
+        goto invalid;
+    }
+
+    /* records are stored from the least recently used ones */
+
+    n = 0;
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    for (i = 0; i < h->entries; i++) {
+        if (ngx_http_cache_purge_snapshot_restore(zone, &rec[i]) != NGX_OK) {
+            ngx_log_error(NGX_LOG_WARN, log, 0,
+                          "could not allocate snapshot node%s",
+                          zone->shpool->log_ctx);
+            break;
+        }
+
+        n++;
+    }
+
+    zone->sh->generation = h->generation;
+
+    /* keys of entries removed while nginx was down are dropped later */
+
+    zone->sh->reconcile = NGX_HTTP_CACHE_PURGE_RECONCILE_ERRORS;
+    zone->sh->reconcile_started = 0;
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "cache purge snapshot \"%s\" loaded: %ui of %uL records,"
+                  " generation %uL", name, n, h->entries, h->generation);
+
+    goto done;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ERR, log, 0,
+                  "\"%s\" is not a valid cache purge snapshot, ignored",
+                  name);
+
+done:
+
+    if (addr && munmap(addr, size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "munmap(%uz) failed", size);
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name);
+    }
+}
+
+ngx_int_t
+ngx_http_cache_purge_snapshot_restore(ngx_http_cache_purge_zone_t *zone,
+    ngx_http_cache_purge_record_t *rec)
+{
+    ngx_http_cache_purge_error_t    *en;
+#  if (nginx_version >= 1007007)
+    ngx_http_cache_purge_primary_t  *pn;
+    ngx_http_cache_purge_variant_t  *vn;
+    ngx_queue_t                     *q;
+#  endif
+
+    /* purge zone must be locked by the caller */
+
+    if (rec->status) {
+        en = (ngx_http_cache_purge_error_t *)
+                 ngx_http_cache_purge_find(&zone->sh->errors, rec->cache,
+                                           rec->key);
+        if (en) {
+            ngx_queue_remove(&en->sn.queue);
+            goto error;
+        }
+
+        en = ngx_slab_alloc_locked(zone->shpool,
+                                   sizeof(ngx_http_cache_purge_error_t));
+        if (en == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy((u_char *) &en->sn.node.key, rec->key,
+                   sizeof(ngx_rbtree_key_t));
+        ngx_memcpy(en->sn.key, rec->key, NGX_HTTP_CACHE_KEY_LEN);
+        en->sn.cache = rec->cache;
+
+        ngx_rbtree_insert(&zone->sh->errors, &en->sn.node);
+
+    error:
+
+        en->status = rec->status;
+
+        ngx_queue_insert_head(&zone->sh->errors_queue, &en->sn.queue);
+
+        return NGX_OK;
+    }
+
+#  if (nginx_version >= 1007007)
+
+    pn = (ngx_http_cache_purge_primary_t *)
+             ngx_http_cache_purge_find(&zone->sh->primaries, rec->cache,
+                                       rec->primary);
+
+    if (pn == NULL) {
+        pn = ngx_slab_alloc_locked(zone->shpool,
+                                   sizeof(ngx_http_cache_purge_primary_t));
+        if (pn == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy((u_char *) &pn->sn.node.key, rec->primary,
+                   sizeof(ngx_rbtree_key_t));
+        ngx_memcpy(pn->sn.key, rec->primary, NGX_HTTP_CACHE_KEY_LEN);
+        pn->sn.cache = rec->cache;
+        ngx_queue_init(&pn->variants);
+
+        ngx_rbtree_insert(&zone->sh->primaries, &pn->sn.node);
+
+    } else {
+        ngx_queue_remove(&pn->sn.queue);
+
+        for (q = ngx_queue_head(&pn->variants);
+             q != ngx_queue_sentinel(&pn->variants);
+             q = ngx_queue_next(q))
+        {
+            vn = ngx_queue_data(q, ngx_http_cache_purge_variant_t, queue);
+
+            if (ngx_memcmp(vn->key, rec->key, NGX_HTTP_CACHE_KEY_LEN) == 0) {
+                goto done;
+            }
+        }
+    }
+
+    ngx_queue_insert_head(&zone->sh->primaries_queue, &pn->sn.queue);
+
+    vn = ngx_slab_alloc_locked(zone->shpool,
+                               sizeof(ngx_http_cache_purge_variant_t));
+    if (vn == NULL) {
+        if (ngx_queue_empty(&pn->variants)) {
+            ngx_http_cache_purge_primary_free(zone, pn);
+        }
+
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(vn->key, rec->key, NGX_HTTP_CACHE_KEY_LEN);
+    ngx_queue_insert_tail(&pn->variants, &vn->queue);
+
+    return NGX_OK;
+
+done:
+
+    ngx_queue_insert_head(&zone->sh->primaries_queue, &pn->sn.queue);
+
+#  endif /* nginx_version >= 1007007 */
+
+    return NGX_OK;
+}
+
+void
+ngx_http_cache_purge_snapshot_handler(ngx_event_t *ev)
+{
+    ngx_http_cache_purge_snapshot_save(ev->data, 0, ev->log);
+
+    ngx_add_timer(ev, 1000);
+}
+
+void
+ngx_http_cache_purge_snapshot_save(ngx_http_cache_purge_main_conf_t *cpmcf,
+    ngx_uint_t exiting, ngx_log_t *log)
+{
+    ngx_http_cache_purge_index_header_t  *h;
+    ngx_http_cache_purge_snapshot_t       ss;
+    ngx_http_cache_purge_zone_t          *zone;
+    ngx_pool_t                           *pool;
+    ngx_fd_t                              fd;
+    ngx_int_t                             rc;
+    uint64_t                              generation;
+    ssize_t                               written;
+    size_t                                size;
+    time_t                                now;
+    u_char                               *buf, *name, *temp;
+
+    zone = cpmcf->shm_zone->data;
+    name = cpmcf->snapshot.data;
+    temp = cpmcf->snapshot_temp.data;
+
+    now = ngx_time();
+
+    /*
+     * the first process to get here writes the snapshot, others wait
+     * for it to finish, unless it looks gone
+     */
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    if ((exiting ? now == zone->sh->snapshot_last
+                 : now - zone->sh->snapshot_last < cpmcf->snapshot_interval)
+        || (zone->sh->snapshot_pid
+            && now - zone->sh->snapshot_last
+               < NGX_HTTP_CACHE_PURGE_SNAPSHOT_TIMEOUT))
+    {
+        ngx_shmtx_unlock(&zone->shpool->mutex);
+        return;
+    }
+
+    zone->sh->snapshot_last = now;
+    zone->sh->snapshot_pid = ngx_pid;
+    generation = ++zone->sh->generation;
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, log);
+    if (pool == NULL) {
+        goto done;
+    }
+
+    ngx_memzero(&ss, sizeof(ngx_http_cache_purge_snapshot_t));
+
+    ss.records = ngx_array_create(pool, NGX_HTTP_CACHE_PURGE_BATCH,
+                                  sizeof(ngx_http_cache_purge_record_t));
+    if (ss.records == NULL) {
+        goto done;
+    }
+
+    ss.tree = NGX_HTTP_CACHE_PURGE_RECONCILE_ERRORS;
+
+    /*
+     * the zone is locked for a batch of records at a time, as it's taken
+     * by each response stored in the cache; keys stored or removed
+     * meanwhile might be missed until the next snapshot
+     */
+
+    do {
+        ngx_shmtx_lock(&zone->shpool->mutex);
+
+        rc = ngx_http_cache_purge_snapshot_records(zone, &ss);
+
+        ngx_shmtx_unlock(&zone->shpool->mutex);
+
+        if (rc == NGX_ERROR) {
+            goto done;
+        }
+
+    } while (rc == NGX_AGAIN);
+
+    size = ss.records->nelts * sizeof(ngx_http_cache_purge_record_t);
+
+    buf = ngx_pnalloc(pool, sizeof(ngx_http_cache_purge_index_header_t)
+                            + size);
+    if (buf == NULL) {
+        goto done;
+    }
+
+    h = (ngx_http_cache_purge_index_header_t *) buf;
+
+    ngx_memcpy(buf + sizeof(ngx_http_cache_purge_index_header_t),
+               ss.records->elts, size);
+
+    ngx_memcpy(h->magic, NGX_HTTP_CACHE_PURGE_SNAPSHOT_MAGIC,
+               sizeof(h->magic));
+    h->version = NGX_HTTP_CACHE_PURGE_SNAPSHOT_VERSION;
+    h->crc32 = ngx_crc32_long(ss.records->elts, size);
+    h->generation = generation;
+    h->entries = ss.records->nelts;
+    h->keys = 0;
+
+    size += sizeof(ngx_http_cache_purge_index_header_t);
+
+    /* written aside and renamed, so a snapshot is never seen in part */
+
+    fd = ngx_open_file(temp, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                       NGX_FILE_DEFAULT_ACCESS);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", temp);
+        goto done;
+    }
+
+    written = ngx_write_fd(fd, buf, size);
+
+    if (written == -1) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_write_fd_n " \"%s\" failed", temp);
+        goto close;
+    }
+
+    if ((size_t) written != size) {
+        ngx_log_error(NGX_LOG_CRIT, log, 0,
+                      ngx_write_fd_n " \"%s\" has written only %z of %uz",
+                      temp, written, size);
+        goto close;
+    }
+
+    if (fsync(fd) == -1) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      "fsync() \"%s\" failed", temp);
+        goto close;
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", temp);
+    }
+
+    if (ngx_rename_file(temp, name) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      temp, name);
+        goto done;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "http file cache purge snapshot: %ui records,"
+                   " generation %uL", ss.records->nelts, generation);
+
+    goto done;
+
+close:
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", temp);
+    }
+
+done:
+
+    if (pool) {
+        ngx_destroy_pool(pool);
+    }
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    if (zone->sh->snapshot_pid == ngx_pid) {
+        zone->sh->snapshot_pid = 0;
+    }
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+}
+
+ngx_int_t
+ngx_http_cache_purge_snapshot_records(ngx_http_cache_purge_zone_t *zone,
+    ngx_http_cache_purge_snapshot_t *ss)
+{
+    ngx_http_cache_purge_record_t   *rec;
+    ngx_http_cache_purge_error_t    *en;
+    ngx_http_cache_purge_node_t     *sn;
+    ngx_rbtree_node_t               *node;
+    ngx_rbtree_t                    *rbtree;
+    ngx_uint_t                       n;
+#  if (nginx_version >= 1007007)
+    ngx_http_cache_purge_primary_t  *pn;
+    ngx_http_cache_purge_variant_t  *vn;
+    ngx_queue_t                     *q;
+#  endif
+
+    /*
+     * purge zone must be locked by the caller; a batch of records is
+     * added from the cursor on, errors first, then variants of each
+     * primary key together
+     */
+
+    rbtree = (ss->tree == NGX_HTTP_CACHE_PURGE_RECONCILE_ERRORS)
+             ? &zone->sh->errors : &zone->sh->primaries;
+
+    if (ss->started) {
+        node = ngx_http_cache_purge_find_next(rbtree, ss->cache, ss->key);
+
+    } else {
+        node = rbtree->root;
+        node = (node != rbtree->sentinel)
+               ? ngx_rbtree_min(node, rbtree->sentinel) : NULL;
+    }
+
+    for (n = 0;
+         node && n < NGX_HTTP_CACHE_PURGE_BATCH;
+         node = ngx_http_cache_purge_rbtree_next(rbtree, node))
+    {
+        sn = (ngx_http_cache_purge_node_t *) node;
+
+        if (ss->tree == NGX_HTTP_CACHE_PURGE_RECONCILE_ERRORS) {
+            en = (ngx_http_cache_purge_error_t *) sn;
+
+            rec = ngx_array_push(ss->records);
+            if (rec == NULL) {
+                return NGX_ERROR;
+            }
+
+            ngx_memzero(rec, sizeof(ngx_http_cache_purge_record_t));
+
+            rec->cache = sn->cache;
+            rec->status = en->status;
+            ngx_memcpy(rec->key, sn->key, NGX_HTTP_CACHE_KEY_LEN);
+
+            n++;
+
+        } else {
+
+#  if (nginx_version >= 1007007)
+
+            pn = (ngx_http_cache_purge_primary_t *) sn;
+
+            for (q = ngx_queue_head(&pn->variants);
+                 q != ngx_queue_sentinel(&pn->variants);
+                 q = ngx_queue_next(q))
+            {
+                vn = ngx_queue_data(q, ngx_http_cache_purge_variant_t, queue);
+
+                rec = ngx_array_push(ss->records);
+                if (rec == NULL) {
+                    return NGX_ERROR;
+                }
+
+                ngx_memzero(rec, sizeof(ngx_http_cache_purge_record_t));
+
+                rec->cache = sn->cache;
+                ngx_memcpy(rec->key, vn->key, NGX_HTTP_CACHE_KEY_LEN);
+                ngx_memcpy(rec->primary, sn->key, NGX_HTTP_CACHE_KEY_LEN);
+
+                n++;
+            }
+
+#  endif /* nginx_version >= 1007007 */
+        }
+
+        ss->cache = sn->cache;
+        ngx_memcpy(ss->key, sn->key, NGX_HTTP_CACHE_KEY_LEN);
+        ss->started = 1;
+    }
+
+    if (node) {
+        return NGX_AGAIN;
+    }
+
+#  if (nginx_version >= 1007007)
+
+    if (ss->tree == NGX_HTTP_CACHE_PURGE_RECONCILE_ERRORS) {
+        ss->tree = NGX_HTTP_CACHE_PURGE_RECONCILE_PRIMARIES;
+        ss->started = 0;
+
+        return NGX_AGAIN;
+    }
+
+#  endif /* nginx_version >= 1007007 */
+
+    return NGX_OK;
+}
+
+ngx_int_t
+ngx_http_cache_purge_snapshot_reconcile(ngx_http_cache_purge_zone_t *zone,
+    ngx_log_t *log)
+{
+    ngx_http_cache_purge_node_t     *sn;
+    ngx_http_cache_purge_error_t    *en;
+    ngx_http_file_cache_node_t      *fcn;
+    ngx_http_file_cache_t           *cache;
+    ngx_rbtree_node_t               *node;
+    ngx_rbtree_t                    *rbtree;
+    ngx_uint_t                       i, n, phase, done;
+    uint32_t                         caches[NGX_HTTP_CACHE_PURGE_BATCH];
+    uint32_t                         last_cache;
+    u_char                           gone[NGX_HTTP_CACHE_PURGE_BATCH];
+    u_char                           keys[NGX_HTTP_CACHE_PURGE_BATCH
+                                          * NGX_HTTP_CACHE_KEY_LEN];
+    u_char                           last_key[NGX_HTTP_CACHE_KEY_LEN];
+#  if (nginx_version >= 1007007)
+    u_char                           primaries[NGX_HTTP_CACHE_PURGE_BATCH
+                                               * NGX_HTTP_CACHE_KEY_LEN];
+    ngx_http_cache_purge_primary_t  *pn;
+    ngx_http_cache_purge_variant_t  *vn;
+    ngx_queue_t                     *q;
+    ngx_uint_t                       v;
+#  endif
+
+    /* checked without the lock, it's only set once a snapshot is loaded */
+
+    if (zone->sh->reconcile == 0) {
+        return NGX_OK;
+    }
+
+    n = 0;
+    last_cache = 0;
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    phase = zone->sh->reconcile;
+
+    if (phase == 0) {
+        ngx_shmtx_unlock(&zone->shpool->mutex);
+        return NGX_OK;
+    }
+
+    rbtree = (phase == NGX_HTTP_CACHE_PURGE_RECONCILE_ERRORS)
+             ? &zone->sh->errors : &zone->sh->primaries;
+
+    if (zone->sh->reconcile_started) {
+        node = ngx_http_cache_purge_find_next(rbtree,
+                                              zone->sh->reconcile_cache,
+                                              zone->sh->reconcile_key);
+
+    } else {
+        node = rbtree->root;
+        node = (node != rbtree->sentinel)
+               ? ngx_rbtree_min(node, rbtree->sentinel) : NULL;
+    }
+
+    for ( /* void */ ; node; node = ngx_http_cache_purge_rbtree_next(rbtree,
+                                                                     node))
+    {
+        sn = (ngx_http_cache_purge_node_t *) node;
+
+        if (phase == NGX_HTTP_CACHE_PURGE_RECONCILE_ERRORS) {
+            if (n == NGX_HTTP_CACHE_PURGE_BATCH) {
+                break;
+            }
+
+            caches[n] = sn->cache;
+            ngx_memcpy(&keys[n * NGX_HTTP_CACHE_KEY_LEN], sn->key,
+                       NGX_HTTP_CACHE_KEY_LEN);
+            n++;
+
+        } else {
+
+#  if (nginx_version >= 1007007)
+
+            /* variants of a primary key are checked in the same batch */
+
+            pn = (ngx_http_cache_purge_primary_t *) sn;
+
+            v = 0;
+
+            for (q = ngx_queue_head(&pn->variants);
+                 q != ngx_queue_sentinel(&pn->variants);
+                 q = ngx_queue_next(q))
+            {
+                v++;
+            }
+
+            if (n && n + v > NGX_HTTP_CACHE_PURGE_BATCH) {
+                break;
+            }
+
+            for (q = ngx_queue_head(&pn->variants);
+                 q != ngx_queue_sentinel(&pn->variants)
+                 && n < NGX_HTTP_CACHE_PURGE_BATCH;
+                 q = ngx_queue_next(q))
+            {
+                vn = ngx_queue_data(q, ngx_http_cache_purge_variant_t, queue);
+
+                caches[n] = sn->cache;
+                ngx_memcpy(&keys[n * NGX_HTTP_CACHE_KEY_LEN], vn->key,
+                           NGX_HTTP_CACHE_KEY_LEN);
+                ngx_memcpy(&primaries[n * NGX_HTTP_CACHE_KEY_LEN], sn->key,
+                           NGX_HTTP_CACHE_KEY_LEN);
+                n++;
+            }
+
+#  endif /* nginx_version >= 1007007 */
+        }
+
+        last_cache = sn->cache;
+        ngx_memcpy(last_key, sn->key, NGX_HTTP_CACHE_KEY_LEN);
+    }
+
+    done = (node == NULL);
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    for (i = 0; i < n; i++) {
+        cache = ngx_http_cache_purge_file_cache((ngx_cycle_t *) ngx_cycle,
+                                                caches[i]);
+        if (cache == NULL) {
+            /* the cache zone was removed from the configuration */
+            gone[i] = 1;
+            continue;
+        }
+
+        if (cache->sh->cold) {
+            /* not all of the entries are known until the loader is done */
+            return NGX_DECLINED;
+        }
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        fcn = ngx_http_cache_purge_lookup(cache,
+                                          &keys[i * NGX_HTTP_CACHE_KEY_LEN]);
+        gone[i] = (fcn == NULL);
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+    }
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    for (i = 0; i < n; i++) {
+
+        if (!gone[i]) {
+            continue;
+        }
+
+        if (phase == NGX_HTTP_CACHE_PURGE_RECONCILE_ERRORS) {
+            en = (ngx_http_cache_purge_error_t *)
+                     ngx_http_cache_purge_find(&zone->sh->errors, caches[i],
+                                         &keys[i * NGX_HTTP_CACHE_KEY_LEN]);
+            if (en) {
+                ngx_http_cache_purge_error_free(zone, en);
+            }
+
+            continue;
+        }
+
+#  if (nginx_version >= 1007007)
+
+        pn = (ngx_http_cache_purge_primary_t *)
+                 ngx_http_cache_purge_find(&zone->sh->primaries, caches[i],
+                                     &primaries[i * NGX_HTTP_CACHE_KEY_LEN]);
+        if (pn == NULL) {
+            continue;
+        }
+
+        for (q = ngx_queue_head(&pn->variants);
+             q != ngx_queue_sentinel(&pn->variants);
+             q = ngx_queue_next(q))
+        {
+            vn = ngx_queue_data(q, ngx_http_cache_purge_variant_t, queue);
+
+            if (ngx_memcmp(vn->key, &keys[i * NGX_HTTP_CACHE_KEY_LEN],
+                           NGX_HTTP_CACHE_KEY_LEN)
+                == 0)
+            {
+                ngx_queue_remove(q);
+                ngx_slab_free_locked(zone->shpool, vn);
+                break;
+            }
+        }
+
+        if (ngx_queue_empty(&pn->variants)) {
+            ngx_http_cache_purge_primary_free(zone, pn);
+        }
+
+#  endif /* nginx_version >= 1007007 */
+    }
+
+    /* another worker process might have moved on already */
+
+    if (zone->sh->reconcile == phase) {
+
+        if (done) {
+            zone->sh->reconcile_started = 0;
+
+#  if (nginx_version >= 1007007)
+            zone->sh->reconcile =
+                (phase == NGX_HTTP_CACHE_PURGE_RECONCILE_ERRORS)
+                ? NGX_HTTP_CACHE_PURGE_RECONCILE_PRIMARIES : 0;
+#  else
+            zone->sh->reconcile = 0;
+#  endif
+
+        } else {
+            zone->sh->reconcile_started = 1;
+            zone->sh->reconcile_cache = last_cache;
+            ngx_memcpy(zone->sh->reconcile_key, last_key,
+                       NGX_HTTP_CACHE_KEY_LEN);
+        }
+    }
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "http file cache purge reconcile: %ui keys, phase %ui",
+                   n, phase);
+
+    return (zone->sh->reconcile) ? NGX_AGAIN : NGX_OK;
+}
+
+char *
+ngx_http_cache_purge_conf(ngx_conf_t *cf, ngx_http_cache_purge_conf_t *cpcf)
+{
+    ngx_cidr_t       cidr;
+    ngx_in_cidr_t   *access;
+# if (NGX_HAVE_INET6)
+    ngx_in6_cidr_t  *access6;
+# endif /* NGX_HAVE_INET6 */
+    ngx_str_t       *value;
+    ngx_int_t        rc;
+    ngx_uint_t       i;
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        cpcf->enable = 0;
+        return NGX_CONF_OK;
+
+    } else if (ngx_strcmp(value[1].data, "on") == 0) {
+        ngx_str_set(&cpcf->method, "PURGE");
+
+    } else {
+        cpcf->method = value[1];
+    }
+
+    if (cf->args->nelts < 4) {
+        cpcf->enable = 1;
+        return NGX_CONF_OK;
+    }
+
+    /* sanity check */
+    if (ngx_strcmp(value[2].data, "from") != 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\", expected"
+                           " \"from\" keyword", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_strcmp(value[3].data, "all") == 0) {
+        cpcf->enable = 1;
+        return NGX_CONF_OK;
+    }
+
+    for (i = 3; i < cf->args->nelts; i++) {
+        rc = ngx_ptocidr(&value[i], &cidr);
+
+        if (rc == NGX_ERROR) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[i]);
+            return NGX_CONF_ERROR;
+        }
+
+        if (rc == NGX_DONE) {
+            ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                               "low address bits of %V are meaningless",
+                               &value[i]);
+        }
+
+        switch (cidr.family) {
+        case AF_INET:
+            if (cpcf->access == NULL) {
+                cpcf->access = ngx_array_create(cf->pool, cf->args->nelts - 3,
+                                                sizeof(ngx_in_cidr_t));
+                if (cpcf->access == NULL) {
+                    return NGX_CONF_ERROR;
+                }
+            }
+
+            access = ngx_array_push(cpcf->access);
+            if (access == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            access->mask = cidr.u.in.mask;
+            access->addr = cidr.u.in.addr;
+
+            break;
+
+# if (NGX_HAVE_INET6)
+        case AF_INET6:
+            if (cpcf->access6 == NULL) {
+                cpcf->access6 = ngx_array_create(cf->pool, cf->args->nelts - 3,
+                                                 sizeof(ngx_in6_cidr_t));
+                if (cpcf->access6 == NULL) {
+                    return NGX_CONF_ERROR;
+                }
+            }
+
+            access6 = ngx_array_push(cpcf->access6);
+            if (access6 == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            access6->mask = cidr.u.in6.mask;
+            access6->addr = cidr.u.in6.addr;
+
+            break;
+# endif /* NGX_HAVE_INET6 */
+        }
+    }
+
+    cpcf->enable = 1;
+
+    return NGX_CONF_OK;
+}
+
+char *
+ngx_http_cache_purge_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf = conf;
+    ngx_http_cache_purge_zone_t       *zone;
+    ngx_str_t                         *value, name, s;
+    ngx_int_t                          n;
+    ngx_uint_t                         i;
+    ssize_t                            size;
+    u_char                            *p;
+
+    if (cpmcf->shm_zone) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    p = (u_char *) ngx_strchr(value[1].data, ':');
+
+    if (p == NULL || p == value[1].data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone \"%V\", expected"
+                           " \"name:size\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    name.data = value[1].data;
+    name.len = p - value[1].data;
+
+    s.data = p + 1;
+    s.len = value[1].data + value[1].len - s.data;
+
+    size = ngx_parse_size(&s);
+
+    if (size == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    cpmcf->batch = 100;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "batch=", 6) == 0) {
+            n = ngx_atoi(value[i].data + 6, value[i].len - 6);
+            if (n == NGX_ERROR || n == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid batch \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            cpmcf->batch = n;
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    zone = ngx_pcalloc(cf->pool, sizeof(ngx_http_cache_purge_zone_t));
+    if (zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cpmcf->shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                            &ngx_http_cache_purge_module);
+    if (cpmcf->shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (cpmcf->shm_zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "duplicate zone \"%V\"", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    cpmcf->shm_zone->init = ngx_http_cache_purge_init_zone;
+    cpmcf->shm_zone->data = zone;
+
+    return NGX_CONF_OK;
+}
+
+/*
+ * Based on: ngx_http_limit_req_module.c/ngx_http_limit_req_init_zone
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+ngx_int_t
+ngx_http_cache_purge_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_cache_purge_zone_t  *ozone = data;
+
+    ngx_http_cache_purge_zone_t  *zone;
+    ngx_uint_t                    i;
+    size_t                        len;
+
+    zone = shm_zone->data;
+
+    if (ozone) {
+        zone->sh = ozone->sh;
+        zone->shpool = ozone->shpool;
+
+        return NGX_OK;
+    }
+
+    zone->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        zone->sh = zone->shpool->data;
+
+        return NGX_OK;
+    }
+
+    zone->sh = ngx_slab_alloc(zone->shpool,
+                              sizeof(ngx_http_cache_purge_shctx_t));
+    if (zone->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    zone->shpool->data = zone->sh;
+
+    ngx_rbtree_init(&zone->sh->rbtree, &zone->sh->sentinel,
+                    ngx_http_cache_purge_rbtree_insert_value);
+
+    ngx_queue_init(&zone->sh->queue);
+    zone->sh->sequence = 0;
+
+    ngx_rbtree_init(&zone->sh->primaries, &zone->sh->primaries_sentinel,
+                    ngx_http_cache_purge_rbtree_insert_value);
+
+    ngx_queue_init(&zone->sh->primaries_queue);
+
+    ngx_rbtree_init(&zone->sh->errors, &zone->sh->errors_sentinel,
+                    ngx_http_cache_purge_rbtree_insert_value);
+
+    ngx_queue_init(&zone->sh->errors_queue);
+
+    ngx_queue_init(&zone->sh->shared);
+
+    zone->sh->generation = 0;
+    zone->sh->snapshot_last = ngx_time();
+    zone->sh->snapshot_pid = 0;
+    zone->sh->reconcile = 0;
+    zone->sh->reconcile_started = 0;
+
+    zone->sh->wheel_last = ngx_time();
+    zone->sh->scheduled = 0;
+
+    for (i = 0; i < NGX_HTTP_CACHE_PURGE_WHEEL; i++) {
+        ngx_queue_init(&zone->sh->wheel[i]);
+    }
+
+    ngx_queue_init(&zone->sh->buckets);
+
+    zone->sh->ingest_keys = 0;
+    zone->sh->ingest_purged = 0;
+    zone->sh->ingest_errors = 0;
+
+    len = sizeof(" in cache purge zone \"\"") + shm_zone->shm.name.len;
+
+    zone->shpool->log_ctx = ngx_slab_alloc(zone->shpool, len);
+    if (zone->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(zone->shpool->log_ctx, " in cache purge zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    if (zone->snapshot.data) {
+        ngx_http_cache_purge_snapshot_load(zone, shm_zone->shm.log);
+    }
+
+    return NGX_OK;
+}
+
+char *
+ngx_http_cache_purge_rewarm_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_cache_purge_loc_conf_t   *cplcf = conf;
+    ngx_http_compile_complex_value_t   ccv;
+    ngx_str_t                         *value;
+    ngx_int_t                          n;
+    ngx_uint_t                         i;
+
+    if (cplcf->rewarm != NGX_CONF_UNSET) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        cplcf->rewarm = 0;
+
+        if (cf->args->nelts > 2) {
+            return "has invalid parameters with \"off\"";
+        }
+
+        return NGX_CONF_OK;
+    }
+
+    cplcf->rewarm = 1;
+
+    if (ngx_strcmp(value[1].data, "on") != 0) {
+        cplcf->rewarm_uri = ngx_palloc(cf->pool,
+                                       sizeof(ngx_http_complex_value_t));
+        if (cplcf->rewarm_uri == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+        ccv.cf = cf;
+        ccv.value = &value[1];
+        ccv.complex_value = cplcf->rewarm_uri;
+
+        if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "min_uses=", 9) == 0) {
+            n = ngx_atoi(value[i].data + 9, value[i].len - 9);
+            if (n == NGX_ERROR) {
+                goto invalid;
+            }
+
+            cplcf->rewarm_min_uses = n;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "concurrency=", 12) == 0) {
+            n = ngx_atoi(value[i].data + 12, value[i].len - 12);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            cplcf->rewarm_concurrency = n;
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+char *
+ngx_http_cache_purge_slice_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_cache_purge_loc_conf_t   *cplcf = conf;
+    ngx_http_compile_complex_value_t   ccv;
+    ngx_str_t                         *value, s;
+    ngx_int_t                          n;
+    ngx_uint_t                         i;
+    ssize_t                            size;
+
+    if (cplcf->slice != NGX_CONF_UNSET_SIZE) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        cplcf->slice = 0;
+
+        if (cf->args->nelts > 2) {
+            return "has invalid parameters with \"off\"";
+        }
+
+        return NGX_CONF_OK;
+    }
+
+    size = ngx_parse_size(&value[1]);
+    if (size == NGX_ERROR || size == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid slice size \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    cplcf->slice = size;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "length=", 7) == 0) {
+            s.len = value[i].len - 7;
+            s.data = value[i].data + 7;
+
+            cplcf->slice_length = ngx_palloc(cf->pool,
+                                             sizeof(ngx_http_complex_value_t));
+            if (cplcf->slice_length == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+            ccv.cf = cf;
+            ccv.value = &s;
+            ccv.complex_value = cplcf->slice_length;
+
+            if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max=", 4) == 0) {
+            n = ngx_atoi(value[i].data + 4, value[i].len - 4);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            cplcf->slice_max = n;
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+char *
+ngx_http_cache_purge_schedule_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_cache_purge_loc_conf_t   *cplcf = conf;
+    ngx_http_compile_complex_value_t   ccv;
+    ngx_str_t                         *value, s;
+    time_t                             jitter;
+
+    if (cplcf->schedule != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        cplcf->schedule = NULL;
+
+        if (cf->args->nelts > 2) {
+            return "has invalid parameters with \"off\"";
+        }
+
+        return NGX_CONF_OK;
+    }
+
+    cplcf->schedule = ngx_palloc(cf->pool, sizeof(ngx_http_complex_value_t));
+    if (cplcf->schedule == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+    ccv.cf = cf;
+    ccv.value = &value[1];
+    ccv.complex_value = cplcf->schedule;
+
+    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (cf->args->nelts == 3) {
+        if (ngx_strncmp(value[2].data, "jitter=", 7) != 0) {
+            goto invalid;
+        }
+
+        s.len = value[2].len - 7;
+        s.data = value[2].data + 7;
+
+        jitter = ngx_parse_time(&s, 1);
+        if (jitter == (time_t) NGX_ERROR) {
+            goto invalid;
+        }
+
+        cplcf->schedule_jitter = jitter;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[2]);
+
+    return NGX_CONF_ERROR;
+}
+
+char *
+ngx_http_cache_purge_rate_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_cache_purge_loc_conf_t  *cplcf = conf;
+    ngx_str_t                        *value, s;
+    ngx_int_t                         n;
+    time_t                            jitter;
+
+    if (cplcf->rate != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        cplcf->rate = 0;
+
+        if (cf->args->nelts > 2) {
+            return "has invalid parameters with \"off\"";
+        }
+
+        return NGX_CONF_OK;
+    }
+
+    n = ngx_atoi(value[1].data, value[1].len);
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid rate \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    cplcf->rate = n;
+
+    if (cf->args->nelts == 3) {
+        if (ngx_strncmp(value[2].data, "jitter=", 7) != 0) {
+            goto invalid;
+        }
+
+        s.len = value[2].len - 7;
+        s.data = value[2].data + 7;
+
+        jitter = ngx_parse_time(&s, 1);
+        if (jitter == (time_t) NGX_ERROR) {
+            goto invalid;
+        }
+
+        cplcf->rate_jitter = jitter;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[2]);
+
+    return NGX_CONF_ERROR;
+}
+
+char *
+ngx_http_cache_purge_io_conf(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf = conf;
+    ngx_str_t                         *value;
+    ngx_int_t                          n;
+
+    if (cpmcf->io_rate) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[1].data, value[1].len);
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid rate \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    cpmcf->io_rate = n;
+    cpmcf->io_burst = n;
+
+    if (cf->args->nelts == 3) {
+        if (ngx_strncmp(value[2].data, "burst=", 6) != 0) {
+            goto invalid;
+        }
+
+        n = ngx_atoi(value[2].data + 6, value[2].len - 6);
+        if (n == NGX_ERROR || n == 0) {
+            goto invalid;
+        }
+
+        cpmcf->io_burst = n;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[2]);
+
+    return NGX_CONF_ERROR;
+}
+
+char *
+ngx_http_cache_purge_snapshot_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf = conf;
+    ngx_str_t                         *value, s;
+    time_t                             interval;
+    u_char                            *p;
+
+    if (cpmcf->snapshot.data) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    cpmcf->snapshot = value[1];
+
+    if (ngx_conf_full_name(cf->cycle, &cpmcf->snapshot, 0) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    cpmcf->snapshot_temp.len = cpmcf->snapshot.len + sizeof(".tmp") - 1;
+
+    p = ngx_pnalloc(cf->pool, cpmcf->snapshot_temp.len + 1);
+    if (p == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_sprintf(p, "%V.tmp%Z", &cpmcf->snapshot);
+    cpmcf->snapshot_temp.data = p;
+
+    cpmcf->snapshot_interval = 60;
+
+    if (cf->args->nelts == 3) {
+        if (ngx_strncmp(value[2].data, "interval=", 9) != 0) {
+            goto invalid;
+        }
+
+        s.data = value[2].data + 9;
+        s.len = value[2].len - 9;
+
+        interval = ngx_parse_time(&s, 1);
+        if (interval == (time_t) NGX_ERROR || interval == 0) {
+            goto invalid;
+        }
+
+        cpmcf->snapshot_interval = interval;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[2]);
+
+    return NGX_CONF_ERROR;
+}
+
+char *
+ngx_http_cache_purge_invalidate_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_cache_purge_loc_conf_t  *cplcf = conf;
+    ngx_str_t                        *value, name;
+
+    if (cplcf->invalidate.data) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        ngx_str_set(&cplcf->invalidate, "");
+
+        if (cf->args->nelts > 2) {
+            return "has invalid parameters with \"off\"";
+        }
+
+        return NGX_CONF_OK;
+    }
+
+    cplcf->invalidate = value[1];
+
+    if (cf->args->nelts == 3) {
+        if (ngx_strncmp(value[2].data, "zone=", 5) != 0
+            || value[2].len == 5)
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        name.data = value[2].data + 5;
+        name.len = value[2].len - 5;
+
+        if (ngx_http_cache_purge_zone_ref(cf, &name) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+
+        /* cache zones are looked up by the crc32 of their names */
+
+        cplcf->invalidate_cache = ngx_crc32_short(name.data, name.len);
+    }
+
+    return NGX_CONF_OK;
+}
+
+#  if (NGX_HAVE_UNIX_DOMAIN)
+
+char *
+ngx_http_cache_purge_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf = conf;
+    ngx_str_t                         *value;
+    ngx_url_t                          u;
+    ngx_uint_t                         i, mode;
+
+    if (cpmcf->listen) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    ngx_memzero(&u, sizeof(ngx_url_t));
+
+    u.url = value[1];
+    u.listen = 1;
+
+    if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
+        if (u.err) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "%s in \"%V\" of the \"cache_purge_listen\""
+                               " directive", u.err, &u.url);
+        }
+
+        return NGX_CONF_ERROR;
+    }
+
+    if (u.family != AF_UNIX) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" is not a unix domain socket", &u.url);
+        return NGX_CONF_ERROR;
+    }
+
+    cpmcf->listen = ngx_palloc(cf->pool, sizeof(ngx_addr_t));
+    if (cpmcf->listen == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cpmcf->listen->sockaddr = ngx_palloc(cf->pool, u.socklen);
+    if (cpmcf->listen->sockaddr == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memcpy(cpmcf->listen->sockaddr, u.sockaddr, u.socklen);
+
+    cpmcf->listen->socklen = u.socklen;
+    cpmcf->listen->name = u.url;
+
+    /* anyone allowed to write to the socket can purge any cache zone */
+
+    cpmcf->listen_mode = 0660;
+
+    if (cf->args->nelts == 2) {
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strncmp(value[2].data, "mode=", 5) != 0
+        || value[2].len == 5 || value[2].len > 9)
+    {
+        goto invalid;
+    }
+
+    mode = 0;
+
+    for (i = 5; i < value[2].len; i++) {
+        if (value[2].data[i] < '0' || value[2].data[i] > '7') {
+            goto invalid;
+        }
+
+        mode = mode * 8 + (value[2].data[i] - '0');
+    }
+
+    cpmcf->listen_mode = mode;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[2]);
+
+    return NGX_CONF_ERROR;
+}
+
+#  endif /* NGX_HAVE_UNIX_DOMAIN */
+
+char *
+ngx_http_cache_purge_inspect_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_cache_purge_loc_conf_t  *cplcf = conf;
+    ngx_str_t                        *value;
+
+    if (cplcf->inspect.data) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        ngx_str_set(&cplcf->inspect, "");
+        return NGX_CONF_OK;
+    }
+
+    cplcf->inspect = value[1];
+
+    return NGX_CONF_OK;
+}
+
+char *
+ngx_http_cache_purge_bulk_conf(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+#  if (nginx_version >= 1007011)
+    ngx_http_cache_purge_loc_conf_t  *cplcf = conf;
+    ngx_http_core_loc_conf_t         *clcf;
+    ngx_str_t                        *value;
+
+    if (cplcf->bulk.data) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    cplcf->bulk = value[1];
+
+    if (ngx_http_cache_purge_zone_ref(cf, &value[1]) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_cache_purge_bulk_handler;
+
+    return NGX_CONF_OK;
+#  else
+    return "requires nginx-1.7.11+";
+#  endif /* nginx_version >= 1007011 */
+}
+
+char *
+ngx_http_cache_purge_export_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_cache_purge_loc_conf_t  *cplcf = conf;
+    ngx_http_core_loc_conf_t         *clcf;
+    ngx_str_t                        *value;
+
+    if (cplcf->export.data) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    cplcf->export = value[1];
+
+    if (ngx_http_cache_purge_zone_ref(cf, &value[1]) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_cache_purge_export_handler;
+
+    return NGX_CONF_OK;
+}
+
+char *
+ngx_http_cache_purge_evict_conf(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_cache_purge_loc_conf_t  *cplcf = conf;
+    ngx_http_core_loc_conf_t         *clcf;
+    ngx_str_t                        *value;
+
+    if (cplcf->evict.data) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    cplcf->evict = value[1];
+
+    if (ngx_http_cache_purge_zone_ref(cf, &value[1]) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_cache_purge_evict_handler;
+
+    return NGX_CONF_OK;
+}
+
+char *
+ngx_http_cache_purge_filter_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_cache_purge_loc_conf_t  *cplcf = conf;
+    ngx_http_core_loc_conf_t         *clcf;
+    ngx_str_t                        *value;
+
+    if (cplcf->filter.data) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    cplcf->filter = value[1];
+
+    if (ngx_http_cache_purge_zone_ref(cf, &value[1]) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_cache_purge_filter_handler;
+
+    return NGX_CONF_OK;
+}
+
+char *
+ngx_http_cache_purge_errors_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_cache_purge_loc_conf_t  *cplcf = conf;
+    ngx_http_core_loc_conf_t         *clcf;
+    ngx_str_t                        *value;
+
+    if (cplcf->errors.data) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    cplcf->errors = value[1];
+
+    if (ngx_http_cache_purge_zone_ref(cf, &value[1]) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_cache_purge_errors_handler;
+
+    return NGX_CONF_OK;
+}
+
+char *
+ngx_http_cache_purge_regex_conf(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+#  if (NGX_PCRE)
+    ngx_http_cache_purge_loc_conf_t  *cplcf = conf;
+    ngx_http_core_loc_conf_t         *clcf;
+    ngx_str_t                        *value;
+
+    if (cplcf->regex.data) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    cplcf->regex = value[1];
+
+    if (ngx_http_cache_purge_zone_ref(cf, &value[1]) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+    cplcf->regex_index = value[2];
+
+    if (ngx_conf_full_name(cf->cycle, &cplcf->regex_index, 0) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_cache_purge_regex_handler;
+
+    return NGX_CONF_OK;
+
+#  else /* !NGX_PCRE */
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "using regex \"%V\" requires PCRE library",
+                       &cmd->name);
+    return NGX_CONF_ERROR;
+
+#  endif /* NGX_PCRE */
+}
+
+ngx_int_t
+ngx_http_cache_purge_add_variables(ngx_conf_t *cf)
+{
+    ngx_http_variable_t  *var, *v;
+
+    for (v = ngx_http_cache_purge_vars; v->name.len; v++) {
+        var = ngx_http_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
+
+    return NGX_OK;
+}
+
+ngx_int_t
+ngx_http_cache_purge_pending_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_zone_t       *zone;
+    u_char                            *p;
+
+    cpmcf = ngx_http_get_module_main_conf(r, ngx_http_cache_purge_module);
+
+    if (cpmcf->shm_zone == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    zone = cpmcf->shm_zone->data;
+
+    p = ngx_pnalloc(r->pool, NGX_INT_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(p, "%ui", zone->sh->scheduled) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+ngx_int_t
+ngx_http_cache_purge_counter_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_zone_t       *zone;
+    ngx_atomic_t                      *counter;
+    u_char                            *p;
+
+    cpmcf = ngx_http_get_module_main_conf(r, ngx_http_cache_purge_module);
+
+    if (cpmcf->shm_zone == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    zone = cpmcf->shm_zone->data;
+    counter = (ngx_atomic_t *) ((char *) zone->sh + data);
+
+    p = ngx_pnalloc(r->pool, NGX_ATOMIC_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(p, "%uA", *counter) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+ngx_int_t
+ngx_http_cache_purge_filter_init(ngx_conf_t *cf)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_core_main_conf_t         *cmcf;
+    ngx_http_handler_pt               *h;
+
+    cpmcf = ngx_http_conf_get_module_main_conf(cf,
+                                               ngx_http_cache_purge_module);
+
+    /* requests are ordered against purges for cache_purge_fence */
+
+    if (cpmcf->shm_zone) {
+        cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+        h = ngx_array_push(&cmcf->phases[NGX_HTTP_PREACCESS_PHASE].handlers);
+        if (h == NULL) {
+            return NGX_ERROR;
+        }
+
+        *h = ngx_http_cache_purge_fence_handler;
+    }
+
+    ngx_http_next_header_filter = ngx_http_top_header_filter;
+    ngx_http_top_header_filter = ngx_http_cache_purge_header_filter;
+
+    ngx_http_next_body_filter = ngx_http_top_body_filter;
+    ngx_http_top_body_filter = ngx_http_cache_purge_body_filter;
+
+    return NGX_OK;
 }
 
 void
@@ -1622,6 +10367,168 @@ ngx_http_cache_purge_merge_conf(ngx_http_cache_purge_conf_t *conf,
     }
 }
 
+void *
+ngx_http_cache_purge_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_cache_purge_main_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_cache_purge_main_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->shm_zone = NULL
+     *     conf->batch = 0
+     *     conf->io_rate = 0
+     *     conf->io_burst = 0
+     *     conf->snapshot = { 0, NULL }
+     *     conf->snapshot_temp = { 0, NULL }
+     *     conf->snapshot_interval = 0
+     *     conf->listen = NULL
+     *     conf->listen_mode = 0
+     *     conf->zone_refs = NULL
+     */
+
+    return conf;
+}
+
+char *
+ngx_http_cache_purge_init_main_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf = conf;
+
+    ngx_http_cache_purge_loc_conf_t  *cplcf;
+    ngx_http_cache_purge_zone_ref_t  *ref;
+    ngx_http_cache_purge_zone_t      *zone;
+    ngx_shm_zone_t                   *shm_zone;
+    ngx_list_part_t                  *part;
+    ngx_uint_t                        i, j;
+
+    /*
+     * cache zones named by directives are checked here, after the whole
+     * http block was parsed, as their *_cache_path might come later
+     */
+
+    ref = cpmcf->zone_refs ? cpmcf->zone_refs->elts : NULL;
+
+    for (j = 0; ref && j < cpmcf->zone_refs->nelts; j++) {
+
+        part = &cf->cycle->shared_memory.part;
+        shm_zone = part->elts;
+
+        for (i = 0; /* void */ ; i++) {
+
+            if (i >= part->nelts) {
+                if (part->next == NULL) {
+                    ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                                  "unknown cache zone \"%V\" in %s:%ui",
+                                  &ref[j].name, ref[j].file, ref[j].line);
+                    return NGX_CONF_ERROR;
+                }
+
+                part = part->next;
+                shm_zone = part->elts;
+                i = 0;
+            }
+
+            if (ngx_http_cache_purge_is_file_cache(&shm_zone[i])
+                && shm_zone[i].shm.name.len == ref[j].name.len
+                && ngx_strncmp(shm_zone[i].shm.name.data, ref[j].name.data,
+                               ref[j].name.len)
+                   == 0)
+            {
+                break;
+            }
+        }
+    }
+
+    if (cpmcf->io_rate && cpmcf->shm_zone == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"cache_purge_io\" requires"
+                           " \"cache_purge_zone\"");
+        return NGX_CONF_ERROR;
+    }
+
+    if (cpmcf->snapshot.data) {
+        if (cpmcf->shm_zone == NULL) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"cache_purge_snapshot\" requires"
+                               " \"cache_purge_zone\"");
+            return NGX_CONF_ERROR;
+        }
+
+        /* loaded once the zone is created */
+
+        zone = cpmcf->shm_zone->data;
+        zone->snapshot = cpmcf->snapshot;
+    }
+
+#  if (NGX_HAVE_UNIX_DOMAIN)
+    if (cpmcf->listen && cpmcf->shm_zone == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"cache_purge_listen\" requires"
+                           " \"cache_purge_zone\"");
+        return NGX_CONF_ERROR;
+    }
+#  endif
+
+    /*
+     * purges without a location follow the http block, whose own settings
+     * are only merged into servers
+     */
+
+    cplcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_cache_purge_module);
+
+    ngx_conf_init_msec_value(cplcf->coalesce, 0);
+    ngx_conf_init_msec_value(cplcf->fence, 0);
+    ngx_conf_init_value(cplcf->vary, 0);
+    ngx_conf_init_uint_value(cplcf->rate, 0);
+
+    if (cplcf->rate && cpmcf->shm_zone == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"cache_purge_rate\" requires"
+                           " \"cache_purge_zone\"");
+        return NGX_CONF_ERROR;
+    }
+
+    cplcf->post.retain = ngx_max(cplcf->coalesce, cplcf->fence);
+    cplcf->post.vary = cplcf->vary;
+
+    return NGX_CONF_OK;
+}
+
+ngx_int_t
+ngx_http_cache_purge_zone_ref(ngx_conf_t *cf, ngx_str_t *name)
+{
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_cache_purge_zone_ref_t   *ref;
+
+    cpmcf = ngx_http_conf_get_module_main_conf(cf,
+                                               ngx_http_cache_purge_module);
+
+    if (cpmcf->zone_refs == NULL) {
+        cpmcf->zone_refs = ngx_array_create(cf->pool, 4,
+                                   sizeof(ngx_http_cache_purge_zone_ref_t));
+        if (cpmcf->zone_refs == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    ref = ngx_array_push(cpmcf->zone_refs);
+    if (ref == NULL) {
+        return NGX_ERROR;
+    }
+
+    ref->name = *name;
+    ref->file = cf->conf_file->file.name.data;
+    ref->line = cf->conf_file->line;
+
+    return NGX_OK;
+}
+
 void *
 ngx_http_cache_purge_create_loc_conf(ngx_conf_t *cf)
 {
@@ -1640,22 +10547,53 @@ ngx_http_cache_purge_create_loc_conf(ngx_conf_t *cf)
      *     conf->*.access6 = NULL
      *     conf->handler = NULL
      *     conf->original_handler = NULL
+     *     conf->rewarm_uri = NULL
+     *     conf->slice_length = NULL
+     *     conf->schedule_jitter = 0
+     *     conf->rate_jitter = 0
+     *     conf->invalidate = { 0, NULL }
+     *     conf->invalidate_cache = 0
+     *     conf->bulk = { 0, NULL }
+     *     conf->inspect = { 0, NULL }
+     *     conf->export = { 0, NULL }
+     *     conf->evict = { 0, NULL }
+     *     conf->filter = { 0, NULL }
+     *     conf->errors = { 0, NULL }
+     *     conf->regex = { 0, NULL }
+     *     conf->regex_index = { 0, NULL }
      */
 
 # if (NGX_HTTP_FASTCGI)
     conf->fastcgi.enable = NGX_CONF_UNSET;
+    conf->fastcgi.unsafe = NGX_CONF_UNSET;
 # endif /* NGX_HTTP_FASTCGI */
 # if (NGX_HTTP_PROXY)
     conf->proxy.enable = NGX_CONF_UNSET;
+    conf->proxy.unsafe = NGX_CONF_UNSET;
 # endif /* NGX_HTTP_PROXY */
 # if (NGX_HTTP_SCGI)
     conf->scgi.enable = NGX_CONF_UNSET;
+    conf->scgi.unsafe = NGX_CONF_UNSET;
 # endif /* NGX_HTTP_SCGI */
 # if (NGX_HTTP_UWSGI)
     conf->uwsgi.enable = NGX_CONF_UNSET;
+    conf->uwsgi.unsafe = NGX_CONF_UNSET;
 # endif /* NGX_HTTP_UWSGI */
 
     conf->conf = NGX_CONF_UNSET_PTR;
+    conf->coalesce = NGX_CONF_UNSET_MSEC;
+    conf->fence = NGX_CONF_UNSET_MSEC;
+    conf->rewarm = NGX_CONF_UNSET;
+    conf->rewarm_min_uses = NGX_CONF_UNSET_UINT;
+    conf->rewarm_concurrency = NGX_CONF_UNSET_UINT;
+    conf->vary = NGX_CONF_UNSET;
+    conf->conditional = NGX_CONF_UNSET;
+    conf->track_errors = NGX_CONF_UNSET;
+    conf->slice = NGX_CONF_UNSET_SIZE;
+    conf->slice_max = NGX_CONF_UNSET_UINT;
+    conf->schedule = NGX_CONF_UNSET_PTR;
+    conf->shards = NGX_CONF_UNSET_UINT;
+    conf->rate = NGX_CONF_UNSET_UINT;
 
     return conf;
 }
@@ -1663,20 +10601,167 @@ ngx_http_cache_purge_create_loc_conf(ngx_conf_t *cf)
 char *
 ngx_http_cache_purge_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 {
-    ngx_http_cache_purge_loc_conf_t  *prev = parent;
-    ngx_http_cache_purge_loc_conf_t  *conf = child;
-    ngx_http_core_loc_conf_t         *clcf;
+    ngx_http_cache_purge_loc_conf_t   *prev = parent;
+    ngx_http_cache_purge_loc_conf_t   *conf = child;
+    ngx_http_cache_purge_main_conf_t  *cpmcf;
+    ngx_http_core_loc_conf_t          *clcf;
+# if (NGX_HTTP_FASTCGI)
+    ngx_http_fastcgi_loc_conf_t       *flcf;
+# endif /* NGX_HTTP_FASTCGI */
+# if (NGX_HTTP_PROXY)
+    ngx_http_proxy_loc_conf_t         *plcf;
+# endif /* NGX_HTTP_PROXY */
+# if (NGX_HTTP_SCGI)
+    ngx_http_scgi_loc_conf_t          *slcf;
+# endif /* NGX_HTTP_SCGI */
+# if (NGX_HTTP_UWSGI)
+    ngx_http_uwsgi_loc_conf_t         *ulcf;
+# endif /* NGX_HTTP_UWSGI */
+
+    cpmcf = ngx_http_conf_get_module_main_conf(cf,
+                                               ngx_http_cache_purge_module);
+
+    ngx_conf_merge_msec_value(conf->coalesce, prev->coalesce, 0);
+
+    if (conf->coalesce && cpmcf->shm_zone == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"cache_purge_coalesce\" requires"
+                           " \"cache_purge_zone\"");
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_conf_merge_msec_value(conf->fence, prev->fence, 0);
+
+    if (conf->fence && cpmcf->shm_zone == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"cache_purge_fence\" requires"
+                           " \"cache_purge_zone\"");
+        return NGX_CONF_ERROR;
+    }
+
+    if (conf->rewarm == NGX_CONF_UNSET) {
+        ngx_conf_merge_value(conf->rewarm, prev->rewarm, 0);
+        conf->rewarm_uri = prev->rewarm_uri;
+        conf->rewarm_min_uses = prev->rewarm_min_uses;
+        conf->rewarm_concurrency = prev->rewarm_concurrency;
+    }
+
+    ngx_conf_init_uint_value(conf->rewarm_min_uses, 0);
+    ngx_conf_init_uint_value(conf->rewarm_concurrency, 16);
+
+    ngx_conf_merge_value(conf->vary, prev->vary, 0);
+
+#  if (nginx_version < 1007007)
+    if (conf->vary) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"cache_purge_vary\" requires nginx-1.7.7+");
+        return NGX_CONF_ERROR;
+    }
+#  endif /* nginx_version < 1007007 */
+
+    if (conf->vary && cpmcf->shm_zone == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"cache_purge_vary\" requires"
+                           " \"cache_purge_zone\"");
+        return NGX_CONF_ERROR;
+    }
+
+    conf->post.retain = ngx_max(conf->coalesce, conf->fence);
+    conf->post.vary = conf->vary;
+
+    ngx_conf_merge_value(conf->conditional, prev->conditional, 0);
+
+#  if (nginx_version < 1007003)
+    if (conf->conditional) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"cache_purge_conditional\" requires"
+                           " nginx-1.7.3+");
+        return NGX_CONF_ERROR;
+    }
+#  endif /* nginx_version < 1007003 */
+
+    ngx_conf_merge_value(conf->track_errors, prev->track_errors, 0);
+
+    if (conf->track_errors && cpmcf->shm_zone == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"cache_purge_track_errors\" requires"
+                           " \"cache_purge_zone\"");
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_conf_merge_uint_value(conf->shards, prev->shards, 0);
+
+    if (conf->shards > 1 && cpmcf->shm_zone == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"cache_purge_shards\" requires"
+                           " \"cache_purge_zone\"");
+        return NGX_CONF_ERROR;
+    }
+
+    if (conf->errors.data && cpmcf->shm_zone == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"cache_purge_errors\" requires"
+                           " \"cache_purge_zone\"");
+        return NGX_CONF_ERROR;
+    }
+
+    if (conf->slice == NGX_CONF_UNSET_SIZE) {
+        ngx_conf_merge_size_value(conf->slice, prev->slice, 0);
+        conf->slice_length = prev->slice_length;
+        conf->slice_max = prev->slice_max;
+    }
+
+    ngx_conf_init_uint_value(conf->slice_max, 65536);
+
+    if (conf->schedule == NGX_CONF_UNSET_PTR) {
+        ngx_conf_merge_ptr_value(conf->schedule, prev->schedule, NULL);
+        conf->schedule_jitter = prev->schedule_jitter;
+    }
+
+    if (conf->schedule && conf->slice) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"cache_purge_schedule\" can't be used"
+                           " with \"cache_purge_slice\"");
+        return NGX_CONF_ERROR;
+    }
+
+    if (conf->schedule && cpmcf->shm_zone == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"cache_purge_schedule\" requires"
+                           " \"cache_purge_zone\"");
+        return NGX_CONF_ERROR;
+    }
+
+    if (conf->invalidate.data == NULL) {
+        conf->invalidate = prev->invalidate;
+        conf->invalidate_cache = prev->invalidate_cache;
+    }
+
+    ngx_conf_merge_str_value(conf->inspect, prev->inspect, "");
+
+    if (conf->rate == NGX_CONF_UNSET_UINT) {
+        ngx_conf_merge_uint_value(conf->rate, prev->rate, 0);
+        conf->rate_jitter = prev->rate_jitter;
+    }
+
+    if (conf->rate && cpmcf->shm_zone == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"cache_purge_rate\" requires"
+                           " \"cache_purge_zone\"");
+        return NGX_CONF_ERROR;
+    }
+
 # if (NGX_HTTP_FASTCGI)
-    ngx_http_fastcgi_loc_conf_t      *flcf;
+    ngx_conf_merge_value(conf->fastcgi.unsafe, prev->fastcgi.unsafe, 0);
 # endif /* NGX_HTTP_FASTCGI */
 # if (NGX_HTTP_PROXY)
-    ngx_http_proxy_loc_conf_t        *plcf;
+    ngx_conf_merge_value(conf->proxy.unsafe, prev->proxy.unsafe, 0);
 # endif /* NGX_HTTP_PROXY */
 # if (NGX_HTTP_SCGI)
-    ngx_http_scgi_loc_conf_t         *slcf;
+    ngx_conf_merge_value(conf->scgi.unsafe, prev->scgi.unsafe, 0);
 # endif /* NGX_HTTP_SCGI */
 # if (NGX_HTTP_UWSGI)
-    ngx_http_uwsgi_loc_conf_t        *ulcf;
+    ngx_conf_merge_value(conf->uwsgi.unsafe, prev->uwsgi.unsafe, 0);
 # endif /* NGX_HTTP_UWSGI */
 
     clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
@@ -1800,4 +10885,19 @@ ngx_module_t  ngx_http_cache_purge_module = {
     NGX_MODULE_V1_PADDING
 };
 
+ngx_module_t  ngx_http_cache_purge_filter_module = {
+    NGX_MODULE_V1,
+    &ngx_http_cache_purge_module_ctx,  /* module context */
+    NULL,                              /* module directives */
+    NGX_HTTP_MODULE,                   /* module type */
+    NULL,                              /* init master */
+    NULL,                              /* init module */
+    NULL,                              /* init process */
+    NULL,                              /* init thread */
+    NULL,                              /* exit thread */
+    NULL,                              /* exit process */
+    NULL,                              /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
 #endif /* NGX_HTTP_CACHE */
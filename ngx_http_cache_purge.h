@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2009-2014, FRiCKLE <info@frickle.com>
+ * Copyright (c) 2009-2014, Piotr Sikora <piotr.sikora@frickle.com>
+ * All rights reserved.
+ *
+ * This project was fully funded by yo.se.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _NGX_HTTP_CACHE_PURGE_H_INCLUDED_
+#define _NGX_HTTP_CACHE_PURGE_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#if (NGX_HTTP_CACHE)
+
+/*
+ * Called once the purge is done, with NGX_OK and the number of entries
+ * purged, or with NGX_ERROR.  It might be called before the purge
+ * function returns, when no disk operations had to be delayed.
+ */
+typedef void (*ngx_http_cache_purge_handler_pt)(void *data, ngx_int_t rc,
+    ngx_uint_t purged);
+
+
+/*
+ * Purge entries stored under the cache keys from the cache zone "zone",
+ * i.e. keys as evaluated from "proxy_cache_key" and alike, without
+ * a request.  Disk operations are subject to "cache_purge_io", and
+ * "cache_purge_coalesce", "cache_purge_fence", "cache_purge_vary" and
+ * "cache_purge_rate" apply as set in the http block.  With a rate, entries
+ * are queued instead, and "purged" is the number of entries queued.
+ * Conditional, scheduled and slice purges are only available to purge
+ * requests.
+ *
+ * Returns NGX_OK if the handler (which can be NULL) is going to be called,
+ * NGX_DECLINED if there is no such cache zone and NGX_ERROR on failure.
+ */
+ngx_int_t ngx_http_cache_purge_key(ngx_str_t *zone, ngx_str_t *key,
+    ngx_http_cache_purge_handler_pt handler, void *data);
+ngx_int_t ngx_http_cache_purge_keys(ngx_str_t *zone, ngx_str_t *keys,
+    ngx_uint_t n, ngx_http_cache_purge_handler_pt handler, void *data);
+
+#endif /* NGX_HTTP_CACHE */
+
+
+#endif /* _NGX_HTTP_CACHE_PURGE_H_INCLUDED_ */
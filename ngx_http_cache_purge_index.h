@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2009-2014, FRiCKLE <info@frickle.com>
+ * Copyright (c) 2009-2014, Piotr Sikora <piotr.sikora@frickle.com>
+ * All rights reserved.
+ *
+ * This project was fully funded by yo.se.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _NGX_HTTP_CACHE_PURGE_INDEX_H_INCLUDED_
+#define _NGX_HTTP_CACHE_PURGE_INDEX_H_INCLUDED_
+
+
+/*
+ * Key index of a cache directory, as written by tools/ngx_cache_purge_index
+ * and meant to be mmap()ed: the header, entries sorted by key (and hash for
+ * variants of the same key), then keys referenced by the entries.  Numbers
+ * are in host byte order, the index isn't portable between platforms.
+ *
+ * The header doesn't depend on nginx headers, it's shared with the tool.
+ */
+
+#include <stdint.h>
+
+
+#define NGX_HTTP_CACHE_PURGE_INDEX_MAGIC    "NGXCPIDX"
+#define NGX_HTTP_CACHE_PURGE_INDEX_VERSION  1
+
+
+typedef struct {
+    unsigned char                 magic[8];
+    uint32_t                      version;
+    uint32_t                      crc32;      /* of everything that follows */
+    uint64_t                      generation; /* time the index was written */
+    uint64_t                      entries;
+    uint64_t                      keys;       /* size of keys */
+} ngx_http_cache_purge_index_header_t;
+
+typedef struct {
+    unsigned char                 hash[16];   /* MD5 of the key, file name */
+    uint64_t                      size;       /* of the cache file */
+    uint64_t                      key;        /* offset in keys */
+    uint32_t                      key_len;
+    uint32_t                      reserved;
+} ngx_http_cache_purge_index_entry_t;
+
+
+#endif /* _NGX_HTTP_CACHE_PURGE_INDEX_H_INCLUDED_ */
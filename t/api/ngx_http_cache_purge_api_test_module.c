@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2009-2014, FRiCKLE <info@frickle.com>
+ * Copyright (c) 2009-2014, Piotr Sikora <piotr.sikora@frickle.com>
+ * All rights reserved.
+ *
+ * This project was fully funded by yo.se.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Exercises the C API in tests, not meant for production use:
+ * "cache_purge_api_test <cache zone>" purges the key given as the query
+ * string of requests to the location and answers with the result.
+ */
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include <ngx_http_cache_purge.h>
+
+
+#if (NGX_HTTP_CACHE)
+
+typedef struct {
+    ngx_str_t                     zone;
+} ngx_http_cache_purge_api_test_loc_conf_t;
+
+typedef struct {
+    ngx_http_request_t           *request;
+    ngx_int_t                     rc;
+    ngx_uint_t                    purged;
+    unsigned                      done:1;
+    unsigned                      waiting:1;
+} ngx_http_cache_purge_api_test_ctx_t;
+
+
+ngx_int_t   ngx_http_cache_purge_api_test_handler(ngx_http_request_t *r);
+void        ngx_http_cache_purge_api_test_done(void *data, ngx_int_t rc,
+    ngx_uint_t purged);
+ngx_int_t   ngx_http_cache_purge_api_test_send(ngx_http_request_t *r,
+    ngx_http_cache_purge_api_test_ctx_t *ctx);
+
+char       *ngx_http_cache_purge_api_test(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+void       *ngx_http_cache_purge_api_test_create_loc_conf(ngx_conf_t *cf);
+
+
+static ngx_command_t  ngx_http_cache_purge_api_test_module_commands[] = {
+
+    { ngx_string("cache_purge_api_test"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_cache_purge_api_test,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+static ngx_http_module_t  ngx_http_cache_purge_api_test_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    ngx_http_cache_purge_api_test_create_loc_conf, /* create location conf */
+    NULL                                   /* merge location configuration */
+};
+
+ngx_module_t  ngx_http_cache_purge_api_test_module = {
+    NGX_MODULE_V1,
+    &ngx_http_cache_purge_api_test_module_ctx, /* module context */
+    ngx_http_cache_purge_api_test_module_commands, /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+ngx_int_t
+ngx_http_cache_purge_api_test_handler(ngx_http_request_t *r)
+{
+    ngx_http_cache_purge_api_test_loc_conf_t  *alcf;
+    ngx_http_cache_purge_api_test_ctx_t       *ctx;
+    ngx_int_t                                  rc;
+
+    rc = ngx_http_discard_request_body(r);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    alcf = ngx_http_get_module_loc_conf(r,
+                                        ngx_http_cache_purge_api_test_module);
+
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_cache_purge_api_test_ctx_t));
+    if (ctx == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ctx->request = r;
+
+    rc = ngx_http_cache_purge_key(&alcf->zone, &r->args,
+                                  ngx_http_cache_purge_api_test_done, ctx);
+
+    if (rc == NGX_DECLINED) {
+        return NGX_HTTP_NOT_FOUND;
+    }
+
+    if (rc != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (ctx->done) {
+        return ngx_http_cache_purge_api_test_send(r, ctx);
+    }
+
+    /* disk operations were delayed */
+
+    ctx->waiting = 1;
+    r->main->count++;
+
+    return NGX_DONE;
+}
+
+void
+ngx_http_cache_purge_api_test_done(void *data, ngx_int_t rc,
+    ngx_uint_t purged)
+{
+    ngx_http_cache_purge_api_test_ctx_t  *ctx = data;
+
+    ngx_http_request_t  *r;
+
+    ctx->done = 1;
+    ctx->rc = rc;
+    ctx->purged = purged;
+
+    if (!ctx->waiting) {
+        return;
+    }
+
+    r = ctx->request;
+
+    rc = ngx_http_cache_purge_api_test_send(r, ctx);
+
+    ngx_http_finalize_request(r, rc);
+}
+
+ngx_int_t
+ngx_http_cache_purge_api_test_send(ngx_http_request_t *r,
+    ngx_http_cache_purge_api_test_ctx_t *ctx)
+{
+    ngx_chain_t   out;
+    ngx_buf_t    *b;
+    ngx_int_t     rc;
+
+    if (ctx->rc != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b = ngx_create_temp_buf(r->pool, sizeof("purged: \n") - 1
+                                     + NGX_INT_T_LEN);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->last = ngx_sprintf(b->last, "purged: %ui\n", ctx->purged);
+    b->last_buf = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    r->headers_out.content_type.len = sizeof("text/plain") - 1;
+    r->headers_out.content_type.data = (u_char *) "text/plain";
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    rc = ngx_http_send_header(r);
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+char *
+ngx_http_cache_purge_api_test(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_cache_purge_api_test_loc_conf_t  *alcf = conf;
+    ngx_http_core_loc_conf_t                  *clcf;
+    ngx_str_t                                 *value;
+
+    if (alcf->zone.data) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    alcf->zone = value[1];
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_cache_purge_api_test_handler;
+
+    return NGX_CONF_OK;
+}
+
+void *
+ngx_http_cache_purge_api_test_create_loc_conf(ngx_conf_t *cf)
+{
+    ngx_http_cache_purge_api_test_loc_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool,
+                       sizeof(ngx_http_cache_purge_api_test_loc_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->zone = { 0, NULL }
+     */
+
+    return conf;
+}
+
+#else /* !NGX_HTTP_CACHE */
+
+static ngx_http_module_t  ngx_http_cache_purge_api_test_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL,                                  /* merge location configuration */
+};
+
+ngx_module_t  ngx_http_cache_purge_api_test_module = {
+    NGX_MODULE_V1,
+    &ngx_http_cache_purge_api_test_module_ctx, /* module context */
+    NULL,                                  /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+#endif /* NGX_HTTP_CACHE */
@@ -0,0 +1,153 @@
+# vi:filetype=perl
+
+use lib 'lib';
+use Test::Nginx::Socket;
+
+# needs nginx built with the test module in t/api
+my $nginx = $ENV{TEST_NGINX_BINARY} || 'nginx';
+
+if (`$nginx -V 2>&1` !~ m{--add-module=\S*t/api\b}) {
+    plan skip_all => 'nginx built without ngx_http_cache_purge_api_test';
+}
+
+repeat_each(1);
+
+plan tests => repeat_each() * (blocks() * 4 + 1 * 1 + 3 * 1);
+
+our $http_config = <<'_EOC_';
+    proxy_cache_path   /tmp/ngx_cache_purge_cache keys_zone=test_cache:10m;
+    proxy_temp_path    /tmp/ngx_cache_purge_temp 1 2;
+    cache_purge_zone   test_purge:1m;
+    cache_purge_fence  1m;
+_EOC_
+
+our $config = <<'_EOC_';
+    location /proxy {
+        proxy_pass         $scheme://127.0.0.1:$server_port/etc/passwd;
+        proxy_cache        test_cache;
+        proxy_cache_key    $uri$is_args$args;
+        proxy_cache_valid  3m;
+        add_header         X-Cache-Status $upstream_cache_status;
+    }
+
+    location = /fenced {
+        # upstream purges the key while its response is on the way
+        proxy_pass         $scheme://127.0.0.1:$server_port/api?/fenced;
+        proxy_cache        test_cache;
+        proxy_cache_key    /fenced;
+        proxy_cache_valid  3m;
+        add_header         X-Cache-Status $upstream_cache_status;
+    }
+
+    location = /api {
+        cache_purge_api_test  test_cache;
+    }
+
+    location = /etc/passwd {
+        root               /;
+    }
+_EOC_
+
+worker_connections(128);
+no_shuffle();
+run_tests();
+
+no_diff();
+
+__DATA__
+
+=== TEST 1: prepare
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- request
+GET /proxy/passwd
+--- error_code: 200
+--- response_headers
+Content-Type: text/plain
+--- response_body_like: root
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
+
+
+
+=== TEST 2: purge through the C API
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- request
+GET /api?/proxy/passwd
+--- error_code: 200
+--- response_headers
+Content-Type: text/plain
+--- response_body
+purged: 1
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
+
+
+
+=== TEST 3: get from source
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- request
+GET /proxy/passwd
+--- error_code: 200
+--- response_headers
+Content-Type: text/plain
+X-Cache-Status: MISS
+--- response_body_like: root
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
+
+
+
+=== TEST 4: purge of a missing key
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- request
+GET /api?/proxy/none
+--- error_code: 200
+--- response_headers
+Content-Type: text/plain
+--- response_body
+purged: 0
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
+
+
+
+=== TEST 5: purge of an unknown cache zone
+--- http_config eval: $::http_config
+--- config
+    location = /api {
+        cache_purge_api_test  none;
+    }
+--- request
+GET /api?/proxy/passwd
+--- error_code: 404
+--- response_headers
+Content-Type: text/html
+--- response_body_like: 404 Not Found
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
+
+
+
+=== TEST 6: keys purged through the C API are fenced
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- pipelined_requests eval
+["GET /fenced", "GET /fenced"]
+--- error_code eval
+[200, 200]
+--- response_headers eval
+["Content-Type: text/plain", "X-Cache-Status: MISS"]
+--- response_body eval
+["purged: 0\n", "purged: 0\n"]
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
@@ -0,0 +1,120 @@
+# vi:filetype=perl
+
+use lib 'lib';
+use Test::Nginx::Socket;
+
+repeat_each(1);
+
+plan tests => repeat_each() * (blocks() * 4 + 1 * 1);
+
+our $http_config = <<'_EOC_';
+    proxy_cache_path  /tmp/ngx_cache_purge_cache keys_zone=test_cache:10m;
+    proxy_temp_path   /tmp/ngx_cache_purge_temp 1 2;
+_EOC_
+
+our $config = <<'_EOC_';
+    location /proxy {
+        proxy_pass         $scheme://127.0.0.1:$server_port/etc/passwd;
+        proxy_cache        test_cache;
+        proxy_cache_key    $uri$is_args$args;
+        proxy_cache_valid  3m;
+        add_header         X-Cache-Status $upstream_cache_status;
+    }
+
+    location ~ /purge(/.*) {
+        proxy_cache_purge        test_cache $1$is_args$args;
+        cache_purge_conditional  on;
+    }
+
+    location = /etc/passwd {
+        root               /;
+    }
+_EOC_
+
+worker_connections(128);
+no_shuffle();
+run_tests();
+
+no_diff();
+
+__DATA__
+
+=== TEST 1: prepare
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- request
+GET /proxy/passwd
+--- error_code: 200
+--- response_headers
+Content-Type: text/plain
+--- response_body_like: root
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
+
+
+
+=== TEST 2: purge entry stored after the date
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- request
+PURGE /purge/proxy/passwd
+--- more_headers
+If-Unmodified-Since: Thu, 01 Jan 1970 00:00:01 GMT
+--- error_code: 412
+--- response_headers
+Content-Type: text/html
+--- response_body_like: 412 Precondition Failed
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
+
+
+
+=== TEST 3: purge entry with another etag
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- request
+PURGE /purge/proxy/passwd
+--- more_headers
+If-Match: "stale"
+--- error_code: 412
+--- response_headers
+Content-Type: text/html
+--- response_body_like: 412 Precondition Failed
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
+
+
+
+=== TEST 4: purge entry stored before the date
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- request
+PURGE /purge/proxy/passwd
+--- more_headers
+If-Unmodified-Since: Fri, 01 Jan 2100 00:00:00 GMT
+--- error_code: 200
+--- response_headers
+Content-Type: text/html
+--- response_body_like: Successful purge
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
+
+
+
+=== TEST 5: get from source
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- request
+GET /proxy/passwd
+--- error_code: 200
+--- response_headers
+Content-Type: text/plain
+X-Cache-Status: MISS
+--- response_body_like: root
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
@@ -0,0 +1,88 @@
+# vi:filetype=perl
+
+use lib 'lib';
+use Test::Nginx::Socket;
+
+repeat_each(1);
+
+plan tests => repeat_each() * (blocks() * 4 + 5 * 3);
+
+our $http_config = <<'_EOC_';
+    proxy_cache_path  /tmp/ngx_cache_purge_cache keys_zone=test_cache:10m;
+    proxy_temp_path   /tmp/ngx_cache_purge_temp 1 2;
+    cache_purge_zone  test_purge:1m;
+_EOC_
+
+our $config = <<'_EOC_';
+    location ~ /proxy/(.*) {
+        proxy_pass         $scheme://127.0.0.1:$server_port/origin/$1;
+        proxy_cache        test_cache;
+        proxy_cache_key    $uri$is_args$args;
+        proxy_cache_valid  any 3m;
+        add_header         X-Cache-Status $upstream_cache_status;
+
+        cache_purge_track_errors  on;
+    }
+
+    location = /errors {
+        cache_purge_errors  test_cache;
+    }
+
+    location /origin/ {
+        alias              /etc/;
+        log_not_found      off;
+    }
+_EOC_
+
+worker_connections(128);
+no_shuffle();
+run_tests();
+
+no_diff();
+
+__DATA__
+
+=== TEST 1: purge cached errors
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- pipelined_requests eval
+["GET /proxy/passwd",
+ "GET /proxy/missing",
+ "POST /errors?status=5xx",
+ "DELETE /errors",
+ "DELETE /errors",
+ "GET /proxy/passwd"]
+--- error_code eval
+[200, 404, 200, 200, 200, 200]
+--- response_headers eval
+["X-Cache-Status: MISS",
+ "Content-Type: text/html",
+ "Content-Type: application/json",
+ "Content-Type: application/json",
+ "Content-Type: application/json",
+ "X-Cache-Status: HIT"]
+--- response_body_like eval
+[qr/root/,
+ qr/404 Not Found/,
+ qr/^\{"scanned":1,"freed":0,"entries":0,"size":[1-9]\d*\}$/,
+ qr/^\{"scanned":1,"freed":[1-9]\d*,"entries":1,"size":[1-9]\d*\}$/,
+ qr/^\{"scanned":0,"freed":0,"entries":0,"size":[1-9]\d*\}$/,
+ qr/root/]
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
+
+
+
+=== TEST 2: purge with invalid status
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- request
+POST /errors?status=200
+--- error_code: 400
+--- response_headers
+Content-Type: text/html
+--- response_body_like: 400 Bad Request
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
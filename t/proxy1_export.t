@@ -0,0 +1,66 @@
+# vi:filetype=perl
+
+use lib 'lib';
+use Test::Nginx::Socket;
+
+repeat_each(1);
+
+plan tests => repeat_each() * (blocks() * 4 + 12 * 1);
+
+our $http_config = <<'_EOC_';
+    proxy_cache_path  /tmp/ngx_cache_purge_cache keys_zone=test_cache:10m;
+    proxy_temp_path   /tmp/ngx_cache_purge_temp 1 2;
+_EOC_
+
+our $config = <<'_EOC_';
+    location /proxy {
+        proxy_pass         $scheme://127.0.0.1:$server_port/etc/passwd;
+        proxy_cache        test_cache;
+        proxy_cache_key    $uri$is_args$args;
+        proxy_cache_valid  3m;
+        add_header         X-Cache-Status $upstream_cache_status;
+    }
+
+    location = /export {
+        cache_purge_export  test_cache;
+    }
+
+    location = /etc/passwd {
+        root               /;
+    }
+_EOC_
+
+worker_connections(128);
+no_shuffle();
+run_tests();
+
+no_diff();
+
+__DATA__
+
+=== TEST 1: export with and without limit
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- pipelined_requests eval
+["GET /proxy/passwd",
+ "GET /proxy/shadow",
+ "GET /export",
+ "GET /export?limit=1",
+ "GET /export?cursor=none"]
+--- error_code eval
+[200, 200, 200, 200, 400]
+--- response_headers eval
+["Content-Type: text/plain",
+ "Content-Type: text/plain",
+ "Content-Type: application/x-ndjson",
+ "Content-Type: application/x-ndjson",
+ "Content-Type: text/html"]
+--- response_body_like eval
+[qr/root/,
+ qr/root/,
+ qr/^(\{"hash":"[0-9a-f]{32}","fs_size":\d+,"valid_sec":\d+,"uses":1\}\n){2}\{"entries":2\}$/,
+ qr/^\{"hash":"([0-9a-f]{32})","fs_size":\d+,"valid_sec":\d+,"uses":1\}\n\{"entries":1,"cursor":"\1"\}$/,
+ qr/400 Bad Request/]
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
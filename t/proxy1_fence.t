@@ -0,0 +1,85 @@
+# vi:filetype=perl
+
+use lib 'lib';
+use Test::Nginx::Socket;
+
+repeat_each(1);
+
+plan tests => repeat_each() * (blocks() * 4 + 7 * 1 + 8 * 1);
+
+our $http_config = <<'_EOC_';
+    proxy_cache_path   /tmp/ngx_cache_purge_cache keys_zone=test_cache:10m;
+    proxy_temp_path    /tmp/ngx_cache_purge_temp 1 2;
+    cache_purge_zone   test_purge:1m;
+    cache_purge_fence  1m;
+_EOC_
+
+our $config = <<'_EOC_';
+    location /proxy {
+        proxy_pass         $scheme://127.0.0.1:$server_port/etc/passwd;
+        proxy_cache        test_cache;
+        proxy_cache_key    $uri$is_args$args;
+        proxy_cache_valid  3m;
+        add_header         X-Cache-Status $upstream_cache_status;
+    }
+
+    location = /fenced {
+        # upstream purges the key while its response is on the way
+        proxy_pass         $scheme://127.0.0.1:$server_port/purge/proxy/passwd;
+        proxy_cache        test_cache;
+        proxy_cache_key    /proxy/passwd;
+        proxy_cache_valid  3m;
+    }
+
+    location ~ /purge(/.*) {
+        proxy_cache_purge  test_cache $1$is_args$args;
+    }
+
+    location = /etc/passwd {
+        root               /;
+    }
+_EOC_
+
+worker_connections(128);
+no_shuffle();
+run_tests();
+
+no_diff();
+
+__DATA__
+
+=== TEST 1: response requested before purge is not cached
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- pipelined_requests eval
+["GET /proxy/passwd", "GET /fenced", "GET /proxy/passwd"]
+--- error_code eval
+[200, 200, 200]
+--- response_headers eval
+["Content-Type: text/plain",
+ "Content-Type: text/html",
+ "Content-Type: text/plain\nX-Cache-Status: MISS"]
+--- response_body_like eval
+[qr/root/, qr/Successful purge/, qr/root/]
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
+
+
+
+=== TEST 2: response requested after purge is cached
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- pipelined_requests eval
+["PURGE /purge/proxy/passwd", "GET /proxy/passwd", "GET /proxy/passwd"]
+--- error_code eval
+[200, 200, 200]
+--- response_headers eval
+["Content-Type: text/html",
+ "Content-Type: text/plain\nX-Cache-Status: MISS",
+ "Content-Type: text/plain\nX-Cache-Status: HIT"]
+--- response_body_like eval
+[qr/Successful purge/, qr/root/, qr/root/]
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
@@ -0,0 +1,64 @@
+# vi:filetype=perl
+
+use lib 'lib';
+use Test::Nginx::Socket;
+
+repeat_each(1);
+
+plan tests => repeat_each() * (blocks() * 4 + 9 * 1);
+
+our $http_config = <<'_EOC_';
+    proxy_cache_path  /tmp/ngx_cache_purge_cache keys_zone=test_cache:10m;
+    proxy_temp_path   /tmp/ngx_cache_purge_temp 1 2;
+_EOC_
+
+our $config = <<'_EOC_';
+    location /proxy {
+        proxy_pass         $scheme://127.0.0.1:$server_port/etc/passwd;
+        proxy_cache        test_cache;
+        proxy_cache_key    $uri$is_args$args;
+        proxy_cache_valid  3m;
+        add_header         X-Cache-Status $upstream_cache_status;
+    }
+
+    location ~ /purge(/.*) {
+        proxy_cache_purge    test_cache $1$is_args$args;
+        cache_purge_inspect  INSPECT;
+    }
+
+    location = /etc/passwd {
+        root               /;
+    }
+_EOC_
+
+worker_connections(128);
+no_shuffle();
+run_tests();
+
+no_diff();
+
+__DATA__
+
+=== TEST 1: inspect before and after purge
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- pipelined_requests eval
+["GET /proxy/passwd",
+ "INSPECT /purge/proxy/passwd",
+ "PURGE /purge/proxy/passwd",
+ "INSPECT /purge/proxy/passwd"]
+--- error_code eval
+[200, 200, 200, 404]
+--- response_headers eval
+["Content-Type: text/plain",
+ "Content-Type: application/json",
+ "Content-Type: text/html",
+ "Content-Type: application/json"]
+--- response_body_like eval
+[qr/root/,
+ qr/^\{"key":"\/proxy\/passwd","hash":"[0-9a-f]{32}","node":true,"exists":true,.*"path":"\/tmp\/ngx_cache_purge_cache\/[0-9a-f]{32}"\}$/,
+ qr/Successful purge/,
+ qr/"node":true,"exists":false,/]
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
@@ -0,0 +1,136 @@
+# vi:filetype=perl
+
+use lib 'lib';
+use Test::Nginx::Socket;
+
+repeat_each(1);
+
+plan tests => repeat_each() * (blocks() * 4 + 9 * 1 + 3 * 1);
+
+our $http_config = <<'_EOC_';
+    proxy_cache_path  /tmp/ngx_cache_purge_cache keys_zone=test_cache:10m;
+    proxy_temp_path   /tmp/ngx_cache_purge_temp 1 2;
+_EOC_
+
+our $config = <<'_EOC_';
+    location /proxy {
+        proxy_pass         $scheme://127.0.0.1:$server_port/etc/passwd;
+        proxy_cache        test_cache;
+        proxy_cache_key    $uri$is_args$args;
+        proxy_cache_valid  3m;
+        add_header         X-Cache-Status $upstream_cache_status;
+    }
+
+    location = /write {
+        proxy_pass              $scheme://127.0.0.1:$server_port/origin;
+        proxy_hide_header       X-Cache-Invalidate;
+        cache_purge_invalidate  X-Cache-Invalidate zone=test_cache;
+    }
+
+    location = /origin {
+        add_header         X-Cache-Invalidate "/proxy/passwd, /proxy/none";
+        return             200 "written\n";
+    }
+
+    location = /etc/passwd {
+        root               /;
+    }
+_EOC_
+
+worker_connections(128);
+no_shuffle();
+run_tests();
+
+no_diff();
+
+__DATA__
+
+=== TEST 1: keys listed by the origin are purged
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- pipelined_requests eval
+["GET /proxy/passwd",
+ "GET /proxy/passwd",
+ "GET /write",
+ "GET /proxy/passwd"]
+--- error_code eval
+[200, 200, 200, 200]
+--- response_headers eval
+["Content-Type: text/plain",
+ "X-Cache-Status: HIT",
+ "X-Cache-Invalidate:",
+ "X-Cache-Status: MISS"]
+--- response_body_like eval
+[qr/root/, qr/root/, qr/written/, qr/root/]
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
+
+
+
+=== TEST 2: cache_purge_invalidate off
+--- http_config eval: $::http_config
+--- config
+    location /proxy {
+        proxy_pass              $scheme://127.0.0.1:$server_port/origin;
+        proxy_cache             test_cache;
+        proxy_cache_key         $uri;
+        proxy_cache_valid       3m;
+        cache_purge_invalidate  off;
+        add_header              X-Cache-Status $upstream_cache_status;
+    }
+
+    location = /origin {
+        add_header         X-Cache-Invalidate "/proxy";
+        return             200 "origin\n";
+    }
+--- request
+GET /proxy
+--- error_code: 200
+--- response_headers
+X-Cache-Invalidate: /proxy
+--- response_body
+origin
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
+
+
+
+=== TEST 3: invalidated keys are fenced
+--- http_config
+    proxy_cache_path   /tmp/ngx_cache_purge_cache keys_zone=test_cache:10m;
+    proxy_temp_path    /tmp/ngx_cache_purge_temp 1 2;
+    cache_purge_zone   test_purge:1m;
+    cache_purge_fence  1m;
+--- config
+    location = /fenced {
+        # upstream invalidates the key while its response is on the way
+        proxy_pass         $scheme://127.0.0.1:$server_port/write;
+        proxy_cache        test_cache;
+        proxy_cache_key    /fenced;
+        proxy_cache_valid  3m;
+        add_header         X-Cache-Status $upstream_cache_status;
+    }
+
+    location = /write {
+        proxy_pass              $scheme://127.0.0.1:$server_port/origin;
+        proxy_hide_header       X-Cache-Invalidate;
+        cache_purge_invalidate  X-Cache-Invalidate zone=test_cache;
+    }
+
+    location = /origin {
+        add_header         X-Cache-Invalidate "/fenced";
+        return             200 "written\n";
+    }
+--- pipelined_requests eval
+["GET /fenced", "GET /fenced"]
+--- error_code eval
+[200, 200]
+--- response_headers eval
+["X-Cache-Invalidate:", "X-Cache-Status: MISS"]
+--- response_body_like eval
+[qr/written/, qr/written/]
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
@@ -0,0 +1,62 @@
+# vi:filetype=perl
+
+use lib 'lib';
+use Test::Nginx::Socket;
+
+repeat_each(1);
+
+plan tests => repeat_each() * (blocks() * 4 + 9 * 1);
+
+our $http_config = <<'_EOC_';
+    proxy_cache_path  /tmp/ngx_cache_purge_cache keys_zone=test_cache:10m;
+    proxy_temp_path   /tmp/ngx_cache_purge_temp 1 2;
+    cache_purge_zone  test_purge:1m;
+    cache_purge_io    1 burst=1;
+_EOC_
+
+our $config = <<'_EOC_';
+    location /proxy {
+        proxy_pass         $scheme://127.0.0.1:$server_port/etc/passwd;
+        proxy_cache        test_cache;
+        proxy_cache_key    $uri$is_args$args;
+        proxy_cache_valid  3m;
+        add_header         X-Cache-Status $upstream_cache_status;
+    }
+
+    location ~ /purge(/.*) {
+        proxy_cache_purge  test_cache $1$is_args$args;
+    }
+
+    location = /etc/passwd {
+        root               /;
+    }
+_EOC_
+
+worker_connections(128);
+no_shuffle();
+run_tests();
+
+no_diff();
+
+__DATA__
+
+=== TEST 1: purge over the disk budget is delayed, not refused
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- pipelined_requests eval
+["GET /proxy/passwd?a",
+ "GET /proxy/passwd?b",
+ "PURGE /purge/proxy/passwd?a",
+ "PURGE /purge/proxy/passwd?b"]
+--- error_code eval
+[200, 200, 200, 200]
+--- response_headers eval
+["Content-Type: text/plain",
+ "Content-Type: text/plain",
+ "Content-Type: text/html",
+ "Content-Type: text/html"]
+--- response_body_like eval
+[qr/root/, qr/root/, qr/Successful purge/, qr/Successful purge/]
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
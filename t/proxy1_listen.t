@@ -0,0 +1,112 @@
+# vi:filetype=perl
+
+use lib 'lib';
+use Test::Nginx::Socket;
+use IO::Socket::UNIX;
+use Socket;
+
+repeat_each(1);
+
+plan tests => repeat_each() * (blocks() * 4 + 1 * 1);
+
+our $http_config = <<'_EOC_';
+    proxy_cache_path    /tmp/ngx_cache_purge_cache keys_zone=test_cache:10m;
+    proxy_temp_path     /tmp/ngx_cache_purge_temp 1 2;
+    cache_purge_zone    test_purge:1m;
+    cache_purge_listen  unix:/tmp/ngx_cache_purge_listen.sock;
+_EOC_
+
+our $config = <<'_EOC_';
+    location /proxy {
+        proxy_pass         $scheme://127.0.0.1:$server_port/etc/passwd;
+        proxy_cache        test_cache;
+        proxy_cache_key    $uri$is_args$args;
+        proxy_cache_valid  3m;
+        add_header         X-Cache-Status $upstream_cache_status;
+    }
+
+    location = /ingest {
+        return  200 "$cache_purge_ingest_keys $cache_purge_ingest_purged $cache_purge_ingest_errors\n";
+    }
+
+    location = /etc/passwd {
+        root               /;
+    }
+_EOC_
+
+# sends datagrams once nginx is listening, and lets it read them
+sub send_datagram ($) {
+    my $data = shift;
+
+    for (1 .. 50) {
+        my $sock = IO::Socket::UNIX->new(
+            Type => SOCK_DGRAM,
+            Peer => '/tmp/ngx_cache_purge_listen.sock',
+        );
+
+        if ($sock && $sock->send($data)) {
+            select(undef, undef, undef, 0.5);
+            return;
+        }
+
+        select(undef, undef, undef, 0.1);
+    }
+
+    die "could not send datagram: $!";
+}
+
+worker_connections(128);
+no_shuffle();
+run_tests();
+
+no_diff();
+
+__DATA__
+
+=== TEST 1: prepare
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- request
+GET /proxy/passwd
+--- error_code: 200
+--- response_headers
+Content-Type: text/plain
+--- response_body_like: root
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
+
+
+
+=== TEST 2: purge received on the socket
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- init
+main::send_datagram("K test_cache /proxy/passwd\nK test_cache /proxy/none\n"
+                    . "X test_cache /proxy/passwd\n");
+--- request
+GET /ingest
+--- error_code: 200
+--- response_headers
+Content-Type: text/plain
+--- response_body
+2 1 1
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
+
+
+
+=== TEST 3: get from source
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- request
+GET /proxy/passwd
+--- error_code: 200
+--- response_headers
+Content-Type: text/plain
+X-Cache-Status: MISS
+--- response_body_like: root
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
@@ -0,0 +1,97 @@
+# vi:filetype=perl
+
+use lib 'lib';
+use Test::Nginx::Socket;
+
+repeat_each(1);
+
+plan tests => repeat_each() * (blocks() * 4 + 13 * 1 + 9 * 1);
+
+our $http_config = <<'_EOC_';
+    proxy_cache_path  /tmp/ngx_cache_purge_cache keys_zone=test_cache:10m;
+    proxy_temp_path   /tmp/ngx_cache_purge_temp 1 2;
+    cache_purge_zone  test_purge:1m;
+_EOC_
+
+our $config = <<'_EOC_';
+    location /proxy {
+        proxy_pass         $scheme://127.0.0.1:$server_port/etc/passwd;
+        proxy_cache        test_cache;
+        proxy_cache_key    $uri$arg_range;
+        proxy_cache_valid  3m;
+        add_header         X-Cache-Status $upstream_cache_status;
+    }
+
+    location ~ /purge(/.*) {
+        proxy_cache_purge  test_cache $1;
+        cache_purge_slice  1k;
+        cache_purge_rate   1 jitter=1h;
+    }
+
+    location = /filter {
+        cache_purge_filter test_cache;
+        cache_purge_rate   1 jitter=1h;
+    }
+
+    location = /pending {
+        return             200 "$cache_purge_pending\n";
+    }
+
+    location = /etc/passwd {
+        root               /;
+    }
+_EOC_
+
+worker_connections(128);
+no_shuffle();
+run_tests();
+
+no_diff();
+
+__DATA__
+
+=== TEST 1: queue purge of all slices
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- pipelined_requests eval
+["GET /proxy/passwd?range=bytes=0-1023",
+ "GET /proxy/passwd?range=bytes=1024-2047",
+ "PURGE /purge/proxy/passwd",
+ "GET /pending",
+ "GET /proxy/passwd?range=bytes=0-1023"]
+--- error_code eval
+[200, 200, 202, 200, 200]
+--- response_headers eval
+["Content-Type: text/plain",
+ "Content-Type: text/plain",
+ "Content-Type: text/html",
+ "Content-Type: text/plain",
+ "Content-Type: text/plain\nX-Cache-Status: HIT"]
+--- response_body_like eval
+[qr/root/, qr/root/, qr/Entries: 2/, qr/^2$/, qr/root/]
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
+
+
+
+=== TEST 2: queue filter purge
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- pipelined_requests eval
+["GET /proxy/passwd?range=bytes=2048-3071",
+ "POST /filter?min_size=1",
+ "GET /pending",
+ "GET /proxy/passwd?range=bytes=2048-3071"]
+--- error_code eval
+[200, 202, 200, 200]
+--- response_headers eval
+["Content-Type: text/plain",
+ "Content-Type: application/json",
+ "Content-Type: text/plain",
+ "X-Cache-Status: HIT"]
+--- response_body_like eval
+[qr/root/, qr/"entries":1,.*"queued":true/, qr/^1$/, qr/root/]
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
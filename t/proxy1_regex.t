@@ -0,0 +1,101 @@
+# vi:filetype=perl
+
+use lib 'lib';
+use Test::Nginx::Socket;
+use Digest::MD5 qw(md5);
+
+repeat_each(1);
+
+plan tests => repeat_each() * (blocks() * 4 + 5 * 3);
+
+# key index, as written by tools/ngx_cache_purge_index
+
+my @keys = ("/proxy/passwd", "/proxy/passwd?x=1");
+my ($entries, $data) = ("", "");
+
+for my $key (@keys) {
+    $entries .= pack("a16 Q Q L L", md5($key), 4096, length($data),
+                     length($key), 0);
+    $data .= $key;
+}
+
+open(my $fh, '>', '/tmp/ngx_cache_purge_index') or die $!;
+print $fh pack("a8 L L Q Q Q", "NGXCPIDX", 1, 0, time(), scalar(@keys),
+               length($data)), $entries, $data;
+close($fh);
+
+our $http_config = <<'_EOC_';
+    proxy_cache_path  /tmp/ngx_cache_purge_cache keys_zone=test_cache:10m;
+    proxy_temp_path   /tmp/ngx_cache_purge_temp 1 2;
+_EOC_
+
+our $config = <<'_EOC_';
+    location /proxy {
+        proxy_pass         $scheme://127.0.0.1:$server_port/etc/passwd;
+        proxy_cache        test_cache;
+        proxy_cache_key    $uri$is_args$args;
+        proxy_cache_valid  3m;
+        add_header         X-Cache-Status $upstream_cache_status;
+    }
+
+    location = /regex {
+        cache_purge_regex  test_cache /tmp/ngx_cache_purge_index;
+    }
+
+    location = /etc/passwd {
+        root               /;
+    }
+_EOC_
+
+worker_connections(128);
+no_shuffle();
+run_tests();
+
+no_diff();
+
+__DATA__
+
+=== TEST 1: purge by regex
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- pipelined_requests eval
+["GET /proxy/passwd",
+ "GET /proxy/passwd?x=1",
+ "POST /regex?pattern=%5E/proxy/passwd%24&dry_run=1",
+ "POST /regex?pattern=%5E/proxy/passwd%24",
+ "GET /proxy/passwd",
+ "GET /proxy/passwd?x=1"]
+--- error_code eval
+[200, 200, 200, 200, 200, 200]
+--- response_headers eval
+["X-Cache-Status: MISS",
+ "X-Cache-Status: MISS",
+ "Content-Type: application/json",
+ "Content-Type: application/json",
+ "X-Cache-Status: MISS",
+ "X-Cache-Status: HIT"]
+--- response_body_like eval
+[qr/root/,
+ qr/root/,
+ qr/^\{"scanned":2,"freed":[1-9]\d*,"entries":1,"size":[1-9]\d*,"dry_run":true\}$/,
+ qr/^\{"scanned":2,"freed":[1-9]\d*,"entries":1,"size":[1-9]\d*\}$/,
+ qr/root/,
+ qr/root/]
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
+
+
+
+=== TEST 2: purge by invalid regex
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- request
+POST /regex?pattern=(
+--- error_code: 400
+--- response_headers
+Content-Type: text/html
+--- response_body_like: 400 Bad Request
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
@@ -0,0 +1,83 @@
+# vi:filetype=perl
+
+use lib 'lib';
+use Test::Nginx::Socket;
+
+repeat_each(1);
+
+plan tests => repeat_each() * (blocks() * 4 + 4 * 3);
+
+our $http_config = <<'_EOC_';
+    proxy_cache_path  /tmp/ngx_cache_purge_cache keys_zone=test_cache:10m;
+    proxy_temp_path   /tmp/ngx_cache_purge_temp 1 2;
+    cache_purge_zone  purge:1m;
+_EOC_
+
+our $config = <<'_EOC_';
+    location /proxy {
+        proxy_pass         $scheme://127.0.0.1:$server_port/etc/passwd;
+        proxy_cache        test_cache;
+        proxy_cache_key    $uri$is_args$args;
+        proxy_cache_valid  3m;
+        add_header         X-Cache-Status $upstream_cache_status;
+    }
+
+    location = /filter {
+        cache_purge_filter  test_cache;
+        cache_purge_shards  4;
+    }
+
+    location = /etc/passwd {
+        root               /;
+    }
+_EOC_
+
+worker_connections(128);
+no_shuffle();
+run_tests();
+
+no_diff();
+
+__DATA__
+
+=== TEST 1: sharded purge by size
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- pipelined_requests eval
+["GET /proxy/passwd",
+ "GET /proxy/passwd?a",
+ "POST /filter?min_size=1g",
+ "DELETE /filter?max_size=1g",
+ "GET /proxy/passwd"]
+--- error_code eval
+[200, 200, 200, 200, 200]
+--- response_headers eval
+["X-Cache-Status: MISS",
+ "X-Cache-Status: MISS",
+ "Content-Type: application/json",
+ "Content-Type: application/json",
+ "X-Cache-Status: MISS"]
+--- response_body_like eval
+[qr/root/,
+ qr/root/,
+ qr/^\{"scanned":2,"freed":0,"entries":0,"size":[1-9]\d*\}$/,
+ qr/^\{"scanned":2,"freed":[1-9]\d*,"entries":2,"size":0\}$/,
+ qr/root/]
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
+
+
+
+=== TEST 2: sharded purge without filters
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- request
+POST /filter
+--- error_code: 400
+--- response_headers
+Content-Type: text/html
+--- response_body_like: 400 Bad Request
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
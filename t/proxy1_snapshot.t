@@ -0,0 +1,101 @@
+# vi:filetype=perl
+
+use lib 'lib';
+use Test::Nginx::Socket;
+use Digest::MD5 qw(md5);
+use Compress::Zlib qw(crc32);
+
+repeat_each(1);
+
+plan tests => repeat_each() * (blocks() * 4 + 1 * 3);
+
+# snapshots of the purge zone, as written by "cache_purge_snapshot"
+
+sub snapshot {
+    my ($file, $zone, @keys) = @_;
+    my $records = "";
+
+    for my $key (@keys) {
+        $records .= pack("L S S a16 a16", crc32($zone), 404, 0, md5($key),
+                         "");
+    }
+
+    open(my $fh, '>', $file) or die $!;
+    print $fh pack("a8 L L Q Q Q", "NGXCPSNP", 1, crc32($records), 7,
+                   length($records) / 40, 0), $records;
+    close($fh);
+}
+
+snapshot('/tmp/ngx_cache_purge_snapshot', 'test_cache', '/proxy/missing');
+snapshot('/tmp/ngx_cache_purge_snapshot_other', 'other_cache',
+         '/proxy/missing');
+
+our $config = <<'_EOC_';
+    location ~ /proxy/(.*) {
+        proxy_pass         $scheme://127.0.0.1:$server_port/origin/$1;
+        proxy_cache        test_cache;
+        proxy_cache_key    $uri$is_args$args;
+        proxy_cache_valid  any 3m;
+        add_header         X-Cache-Status $upstream_cache_status;
+
+        cache_purge_track_errors  on;
+    }
+
+    location = /errors {
+        cache_purge_errors  test_cache;
+    }
+
+    location /origin/ {
+        alias              /etc/;
+        log_not_found      off;
+    }
+_EOC_
+
+worker_connections(128);
+no_shuffle();
+run_tests();
+
+no_diff();
+
+__DATA__
+
+=== TEST 1: purge errors loaded from snapshot
+--- http_config
+    proxy_cache_path      /tmp/ngx_cache_purge_cache keys_zone=test_cache:10m;
+    proxy_temp_path       /tmp/ngx_cache_purge_temp 1 2;
+    cache_purge_zone      test_purge:1m;
+    cache_purge_snapshot  /tmp/ngx_cache_purge_snapshot;
+--- config eval: $::config
+--- pipelined_requests eval
+["DELETE /errors",
+ "DELETE /errors"]
+--- error_code eval
+[200, 200]
+--- response_headers eval
+["Content-Type: application/json",
+ "Content-Type: application/json"]
+--- response_body_like eval
+[qr/^\{"scanned":1,"freed":0,"entries":0,"size":\d+\}$/,
+ qr/^\{"scanned":0,"freed":0,"entries":0,"size":\d+\}$/]
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
+
+
+
+=== TEST 2: snapshot of another cache zone
+--- http_config
+    proxy_cache_path      /tmp/ngx_cache_purge_cache keys_zone=test_cache:10m;
+    proxy_temp_path       /tmp/ngx_cache_purge_temp 1 2;
+    cache_purge_zone      test_purge:1m;
+    cache_purge_snapshot  /tmp/ngx_cache_purge_snapshot_other;
+--- config eval: $::config
+--- request
+DELETE /errors
+--- error_code: 200
+--- response_headers
+Content-Type: application/json
+--- response_body_like: ^\{"scanned":0,"freed":0,"entries":0,"size":\d+\}$
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
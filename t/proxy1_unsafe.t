@@ -0,0 +1,69 @@
+# vi:filetype=perl
+
+use lib 'lib';
+use Test::Nginx::Socket;
+
+repeat_each(1);
+
+plan tests => repeat_each() * (blocks() * 4 + 15 * 1);
+
+our $http_config = <<'_EOC_';
+    proxy_cache_path  /tmp/ngx_cache_purge_cache keys_zone=test_cache:10m;
+    proxy_temp_path   /tmp/ngx_cache_purge_temp 1 2;
+_EOC_
+
+our $config = <<'_EOC_';
+    location /proxy {
+        proxy_pass                   $scheme://127.0.0.1:$server_port/etc/passwd$is_args$args;
+        proxy_cache                  test_cache;
+        proxy_cache_key              $request_method$uri;
+        proxy_cache_valid            3m;
+        proxy_cache_purge_on_unsafe  on;
+        add_header                   X-Cache-Status $upstream_cache_status;
+    }
+
+    location = /etc/passwd {
+        if ($arg_deny) {
+            return         403;
+        }
+
+        if ($request_method = DELETE) {
+            return         204;
+        }
+
+        root               /;
+    }
+_EOC_
+
+worker_connections(128);
+no_shuffle();
+run_tests();
+
+no_diff();
+
+__DATA__
+
+=== TEST 1: successful unsafe request purges the cached GET
+--- http_config eval: $::http_config
+--- config eval: $::config
+--- pipelined_requests eval
+["GET /proxy/passwd",
+ "GET /proxy/passwd",
+ "DELETE /proxy/passwd?deny=1",
+ "GET /proxy/passwd",
+ "DELETE /proxy/passwd",
+ "GET /proxy/passwd"]
+--- error_code eval
+[200, 200, 403, 200, 204, 200]
+--- response_headers eval
+["Content-Type: text/plain",
+ "X-Cache-Status: HIT",
+ "X-Cache-Status:",
+ "X-Cache-Status: HIT",
+ "X-Cache-Status:",
+ "X-Cache-Status: MISS"]
+--- response_body_like eval
+[qr/root/, qr/root/, qr/403/, qr/root/, qr/^$/, qr/root/]
+--- timeout: 10
+--- no_error_log eval
+qr/\[(warn|error|crit|alert|emerg)\]/
@@ -0,0 +1,935 @@
+/*
+ * Copyright (c) 2009-2014, FRiCKLE <info@frickle.com>
+ * Copyright (c) 2009-2014, Piotr Sikora <piotr.sikora@frickle.com>
+ * All rights reserved.
+ *
+ * This project was fully funded by yo.se.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Load generator of the purge benchmark: keeps a number of keep-alive
+ * connections busy with one workload, records the latency of every
+ * request and, on a separate connection, of a cheap probe request sent
+ * every few milliseconds, which is delayed by as much as the event loop
+ * of the worker process is stalled.  Results are printed as a single
+ * line of JSON.
+ *
+ * Purges recorded in an access log can be replayed at their original
+ * pace, or a multiple of it.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define CPB_MAX_CONNECTIONS  1024
+#define CPB_BUF              16384
+#define CPB_PROBE_INTERVAL   10000000    /* ns */
+
+
+typedef enum {
+    CPB_POPULATE = 0,
+    CPB_HIT,
+    CPB_MISS,
+    CPB_RACE,
+    CPB_REPLAY
+} cpb_workload_e;
+
+typedef struct {
+    int                           fd;
+    int                           busy;     /* request in flight */
+    uint64_t                      start;    /* ns */
+
+    char                          out[1024];
+    size_t                        out_len;
+    size_t                        out_sent;
+
+    char                          in[CPB_BUF];
+    size_t                        in_len;
+} cpb_conn_t;
+
+typedef struct {
+    uint64_t                     *values;
+    size_t                        n;
+    size_t                        alloc;
+} cpb_samples_t;
+
+typedef struct {
+    uint64_t                      offset;   /* ns since the first purge */
+    char                         *uri;
+} cpb_purge_t;
+
+
+static const char                *cpb_workloads[] = {
+    "populate", "hit", "miss", "race", "replay"
+};
+
+static const char                *cpb_months[] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static struct sockaddr_in         cpb_addr;
+static const char                *cpb_host = "localhost";
+static const char                *cpb_prefix = "/bench/";
+static const char                *cpb_probe_uri = "/bench-ping";
+static const char                *cpb_method = "PURGE";
+static int                        cpb_prefix_set;
+
+static cpb_purge_t               *cpb_purges;
+static uint64_t                   cpb_npurges;
+static double                     cpb_scale = 1.0;
+
+static cpb_samples_t              cpb_latency;
+static cpb_samples_t              cpb_stall;
+
+static uint64_t                   cpb_status[6];   /* 2xx-5xx, 412, other */
+static uint64_t                   cpb_errors;
+
+
+static void
+cpb_usage(void)
+{
+    fprintf(stderr,
+            "usage: ngx_cache_purge_bench [-a addr:port] [-c connections]"
+            " [-n requests]\n"
+            "           [-k keys] [-s start] [-m method] [-u prefix]"
+            " [-p probe]\n"
+            "           [-f log] [-x scale] workload\n"
+            "  -a addr:port    nginx to benchmark (default: 127.0.0.1:8080)\n"
+            "  -c connections  concurrent connections (default: 16)\n"
+            "  -n requests     requests to send (default: 100000)\n"
+            "  -k keys         keys populated in the cache (default:"
+            " 1000000)\n"
+            "  -s start        first key to use (default: 0)\n"
+            "  -m method       purge method (default: PURGE)\n"
+            "  -u prefix       URI prefix of keys (default: /bench/)\n"
+            "  -p probe        URI of the stall probe (default:"
+            " /bench-ping),\n"
+            "                  \"off\" disables it\n"
+            "  -f log          access log to replay purges from\n"
+            "  -x scale        pace of the replay, e.g. 2 for twice as"
+            " fast,\n"
+            "                  0 for as fast as possible (default: 1)\n"
+            "workloads:\n"
+            "  populate        GET keys start..start+requests into the"
+            " cache\n"
+            "  hit             purge keys start..start+requests, once each\n"
+            "  miss            purge keys which aren't cached\n"
+            "  race            purge each key on all connections at once\n"
+            "  replay          purge URIs of the log with the method given,"
+            " and\n"
+            "                  the prefix if one is given\n");
+}
+
+
+static uint64_t
+cpb_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static int
+cpb_sample(cpb_samples_t *s, uint64_t value)
+{
+    uint64_t  *values;
+
+    if (s->n == s->alloc) {
+        s->alloc = s->alloc ? s->alloc * 2 : 65536;
+
+        values = realloc(s->values, s->alloc * sizeof(uint64_t));
+        if (values == NULL) {
+            return -1;
+        }
+
+        s->values = values;
+    }
+
+    s->values[s->n++] = value;
+
+    return 0;
+}
+
+
+static int
+cpb_cmp(const void *one, const void *two)
+{
+    uint64_t  a = *(const uint64_t *) one;
+    uint64_t  b = *(const uint64_t *) two;
+
+    return (a > b) - (a < b);
+}
+
+
+static uint64_t
+cpb_percentile(cpb_samples_t *s, double q)
+{
+    if (s->n == 0) {
+        return 0;
+    }
+
+    /* samples are sorted by the caller, in microseconds */
+
+    return s->values[(size_t) (q * (s->n - 1))] / 1000;
+}
+
+
+/*
+ * Based on: ngx_parse_time.c/ngx_http_parse_time
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+static int64_t
+cpb_time(const char *p)
+{
+    int64_t  days;
+    long     off;
+    char     mon[4];
+    int      i, n, year, month, day, hour, min, sec;
+
+    /* $time_local, e.g. "10/Oct/2014:13:55:36 -0700" */
+
+    n = 0;
+
+    if (sscanf(p, "%2d/%3s/%4d:%2d:%2d:%2d %n",
+               &day, mon, &year, &hour, &min, &sec, &n)
+        != 6
+        || n == 0)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < 12; i++) {
+        if (strcmp(mon, cpb_months[i]) == 0) {
+            break;
+        }
+    }
+
+    if (i == 12) {
+        return -1;
+    }
+
+    month = i;
+
+    off = strtol(p + n + 1, NULL, 10);
+    off = (off / 100) * 3600 + (off % 100) * 60;
+
+    if (p[n] == '-') {
+        off = -off;
+    }
+
+    if (--month <= 0) {
+        month += 12;
+        year -= 1;
+    }
+
+    /* Gauss' formula for Gregorian days since March 1, 1 BC */
+
+    days = 365 * (int64_t) year + year / 4 - year / 100 + year / 400
+           + 367 * month / 12 - 30 + day - 1
+           - 719527 + 31 + 28;
+
+    return days * 86400 + hour * 3600 + min * 60 + sec - off;
+}
+
+
+static int
+cpb_load(const char *file)
+{
+    cpb_purge_t  *purges, *pr;
+    uint64_t      alloc, i, j, k;
+    int64_t       t, first, last, *times;
+    size_t        len;
+    char          line[16384], *p, *uri, *end;
+    FILE         *f;
+
+    f = fopen(file, "r");
+    if (f == NULL) {
+        fprintf(stderr, "ngx_cache_purge_bench: fopen() \"%s\" failed: %s\n",
+                file, strerror(errno));
+        return -1;
+    }
+
+    alloc = 0;
+    times = NULL;
+    first = -1;
+    last = 0;
+    len = strlen(cpb_method);
+
+    while (fgets(line, sizeof(line), f)) {
+
+        /* '... [$time_local] "$request" ...', as in the "combined" format */
+
+        p = strchr(line, '[');
+        if (p == NULL || (t = cpb_time(p + 1)) == -1) {
+            continue;
+        }
+
+        p = strchr(p, '"');
+        if (p == NULL || strncmp(p + 1, cpb_method, len) != 0
+            || p[len + 1] != ' ')
+        {
+            continue;
+        }
+
+        uri = p + len + 2;
+
+        end = strpbrk(uri, " \"");
+        if (end == NULL) {
+            continue;
+        }
+
+        *end = '\0';
+
+        if (cpb_prefix_set && strncmp(uri, cpb_prefix, strlen(cpb_prefix))) {
+            continue;
+        }
+
+        if (cpb_npurges == alloc) {
+            alloc = alloc ? alloc * 2 : 65536;
+
+            purges = realloc(cpb_purges, alloc * sizeof(cpb_purge_t));
+            times = realloc(times, alloc * sizeof(int64_t));
+
+            if (purges == NULL || times == NULL) {
+                goto nomem;
+            }
+
+            cpb_purges = purges;
+        }
+
+        /* lines are written once requests are done, not quite in order */
+
+        if (first == -1) {
+            first = t;
+        }
+
+        if (t < last) {
+            t = last;
+        }
+
+        last = t;
+
+        pr = &cpb_purges[cpb_npurges];
+
+        pr->uri = strdup(uri);
+        if (pr->uri == NULL) {
+            goto nomem;
+        }
+
+        times[cpb_npurges++] = t - first;
+    }
+
+    fclose(f);
+
+    /* purges logged within the same second are spread over it */
+
+    for (i = 0; i < cpb_npurges; i = j) {
+
+        for (j = i + 1; j < cpb_npurges && times[j] == times[i]; j++) {
+            /* void */
+        }
+
+        for (k = i; k < j; k++) {
+            cpb_purges[k].offset = times[k] * 1000000000
+                                   + (k - i) * 1000000000 / (j - i);
+        }
+    }
+
+    free(times);
+
+    return 0;
+
+nomem:
+
+    fprintf(stderr, "ngx_cache_purge_bench: out of memory\n");
+    fclose(f);
+
+    return -1;
+}
+
+
+static int
+cpb_connect(cpb_conn_t *c)
+{
+    int  fd, one;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("ngx_cache_purge_bench: socket()");
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *) &cpb_addr, sizeof(cpb_addr)) == -1) {
+        perror("ngx_cache_purge_bench: connect()");
+        close(fd);
+        return -1;
+    }
+
+    one = 1;
+    (void) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1) {
+        perror("ngx_cache_purge_bench: fcntl()");
+        close(fd);
+        return -1;
+    }
+
+    c->fd = fd;
+    c->busy = 0;
+    c->in_len = 0;
+
+    return 0;
+}
+
+
+static int
+cpb_send(cpb_conn_t *c, const char *method, const char *uri, uint64_t key,
+    int numbered)
+{
+    ssize_t  n;
+
+    if (numbered) {
+        c->out_len = snprintf(c->out, sizeof(c->out),
+                              "%s %s%llu HTTP/1.1\r\nHost: %s\r\n\r\n",
+                              method, uri, (unsigned long long) key,
+                              cpb_host);
+    } else {
+        c->out_len = snprintf(c->out, sizeof(c->out),
+                              "%s %s HTTP/1.1\r\nHost: %s\r\n\r\n",
+                              method, uri, cpb_host);
+    }
+
+    if (c->out_len >= sizeof(c->out)) {
+        fprintf(stderr, "ngx_cache_purge_bench: request too long\n");
+        return -1;
+    }
+
+    c->out_sent = 0;
+    c->in_len = 0;
+    c->busy = 1;
+    c->start = cpb_now();
+
+    n = send(c->fd, c->out, c->out_len, 0);
+
+    if (n == -1) {
+        if (errno == EAGAIN || errno == EINTR) {
+            return 0;
+        }
+
+        perror("ngx_cache_purge_bench: send()");
+        return -1;
+    }
+
+    c->out_sent = n;
+
+    return 0;
+}
+
+
+/*
+ * Returns the status once the whole response is read, 0 if it isn't yet
+ * and -1 on errors.  Responses are expected with "Content-Length" or in
+ * chunks, one at a time.
+ */
+
+static int
+cpb_response(cpb_conn_t *c, int *closed)
+{
+    char    *p, *end, *h;
+    size_t   header, length;
+    int      status;
+
+    c->in[c->in_len] = '\0';
+
+    end = strstr(c->in, "\r\n\r\n");
+    if (end == NULL) {
+        return (c->in_len == sizeof(c->in) - 1) ? -1 : 0;
+    }
+
+    header = end + 4 - c->in;
+
+    if (c->in_len < 12 || strncmp(c->in, "HTTP/1.", 7) != 0) {
+        return -1;
+    }
+
+    status = atoi(c->in + 9);
+
+    *closed = 0;
+    length = 0;
+
+    for (h = strstr(c->in, "\r\n") + 2; h < end; h = p + 2) {
+        p = strstr(h, "\r\n");
+
+        if (strncasecmp(h, "Content-Length:", 15) == 0) {
+            length = strtoul(h + 15, NULL, 10);
+
+        } else if (strncasecmp(h, "Transfer-Encoding:", 18) == 0) {
+            /* the last chunk ends the response */
+            if (strstr(c->in + header - 2, "\r\n0\r\n\r\n") == NULL) {
+                return 0;
+            }
+
+        } else if (strncasecmp(h, "Connection: close", 17) == 0) {
+            *closed = 1;
+        }
+    }
+
+    if (c->in_len < header + length) {
+        return 0;
+    }
+
+    return status;
+}
+
+
+static void
+cpb_status_add(int status)
+{
+    if (status < 200 || status >= 600) {
+        cpb_status[5]++;
+        return;
+    }
+
+    cpb_status[status / 100 - 2]++;
+
+    /* purges of keys not cached, counted among 4xx too */
+
+    if (status == 412) {
+        cpb_status[4]++;
+    }
+}
+
+
+static int
+cpb_run(cpb_workload_e workload, cpb_conn_t *conns, int nconns,
+    cpb_conn_t *probe, uint64_t requests, uint64_t keys, uint64_t start)
+{
+    struct pollfd  pfd[CPB_MAX_CONNECTIONS + 1];
+    cpb_conn_t    *c;
+    cpb_purge_t   *pr;
+    uint64_t       sent, done, key, now, next_probe, begin;
+    ssize_t        n;
+    int            i, status, closed, timeout, idle;
+
+    sent = 0;
+    done = 0;
+    begin = cpb_now();
+    next_probe = begin;
+
+    while (done < requests) {
+
+        now = cpb_now();
+
+        /* races start once all the connections are done with a key */
+
+        idle = 0;
+
+        for (i = 0; i < nconns; i++) {
+            idle += !conns[i].busy;
+        }
+
+        for (i = 0; i < nconns && sent < requests; i++) {
+            c = &conns[i];
+
+            if (c->busy || (workload == CPB_RACE && idle != nconns)) {
+                continue;
+            }
+
+            if (workload == CPB_REPLAY) {
+                pr = &cpb_purges[sent];
+
+                /* not due yet, or delayed by purges still in flight */
+
+                if (cpb_scale > 0 && now - begin < pr->offset / cpb_scale) {
+                    break;
+                }
+
+                if (cpb_send(c, cpb_method, pr->uri, 0, 0) != 0) {
+                    return -1;
+                }
+
+                sent++;
+                continue;
+            }
+
+            switch (workload) {
+
+            case CPB_HIT:
+            case CPB_POPULATE:
+                key = start + sent;
+                break;
+
+            case CPB_MISS:
+                key = keys + start + sent;
+                break;
+
+            default: /* CPB_RACE */
+                key = start + sent / nconns;
+                break;
+            }
+
+            if (cpb_send(c, (workload == CPB_POPULATE) ? "GET" : cpb_method,
+                         cpb_prefix, key, 1)
+                != 0)
+            {
+                return -1;
+            }
+
+            sent++;
+        }
+
+        if (probe && !probe->busy && now >= next_probe) {
+            if (cpb_send(probe, "GET", cpb_probe_uri, 0, 0) != 0) {
+                return -1;
+            }
+
+            next_probe = now + CPB_PROBE_INTERVAL;
+        }
+
+        for (i = 0; i < nconns; i++) {
+            pfd[i].fd = conns[i].fd;
+            pfd[i].events = POLLIN;
+
+            if (conns[i].out_sent < conns[i].out_len) {
+                pfd[i].events |= POLLOUT;
+            }
+        }
+
+        if (probe) {
+            pfd[nconns].fd = probe->fd;
+            pfd[nconns].events = POLLIN;
+        }
+
+        timeout = probe ? 1 : 1000;
+
+        if (poll(pfd, nconns + (probe != NULL), timeout) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            perror("ngx_cache_purge_bench: poll()");
+            return -1;
+        }
+
+        for (i = 0; i < nconns + (probe != NULL); i++) {
+            c = (i < nconns) ? &conns[i] : probe;
+
+            if (pfd[i].revents & POLLOUT) {
+                n = send(c->fd, c->out + c->out_sent,
+                         c->out_len - c->out_sent, 0);
+                if (n > 0) {
+                    c->out_sent += n;
+                }
+            }
+
+            if (!(pfd[i].revents & (POLLIN|POLLHUP|POLLERR))) {
+                continue;
+            }
+
+            n = recv(c->fd, c->in + c->in_len, sizeof(c->in) - 1 - c->in_len,
+                     0);
+
+            if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+                continue;
+            }
+
+            closed = 0;
+            status = -1;
+
+            if (n > 0) {
+                c->in_len += n;
+                status = cpb_response(c, &closed);
+
+                if (status == 0) {
+                    continue;
+                }
+            }
+
+            if (c->busy) {
+                c->busy = 0;
+
+                if (c == probe) {
+                    if (status > 0
+                        && cpb_sample(&cpb_stall, cpb_now() - c->start) != 0)
+                    {
+                        return -1;
+                    }
+
+                } else {
+                    done++;
+
+                    if (status > 0) {
+                        cpb_status_add(status);
+
+                        if (cpb_sample(&cpb_latency, cpb_now() - c->start)
+                            != 0)
+                        {
+                            return -1;
+                        }
+
+                    } else {
+                        cpb_errors++;
+                    }
+                }
+            }
+
+            if (status < 0 || closed) {
+                close(c->fd);
+
+                if (cpb_connect(c) != 0) {
+                    return -1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    cpb_conn_t      *conns, probe;
+    cpb_workload_e   workload;
+    uint64_t         requests, keys, start, begin, elapsed;
+    double           seconds;
+    const char      *log;
+    char            *p;
+    int              c, i, nconns, use_probe, requests_set;
+
+    cpb_addr.sin_family = AF_INET;
+    cpb_addr.sin_port = htons(8080);
+    cpb_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    nconns = 16;
+    requests = 100000;
+    keys = 1000000;
+    start = 0;
+    use_probe = 1;
+
+    log = NULL;
+    requests_set = 0;
+
+    while ((c = getopt(argc, argv, "a:c:n:k:s:m:u:p:f:x:h")) != -1) {
+        switch (c) {
+
+        case 'a':
+            p = strrchr(optarg, ':');
+            if (p == NULL) {
+                goto invalid;
+            }
+
+            *p = '\0';
+            cpb_host = optarg;
+
+            if (inet_pton(AF_INET, optarg, &cpb_addr.sin_addr) != 1
+                || atoi(p + 1) < 1 || atoi(p + 1) > 65535)
+            {
+                *p = ':';
+                goto invalid;
+            }
+
+            cpb_addr.sin_port = htons(atoi(p + 1));
+            break;
+
+        case 'c':
+            nconns = atoi(optarg);
+            if (nconns < 1 || nconns > CPB_MAX_CONNECTIONS) {
+                goto invalid;
+            }
+            break;
+
+        case 'n':
+            requests = strtoull(optarg, NULL, 10);
+            requests_set = 1;
+            break;
+
+        case 'k':
+            keys = strtoull(optarg, NULL, 10);
+            break;
+
+        case 's':
+            start = strtoull(optarg, NULL, 10);
+            break;
+
+        case 'm':
+            cpb_method = optarg;
+            break;
+
+        case 'u':
+            cpb_prefix = optarg;
+            cpb_prefix_set = 1;
+            break;
+
+        case 'p':
+            if (strcmp(optarg, "off") == 0) {
+                use_probe = 0;
+            } else {
+                cpb_probe_uri = optarg;
+            }
+            break;
+
+        case 'f':
+            log = optarg;
+            break;
+
+        case 'x':
+            cpb_scale = strtod(optarg, NULL);
+            if (cpb_scale < 0) {
+                goto invalid;
+            }
+            break;
+
+        default:
+            cpb_usage();
+            return 2;
+        }
+    }
+
+    if (optind != argc - 1) {
+        cpb_usage();
+        return 2;
+    }
+
+    for (i = 0; i < (int) (sizeof(cpb_workloads) / sizeof(char *)); i++) {
+        if (strcmp(argv[optind], cpb_workloads[i]) == 0) {
+            break;
+        }
+    }
+
+    if (i == (int) (sizeof(cpb_workloads) / sizeof(char *))) {
+        cpb_usage();
+        return 2;
+    }
+
+    workload = (cpb_workload_e) i;
+
+    if ((workload == CPB_REPLAY) != (log != NULL)) {
+        cpb_usage();
+        return 2;
+    }
+
+    if (workload == CPB_REPLAY) {
+        if (cpb_load(log) != 0) {
+            return 1;
+        }
+
+        if (!requests_set || requests > cpb_npurges) {
+            requests = cpb_npurges;
+        }
+    }
+
+    if (workload == CPB_RACE) {
+        /* every key is purged once on each connection */
+        requests -= requests % nconns;
+    }
+
+    conns = calloc(nconns, sizeof(cpb_conn_t));
+    if (conns == NULL) {
+        fprintf(stderr, "ngx_cache_purge_bench: out of memory\n");
+        return 1;
+    }
+
+    for (i = 0; i < nconns; i++) {
+        if (cpb_connect(&conns[i]) != 0) {
+            return 1;
+        }
+    }
+
+    if (use_probe && cpb_connect(&probe) != 0) {
+        return 1;
+    }
+
+    begin = cpb_now();
+
+    if (cpb_run(workload, conns, nconns, use_probe ? &probe : NULL,
+                requests, keys, start)
+        != 0)
+    {
+        return 1;
+    }
+
+    elapsed = cpb_now() - begin;
+    seconds = elapsed / 1000000000.0;
+
+    qsort(cpb_latency.values, cpb_latency.n, sizeof(uint64_t), cpb_cmp);
+    qsort(cpb_stall.values, cpb_stall.n, sizeof(uint64_t), cpb_cmp);
+
+    printf("{\"workload\":\"%s\",\"connections\":%d,\"requests\":%llu,"
+           "\"seconds\":%.3f,\"rps\":%.1f,"
+           "\"status\":{\"2xx\":%llu,\"3xx\":%llu,\"4xx\":%llu,\"5xx\":%llu,"
+           "\"412\":%llu,\"other\":%llu},\"errors\":%llu,"
+           "\"latency_us\":{\"p50\":%llu,\"p99\":%llu,\"p999\":%llu,"
+           "\"max\":%llu},"
+           "\"stall_us\":{\"samples\":%llu,\"p50\":%llu,\"p99\":%llu,"
+           "\"p999\":%llu,\"max\":%llu}}\n",
+           cpb_workloads[workload], nconns, (unsigned long long) requests,
+           seconds, seconds > 0 ? requests / seconds : 0.0,
+           (unsigned long long) cpb_status[0],
+           (unsigned long long) cpb_status[1],
+           (unsigned long long) cpb_status[2],
+           (unsigned long long) cpb_status[3],
+           (unsigned long long) cpb_status[4],
+           (unsigned long long) cpb_status[5],
+           (unsigned long long) cpb_errors,
+           (unsigned long long) cpb_percentile(&cpb_latency, 0.5),
+           (unsigned long long) cpb_percentile(&cpb_latency, 0.99),
+           (unsigned long long) cpb_percentile(&cpb_latency, 0.999),
+           (unsigned long long) cpb_percentile(&cpb_latency, 1.0),
+           (unsigned long long) cpb_stall.n,
+           (unsigned long long) cpb_percentile(&cpb_stall, 0.5),
+           (unsigned long long) cpb_percentile(&cpb_stall, 0.99),
+           (unsigned long long) cpb_percentile(&cpb_stall, 0.999),
+           (unsigned long long) cpb_percentile(&cpb_stall, 1.0));
+
+    return cpb_errors ? 1 : 0;
+
+invalid:
+
+    fprintf(stderr, "ngx_cache_purge_bench: invalid value \"%s\" of -%c\n",
+            optarg, c);
+
+    return 2;
+}
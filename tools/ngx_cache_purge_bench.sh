@@ -0,0 +1,113 @@
+#!/bin/sh
+#
+# Purge benchmark: starts nginx with a synthetic cache zone of $KEYS
+# entries, populated through nginx itself, and runs the workloads of
+# ngx_cache_purge_bench against it.  Results are printed as one line of
+# JSON for each workload, after a line describing the run.
+#
+#   NGINX        nginx binary built with the module (default: nginx)
+#   KEYS         entries of the cache zone (default: 1000000)
+#   REQUESTS     requests of each workload (default: 100000)
+#   CONNECTIONS  concurrent connections (default: 16)
+#   PORT         port of nginx, the origin uses the next one (default: 18080)
+#   DIR          directory for the cache and logs (default: a temporary one,
+#                removed afterwards)
+#
+
+set -e
+
+NGINX=${NGINX:-nginx}
+KEYS=${KEYS:-1000000}
+REQUESTS=${REQUESTS:-100000}
+CONNECTIONS=${CONNECTIONS:-16}
+PORT=${PORT:-18080}
+
+BENCH="$(cd "$(dirname "$0")" && pwd)/ngx_cache_purge_bench"
+
+if [ $((REQUESTS * 2)) -gt "$KEYS" ]; then
+    echo "ngx_cache_purge_bench.sh: KEYS has to be at least 2 * REQUESTS" >&2
+    exit 2
+fi
+
+if [ -z "$DIR" ]; then
+    DIR=$(mktemp -d /tmp/ngx_cache_purge_bench.XXXXXX)
+    trap 'stop; rm -rf "$DIR"' EXIT
+else
+    mkdir -p "$DIR"
+    trap 'stop' EXIT
+fi
+
+stop() {
+    if [ -f "$DIR/logs/nginx.pid" ]; then
+        kill "$(cat "$DIR/logs/nginx.pid")" 2>/dev/null || true
+        sleep 1
+    fi
+}
+
+mkdir -p "$DIR/logs" "$DIR/cache" "$DIR/temp"
+
+# about 256 bytes of the keys zone for each entry
+
+cat > "$DIR/nginx.conf" <<EOC
+worker_processes  1;
+error_log         logs/error.log;
+pid               logs/nginx.pid;
+
+events {
+    worker_connections  4096;
+}
+
+http {
+    access_log  off;
+
+    proxy_cache_path  $DIR/cache levels=1:2 inactive=1d
+                      keys_zone=bench:$((KEYS / 4096 + 16))m;
+    proxy_temp_path   $DIR/temp;
+
+    server {
+        listen  127.0.0.1:$PORT;
+
+        location /bench/ {
+            proxy_pass         http://127.0.0.1:$((PORT + 1));
+            proxy_cache        bench;
+            proxy_cache_key    \$uri;
+            proxy_cache_valid  1d;
+            proxy_cache_purge  PURGE from 127.0.0.1;
+        }
+
+        location = /bench-ping {
+            return  204;
+        }
+    }
+
+    server {
+        listen  127.0.0.1:$((PORT + 1));
+
+        location / {
+            return  200 "\$uri\n";
+        }
+    }
+}
+EOC
+
+"$NGINX" -p "$DIR" -c nginx.conf
+
+sleep 1
+
+VERSION=$("$NGINX" -v 2>&1 | sed 's/.*nginx\///')
+REVISION=$(git -C "$(dirname "$0")" rev-parse --short HEAD 2>/dev/null \
+           || echo unknown)
+
+printf '{"nginx":"%s","revision":"%s","date":"%s","keys":%s,"requests":%s,' \
+       "$VERSION" "$REVISION" "$(date -u +%Y-%m-%dT%H:%M:%SZ)" \
+       "$KEYS" "$REQUESTS"
+printf '"connections":%s}\n' "$CONNECTIONS"
+
+B="$BENCH -a 127.0.0.1:$PORT -c $CONNECTIONS -k $KEYS"
+
+# keys 0..REQUESTS-1 are purged by hits, the next ones by races
+
+$B -n "$KEYS" populate
+$B -n "$REQUESTS" hit
+$B -n "$REQUESTS" miss
+$B -n "$REQUESTS" -s "$REQUESTS" race
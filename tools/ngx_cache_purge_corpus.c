@@ -0,0 +1,641 @@
+/*
+ * Copyright (c) 2009-2014, FRiCKLE <info@frickle.com>
+ * Copyright (c) 2009-2014, Piotr Sikora <piotr.sikora@frickle.com>
+ * All rights reserved.
+ *
+ * This project was fully funded by yo.se.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Generates a cache directory as written by proxy_cache of nginx-1.7.3+:
+ * files named by MD5 of their keys in "levels=" subdirectories, each with
+ * the fixed header, the "KEY:" line, a response header and a body of
+ * a size drawn from the given distribution.  The cache loader picks the
+ * entries up as if they were cached by nginx itself.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define CPC_KEY_LEN        16
+#define CPC_MAX_LEVELS     3
+#define CPC_CACHE_VERSION  3    /* NGX_HTTP_CACHE_VERSION */
+
+
+/*
+ * Based on: ngx_http_cache.h/ngx_http_file_cache_header_t (nginx-1.7.3+)
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+typedef struct {
+    unsigned long                 version;
+    time_t                        valid_sec;
+    time_t                        last_modified;
+    time_t                        date;
+    uint32_t                      crc32;
+    unsigned short                valid_msec;
+    unsigned short                header_start;
+    unsigned short                body_start;
+    unsigned char                 etag_len;
+    unsigned char                 etag[42];
+    unsigned char                 vary_len;
+    unsigned char                 vary[42];
+    unsigned char                 variant[CPC_KEY_LEN];
+} cpc_cache_header_t;
+
+typedef struct {
+    uint32_t                      a, b, c, d;
+    uint32_t                      block[16];
+} cpc_md5_t;
+
+
+static size_t                     cpc_levels[CPC_MAX_LEVELS];
+static size_t                     cpc_nlevels;
+
+static uint32_t                   cpc_crc32_table[256];
+
+static unsigned char              cpc_body[65536];
+
+
+static void
+cpc_usage(void)
+{
+    fprintf(stderr,
+            "usage: ngx_cache_purge_corpus [-n entries] [-l levels]"
+            " [-k key] [-s size]\n"
+            "           [-d distribution] [-v valid] [-r seed] path\n"
+            "  -n entries       number of cache files (default: 100000)\n"
+            "  -l levels        \"levels=\" of proxy_cache_path, e.g. 1:2\n"
+            "  -k key           key of each entry, with %%llu replaced by"
+            " its number\n"
+            "                   (default: /bench/%%llu)\n"
+            "  -s size          body size, or min-max range, with k or m"
+            " suffix\n"
+            "                   (default: 1k-1m)\n"
+            "  -d distribution  of sizes in the range: uniform or log"
+            " (default: log)\n"
+            "  -v valid         seconds entries stay valid (default:"
+            " 86400)\n"
+            "  -r seed          seed of sizes (default: 1)\n");
+}
+
+
+static int
+cpc_parse_levels(char *p)
+{
+    char  *last;
+    long   n;
+
+    cpc_nlevels = 0;
+
+    for ( ;; ) {
+        n = strtol(p, &last, 10);
+
+        if (last == p || n < 1 || n > 2 || cpc_nlevels == CPC_MAX_LEVELS) {
+            return -1;
+        }
+
+        cpc_levels[cpc_nlevels++] = n;
+
+        if (*last == '\0') {
+            return 0;
+        }
+
+        if (*last != ':') {
+            return -1;
+        }
+
+        p = last + 1;
+    }
+}
+
+
+static int
+cpc_parse_size(char *p, char **last, uint64_t *size)
+{
+    unsigned long long  n;
+
+    n = strtoull(p, last, 10);
+
+    if (*last == p) {
+        return -1;
+    }
+
+    switch (**last) {
+
+    case 'k':
+    case 'K':
+        n *= 1024;
+        (*last)++;
+        break;
+
+    case 'm':
+    case 'M':
+        n *= 1024 * 1024;
+        (*last)++;
+        break;
+    }
+
+    *size = n;
+
+    return 0;
+}
+
+
+/*
+ * CRC-32 as ngx_crc32_short(), checked against the key when the entry
+ * is read
+ */
+
+static void
+cpc_crc32_init(void)
+{
+    uint32_t  c;
+    int       i, k;
+
+    for (i = 0; i < 256; i++) {
+        c = i;
+
+        for (k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        }
+
+        cpc_crc32_table[i] = c;
+    }
+}
+
+
+static uint32_t
+cpc_crc32(const void *data, size_t len)
+{
+    const unsigned char  *p = data;
+    uint32_t              crc;
+
+    crc = 0xffffffff;
+
+    while (len--) {
+        crc = cpc_crc32_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc ^ 0xffffffff;
+}
+
+
+/*
+ * MD5 of RFC 1321, as ngx_md5_*() for keys of cache files
+ */
+
+#define CPC_ROTATE(x, n)  (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void
+cpc_md5_block(cpc_md5_t *ctx, const unsigned char *p)
+{
+    static const uint32_t  k[64] = {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf,
+        0x4787c62a, 0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af,
+        0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e,
+        0x49b40821, 0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+        0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8, 0x21e1cde6,
+        0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+        0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122,
+        0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+        0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039,
+        0xe6db99e5, 0x1fa27cf8, 0xc4ac5665, 0xf4292244, 0x432aff97,
+        0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d,
+        0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+        0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+    };
+
+    static const unsigned char  r[16] = {
+        7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21
+    };
+
+    uint32_t  a, b, c, d, f, t, *x;
+    int       i, g;
+
+    x = ctx->block;
+
+    for (i = 0; i < 16; i++) {
+        x[i] = (uint32_t) p[i * 4] | (uint32_t) p[i * 4 + 1] << 8
+               | (uint32_t) p[i * 4 + 2] << 16 | (uint32_t) p[i * 4 + 3] << 24;
+    }
+
+    a = ctx->a;
+    b = ctx->b;
+    c = ctx->c;
+    d = ctx->d;
+
+    for (i = 0; i < 64; i++) {
+
+        switch (i / 16) {
+
+        case 0:
+            f = (b & c) | (~b & d);
+            g = i;
+            break;
+
+        case 1:
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) % 16;
+            break;
+
+        case 2:
+            f = b ^ c ^ d;
+            g = (3 * i + 5) % 16;
+            break;
+
+        default:
+            f = c ^ (b | ~d);
+            g = (7 * i) % 16;
+            break;
+        }
+
+        t = d;
+        d = c;
+        c = b;
+        b += CPC_ROTATE(a + f + k[i] + x[g], r[(i / 16) * 4 + i % 4]);
+        a = t;
+    }
+
+    ctx->a += a;
+    ctx->b += b;
+    ctx->c += c;
+    ctx->d += d;
+}
+
+
+static void
+cpc_md5(unsigned char *result, const unsigned char *data, size_t len)
+{
+    cpc_md5_t      ctx;
+    unsigned char  buf[128];
+    uint64_t       bits;
+    size_t         i, n;
+
+    ctx.a = 0x67452301;
+    ctx.b = 0xefcdab89;
+    ctx.c = 0x98badcfe;
+    ctx.d = 0x10325476;
+
+    bits = (uint64_t) len * 8;
+
+    for ( /* void */ ; len >= 64; data += 64, len -= 64) {
+        cpc_md5_block(&ctx, data);
+    }
+
+    /* the rest, the padding and the length in bits */
+
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, data, len);
+    buf[len] = 0x80;
+
+    n = (len < 56) ? 64 : 128;
+
+    for (i = 0; i < 8; i++) {
+        buf[n - 8 + i] = (unsigned char) (bits >> (i * 8));
+    }
+
+    cpc_md5_block(&ctx, buf);
+
+    if (n == 128) {
+        cpc_md5_block(&ctx, buf + 64);
+    }
+
+    for (i = 0; i < 4; i++) {
+        result[i] = (unsigned char) (ctx.a >> (i * 8));
+        result[i + 4] = (unsigned char) (ctx.b >> (i * 8));
+        result[i + 8] = (unsigned char) (ctx.c >> (i * 8));
+        result[i + 12] = (unsigned char) (ctx.d >> (i * 8));
+    }
+}
+
+
+/*
+ * Based on: ngx_file.c/ngx_create_hashed_filename
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+static int
+cpc_path(char *path, size_t len, const char *name)
+{
+    size_t  i, n, end;
+
+    /* levels are taken from the end of the name, each made if needed */
+
+    end = 2 * CPC_KEY_LEN;
+
+    for (i = 0; i < cpc_nlevels; i++) {
+        n = cpc_levels[i];
+        end -= n;
+
+        path[len++] = '/';
+        memcpy(&path[len], &name[end], n);
+        len += n;
+        path[len] = '\0';
+
+        if (mkdir(path, 0700) == -1 && errno != EEXIST) {
+            fprintf(stderr, "ngx_cache_purge_corpus: mkdir() \"%s\""
+                    " failed: %s\n", path, strerror(errno));
+            return -1;
+        }
+    }
+
+    path[len++] = '/';
+    memcpy(&path[len], name, 2 * CPC_KEY_LEN + 1);
+
+    return 0;
+}
+
+
+static int
+cpc_file(const char *path, const char *key, uint64_t size, time_t now,
+    time_t valid)
+{
+    cpc_cache_header_t  *h;
+    unsigned char        buf[8192];
+    size_t               key_len, len, n;
+    int                  fd, rc;
+
+    key_len = strlen(key);
+
+    len = sizeof(cpc_cache_header_t) + sizeof("\nKEY: ") - 1 + key_len + 1;
+
+    if (len + 64 > sizeof(buf)) {
+        fprintf(stderr, "ngx_cache_purge_corpus: key too long\n");
+        return -1;
+    }
+
+    memset(buf, 0, sizeof(cpc_cache_header_t));
+
+    h = (cpc_cache_header_t *) buf;
+
+    h->version = CPC_CACHE_VERSION;
+    h->valid_sec = now + valid;
+    h->last_modified = now - valid;
+    h->date = now;
+    h->crc32 = cpc_crc32(key, key_len);
+    h->header_start = (unsigned short) len;
+
+    sprintf((char *) &buf[sizeof(cpc_cache_header_t)], "\nKEY: %s\n", key);
+
+    /* response header, as received from the upstream */
+
+    n = sprintf((char *) &buf[len],
+                "HTTP/1.1 200 OK\r\nContent-Length: %llu\r\n\r\n",
+                (unsigned long long) size);
+
+    len += n;
+
+    h->body_start = (unsigned short) len;
+
+    fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+
+    if (fd == -1) {
+        fprintf(stderr, "ngx_cache_purge_corpus: open() \"%s\" failed: %s\n",
+                path, strerror(errno));
+        return -1;
+    }
+
+    rc = 0;
+
+    if (write(fd, buf, len) != (ssize_t) len) {
+        goto failed;
+    }
+
+    while (size) {
+        n = (size < sizeof(cpc_body)) ? size : sizeof(cpc_body);
+
+        if (write(fd, cpc_body, n) != (ssize_t) n) {
+            goto failed;
+        }
+
+        size -= n;
+    }
+
+    goto done;
+
+failed:
+
+    fprintf(stderr, "ngx_cache_purge_corpus: write() \"%s\" failed: %s\n",
+            path, strerror(errno));
+    rc = -1;
+
+done:
+
+    close(fd);
+
+    return rc;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    struct timeval       start, end;
+    unsigned long long   n, i;
+    unsigned char        md5[CPC_KEY_LEN];
+    uint64_t             min, max, size, total;
+    const char          *tmpl, *p;
+    char                *path, *last, key[4096], name[2 * CPC_KEY_LEN + 1];
+    size_t               len;
+    time_t               now, valid;
+    long                 seed;
+    int                  c, log_sizes;
+
+    n = 100000;
+    tmpl = "/bench/%llu";
+    min = 1024;
+    max = 1024 * 1024;
+    log_sizes = 1;
+    valid = 86400;
+    seed = 1;
+    cpc_nlevels = 0;
+
+    while ((c = getopt(argc, argv, "n:l:k:s:d:v:r:h")) != -1) {
+        switch (c) {
+
+        case 'n':
+            n = strtoull(optarg, NULL, 10);
+            break;
+
+        case 'l':
+            if (cpc_parse_levels(optarg) != 0) {
+                goto invalid;
+            }
+            break;
+
+        case 'k':
+            /* a single %llu, and no other conversions */
+
+            p = strchr(optarg, '%');
+
+            if (p == NULL || strncmp(p, "%llu", 4) != 0
+                || strchr(p + 4, '%') != NULL)
+            {
+                goto invalid;
+            }
+
+            tmpl = optarg;
+            break;
+
+        case 's':
+            if (cpc_parse_size(optarg, &last, &min) != 0) {
+                goto invalid;
+            }
+
+            max = min;
+
+            if (*last == '-'
+                && cpc_parse_size(last + 1, &last, &max) != 0)
+            {
+                goto invalid;
+            }
+
+            if (*last != '\0' || max < min) {
+                goto invalid;
+            }
+            break;
+
+        case 'd':
+            if (strcmp(optarg, "uniform") == 0) {
+                log_sizes = 0;
+
+            } else if (strcmp(optarg, "log") == 0) {
+                log_sizes = 1;
+
+            } else {
+                goto invalid;
+            }
+            break;
+
+        case 'v':
+            valid = strtol(optarg, NULL, 10);
+            if (valid < 1) {
+                goto invalid;
+            }
+            break;
+
+        case 'r':
+            seed = strtol(optarg, NULL, 10);
+            break;
+
+        default:
+            cpc_usage();
+            return 2;
+        }
+    }
+
+    if (optind != argc - 1) {
+        cpc_usage();
+        return 2;
+    }
+
+    len = strlen(argv[optind]);
+
+    path = malloc(len + CPC_MAX_LEVELS * 3 + 2 * CPC_KEY_LEN + 2);
+    if (path == NULL) {
+        fprintf(stderr, "ngx_cache_purge_corpus: out of memory\n");
+        return 1;
+    }
+
+    memcpy(path, argv[optind], len + 1);
+
+    if (mkdir(path, 0700) == -1 && errno != EEXIST) {
+        fprintf(stderr, "ngx_cache_purge_corpus: mkdir() \"%s\" failed: %s\n",
+                path, strerror(errno));
+        return 1;
+    }
+
+    cpc_crc32_init();
+    memset(cpc_body, 'x', sizeof(cpc_body));
+    srand48(seed);
+
+    gettimeofday(&start, NULL);
+
+    now = time(NULL);
+    total = 0;
+
+    for (i = 0; i < n; i++) {
+
+        if ((size_t) snprintf(key, sizeof(key), tmpl, i) >= sizeof(key)) {
+            fprintf(stderr, "ngx_cache_purge_corpus: key too long\n");
+            return 1;
+        }
+
+        /* a log-uniform distribution makes small responses prevail */
+
+        if (min == max) {
+            size = min;
+
+        } else if (log_sizes) {
+            size = (uint64_t) exp(log(min ? min : 1)
+                                  + drand48() * (log(max) - log(min ? min : 1)));
+
+        } else {
+            size = min + (uint64_t) (drand48() * (max - min + 1));
+        }
+
+        cpc_md5(md5, (unsigned char *) key, strlen(key));
+
+        for (c = 0; c < CPC_KEY_LEN; c++) {
+            sprintf(&name[c * 2], "%02x", md5[c]);
+        }
+
+        if (cpc_path(path, len, name) != 0
+            || cpc_file(path, key, size, now, valid) != 0)
+        {
+            return 1;
+        }
+
+        total += size;
+    }
+
+    gettimeofday(&end, NULL);
+
+    fprintf(stderr, "ngx_cache_purge_corpus: %llu files, %llu bytes of bodies"
+            " in %.3fs\n", n, (unsigned long long) total,
+            (end.tv_sec - start.tv_sec)
+            + (end.tv_usec - start.tv_usec) / 1000000.0);
+
+    return 0;
+
+invalid:
+
+    fprintf(stderr, "ngx_cache_purge_corpus: invalid value \"%s\" of -%c\n",
+            optarg, c);
+
+    return 2;
+}
@@ -0,0 +1,761 @@
+/*
+ * Copyright (c) 2009-2014, FRiCKLE <info@frickle.com>
+ * Copyright (c) 2009-2014, Piotr Sikora <piotr.sikora@frickle.com>
+ * All rights reserved.
+ *
+ * This project was fully funded by yo.se.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Builds the key index of a cache directory without nginx running:
+ * directories are walked by a pool of threads, each cache file is read
+ * only up to the start of its response header, i.e. the fixed header and
+ * the "KEY:" line, and the entries are written sorted by key.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <ngx_http_cache_purge_index.h>
+
+
+#define CPI_KEY_LEN        16
+#define CPI_MAX_LEVELS     3
+#define CPI_MAX_THREADS    256
+
+
+/*
+ * Based on: ngx_http_cache.h/ngx_http_file_cache_header_t (nginx-1.7.3+)
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+typedef struct {
+    unsigned long                 version;
+    time_t                        valid_sec;
+    time_t                        last_modified;
+    time_t                        date;
+    uint32_t                      crc32;
+    unsigned short                valid_msec;
+    unsigned short                header_start;
+    unsigned short                body_start;
+    unsigned char                 etag_len;
+    unsigned char                 etag[42];
+    unsigned char                 vary_len;
+    unsigned char                 vary[42];
+    unsigned char                 variant[CPI_KEY_LEN];
+} cpi_cache_header_t;
+
+typedef struct {
+    char                         *path;
+    size_t                        depth;
+} cpi_dir_t;
+
+typedef struct {
+    pthread_t                     tid;
+
+    ngx_http_cache_purge_index_entry_t  *entries;
+    size_t                        nentries;
+    size_t                        nalloc;
+
+    char                         *keys;
+    size_t                        keys_len;
+    size_t                        keys_alloc;
+
+    uint64_t                      skipped;
+    uint64_t                      errors;
+
+    unsigned char                 buf[65536];
+} cpi_worker_t;
+
+
+static size_t                     cpi_levels[CPI_MAX_LEVELS];
+static size_t                     cpi_nlevels;
+
+static pthread_mutex_t            cpi_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t             cpi_cond = PTHREAD_COND_INITIALIZER;
+static cpi_dir_t                 *cpi_dirs;
+static size_t                     cpi_ndirs;
+static size_t                     cpi_dirs_alloc;
+static size_t                     cpi_active;
+static int                        cpi_failed;
+
+static const char                *cpi_sort_keys;
+
+static uint32_t                   cpi_crc32_table[256];
+
+
+static void
+cpi_usage(void)
+{
+    fprintf(stderr,
+            "usage: ngx_cache_purge_index [-t threads] [-l levels]"
+            " -o index path\n"
+            "  -t threads  number of threads (default: number of CPUs)\n"
+            "  -l levels   \"levels=\" of proxy_cache_path, e.g. 1:2\n"
+            "  -o index    index file to write\n");
+}
+
+
+static int
+cpi_parse_levels(char *p)
+{
+    char  *last;
+    long   n;
+
+    cpi_nlevels = 0;
+
+    for ( ;; ) {
+        n = strtol(p, &last, 10);
+
+        if (last == p || n < 1 || n > 2 || cpi_nlevels == CPI_MAX_LEVELS) {
+            return -1;
+        }
+
+        cpi_levels[cpi_nlevels++] = n;
+
+        if (*last == '\0') {
+            return 0;
+        }
+
+        if (*last != ':') {
+            return -1;
+        }
+
+        p = last + 1;
+    }
+}
+
+
+static int
+cpi_hex(unsigned char *dst, const char *src, size_t len)
+{
+    size_t  i;
+    int     c, n;
+
+    for (i = 0; i < len; i++) {
+        c = src[i];
+
+        if (c >= '0' && c <= '9') {
+            n = c - '0';
+
+        } else if (c >= 'a' && c <= 'f') {
+            n = c - 'a' + 10;
+
+        } else {
+            return -1;
+        }
+
+        if (dst) {
+            if (i & 1) {
+                dst[i / 2] |= n;
+
+            } else {
+                dst[i / 2] = n << 4;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+cpi_push(char *path, size_t depth)
+{
+    cpi_dir_t  *dirs;
+
+    /* cpi_mutex must be locked by the caller */
+
+    if (cpi_ndirs == cpi_dirs_alloc) {
+        cpi_dirs_alloc = cpi_dirs_alloc ? cpi_dirs_alloc * 2 : 256;
+
+        dirs = realloc(cpi_dirs, cpi_dirs_alloc * sizeof(cpi_dir_t));
+        if (dirs == NULL) {
+            return -1;
+        }
+
+        cpi_dirs = dirs;
+    }
+
+    cpi_dirs[cpi_ndirs].path = path;
+    cpi_dirs[cpi_ndirs].depth = depth;
+    cpi_ndirs++;
+
+    pthread_cond_signal(&cpi_cond);
+
+    return 0;
+}
+
+
+static int
+cpi_add(cpi_worker_t *w, const char *name, const char *key, size_t len,
+    uint64_t size)
+{
+    ngx_http_cache_purge_index_entry_t  *e;
+    void                                *p;
+
+    if (w->nentries == w->nalloc) {
+        w->nalloc = w->nalloc ? w->nalloc * 2 : 4096;
+
+        p = realloc(w->entries,
+                    w->nalloc * sizeof(ngx_http_cache_purge_index_entry_t));
+        if (p == NULL) {
+            return -1;
+        }
+
+        w->entries = p;
+    }
+
+    if (w->keys_len + len > w->keys_alloc) {
+        while (w->keys_len + len > w->keys_alloc) {
+            w->keys_alloc = w->keys_alloc ? w->keys_alloc * 2 : 65536;
+        }
+
+        p = realloc(w->keys, w->keys_alloc);
+        if (p == NULL) {
+            return -1;
+        }
+
+        w->keys = p;
+    }
+
+    e = &w->entries[w->nentries++];
+
+    memset(e, 0, sizeof(ngx_http_cache_purge_index_entry_t));
+    (void) cpi_hex(e->hash, name, 2 * CPI_KEY_LEN);
+    e->size = size;
+    e->key = w->keys_len;
+    e->key_len = len;
+
+    memcpy(&w->keys[w->keys_len], key, len);
+    w->keys_len += len;
+
+    return 0;
+}
+
+
+static int
+cpi_file(cpi_worker_t *w, int dfd, const char *name)
+{
+    cpi_cache_header_t  *h;
+    struct stat          st;
+    ssize_t              n;
+    size_t               start, len;
+    uint64_t             size;
+    int                  fd, rc;
+
+    fd = openat(dfd, name, O_RDONLY);
+
+    if (fd == -1) {
+        /* removed by the cache manager in the meantime */
+
+        if (errno != ENOENT) {
+            w->errors++;
+        }
+
+        return 0;
+    }
+
+    rc = 0;
+
+    if (fstat(fd, &st) == -1) {
+        w->errors++;
+        goto done;
+    }
+
+    /* the key is followed by the response header, see header_start */
+
+    n = pread(fd, w->buf, sizeof(w->buf), 0);
+
+    if (n < (ssize_t) (sizeof(cpi_cache_header_t) + sizeof("\nKEY: \n") - 1))
+    {
+        w->skipped++;
+        goto done;
+    }
+
+    h = (cpi_cache_header_t *) w->buf;
+    start = sizeof(cpi_cache_header_t) + sizeof("\nKEY: ") - 1;
+
+    if (memcmp(&w->buf[sizeof(cpi_cache_header_t)], "\nKEY: ",
+               sizeof("\nKEY: ") - 1)
+        != 0
+        || h->header_start <= start
+        || h->header_start > n
+        || w->buf[h->header_start - 1] != '\n')
+    {
+        /* temporary file, or written by another nginx version */
+        w->skipped++;
+        goto done;
+    }
+
+    len = h->header_start - 1 - start;
+
+    /* as ngx_file_fs_size() */
+
+    size = st.st_blocks * 512;
+
+    if (size < (uint64_t) st.st_size) {
+        size = st.st_size;
+    }
+
+    rc = cpi_add(w, name, (char *) &w->buf[start], len, size);
+
+done:
+
+    close(fd);
+
+    return rc;
+}
+
+
+static int
+cpi_dir(cpi_worker_t *w, cpi_dir_t *d)
+{
+    struct dirent  *de;
+    size_t          len, plen;
+    char           *path;
+    DIR            *dir;
+    int             rc;
+
+    dir = opendir(d->path);
+
+    if (dir == NULL) {
+        fprintf(stderr, "ngx_cache_purge_index: opendir(\"%s\") failed: %s\n",
+                d->path, strerror(errno));
+        w->errors++;
+        return 0;
+    }
+
+    rc = 0;
+    plen = strlen(d->path);
+
+    while ((de = readdir(dir)) != NULL) {
+
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+
+        len = strlen(de->d_name);
+
+        if (d->depth == cpi_nlevels) {
+
+            /* cache files are named by hex MD5 of their keys */
+
+            if (len != 2 * CPI_KEY_LEN
+                || cpi_hex(NULL, de->d_name, len) != 0)
+            {
+                continue;
+            }
+
+            rc = cpi_file(w, dirfd(dir), de->d_name);
+
+            if (rc != 0) {
+                break;
+            }
+
+            continue;
+        }
+
+        /* names of levels are last characters of the MD5 */
+
+        if (len != cpi_levels[d->depth] || cpi_hex(NULL, de->d_name, len) != 0)
+        {
+            continue;
+        }
+
+        path = malloc(plen + 1 + len + 1);
+        if (path == NULL) {
+            rc = -1;
+            break;
+        }
+
+        sprintf(path, "%s/%s", d->path, de->d_name);
+
+        pthread_mutex_lock(&cpi_mutex);
+        rc = cpi_push(path, d->depth + 1);
+        pthread_mutex_unlock(&cpi_mutex);
+
+        if (rc != 0) {
+            free(path);
+            break;
+        }
+    }
+
+    closedir(dir);
+
+    return rc;
+}
+
+
+static void *
+cpi_worker(void *data)
+{
+    cpi_worker_t  *w = data;
+    cpi_dir_t      d;
+    int            rc;
+
+    rc = 0;
+
+    pthread_mutex_lock(&cpi_mutex);
+
+    for ( ;; ) {
+
+        while (cpi_ndirs == 0 && cpi_active && !cpi_failed) {
+            pthread_cond_wait(&cpi_cond, &cpi_mutex);
+        }
+
+        if (cpi_ndirs == 0 || cpi_failed) {
+            /* nothing left to walk, and nobody to add more */
+            break;
+        }
+
+        d = cpi_dirs[--cpi_ndirs];
+        cpi_active++;
+
+        pthread_mutex_unlock(&cpi_mutex);
+
+        rc = cpi_dir(w, &d);
+
+        free(d.path);
+
+        pthread_mutex_lock(&cpi_mutex);
+
+        cpi_active--;
+
+        if (rc != 0) {
+            cpi_failed = 1;
+        }
+
+        if (cpi_active == 0 || cpi_failed) {
+            pthread_cond_broadcast(&cpi_cond);
+        }
+    }
+
+    pthread_cond_broadcast(&cpi_cond);
+    pthread_mutex_unlock(&cpi_mutex);
+
+    if (rc != 0) {
+        fprintf(stderr, "ngx_cache_purge_index: out of memory\n");
+    }
+
+    return NULL;
+}
+
+
+static int
+cpi_cmp(const void *one, const void *two)
+{
+    const ngx_http_cache_purge_index_entry_t  *a = one, *b = two;
+    size_t                                     len;
+    int                                        rc;
+
+    len = (a->key_len < b->key_len) ? a->key_len : b->key_len;
+
+    rc = memcmp(&cpi_sort_keys[a->key], &cpi_sort_keys[b->key], len);
+
+    if (rc == 0 && a->key_len != b->key_len) {
+        rc = (a->key_len < b->key_len) ? -1 : 1;
+    }
+
+    if (rc == 0) {
+        /* variants of the same key */
+        rc = memcmp(a->hash, b->hash, CPI_KEY_LEN);
+    }
+
+    return rc;
+}
+
+
+/*
+ * CRC-32 as ngx_crc32_long(), so that the module can check the index
+ */
+
+static void
+cpi_crc32_init(void)
+{
+    uint32_t  c;
+    int       i, k;
+
+    for (i = 0; i < 256; i++) {
+        c = i;
+
+        for (k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        }
+
+        cpi_crc32_table[i] = c;
+    }
+}
+
+
+static uint32_t
+cpi_crc32_update(uint32_t crc, const void *data, size_t len)
+{
+    const unsigned char  *p = data;
+
+    while (len--) {
+        crc = cpi_crc32_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+
+static int
+cpi_write(const char *file, ngx_http_cache_purge_index_entry_t *entries,
+    uint64_t n, const char *keys, uint64_t keys_len)
+{
+    ngx_http_cache_purge_index_header_t  h;
+    uint32_t                             crc;
+    size_t                               len;
+    char                                *tmp;
+    FILE                                *f;
+
+    len = strlen(file);
+
+    tmp = malloc(len + sizeof(".tmp"));
+    if (tmp == NULL) {
+        return -1;
+    }
+
+    sprintf(tmp, "%s.tmp", file);
+
+    cpi_crc32_init();
+
+    crc = 0xffffffff;
+    crc = cpi_crc32_update(crc, entries,
+                           n * sizeof(ngx_http_cache_purge_index_entry_t));
+    crc = cpi_crc32_update(crc, keys, keys_len);
+
+    memset(&h, 0, sizeof(ngx_http_cache_purge_index_header_t));
+    memcpy(h.magic, NGX_HTTP_CACHE_PURGE_INDEX_MAGIC, sizeof(h.magic));
+    h.version = NGX_HTTP_CACHE_PURGE_INDEX_VERSION;
+    h.crc32 = crc ^ 0xffffffff;
+    h.generation = time(NULL);
+    h.entries = n;
+    h.keys = keys_len;
+
+    /* the index is replaced atomically, it might be mapped already */
+
+    f = fopen(tmp, "w");
+
+    if (f == NULL) {
+        fprintf(stderr, "ngx_cache_purge_index: fopen(\"%s\") failed: %s\n",
+                tmp, strerror(errno));
+        free(tmp);
+        return -1;
+    }
+
+    if (fwrite(&h, sizeof(h), 1, f) != 1
+        || (n && fwrite(entries, sizeof(ngx_http_cache_purge_index_entry_t),
+                        n, f) != n)
+        || (keys_len && fwrite(keys, keys_len, 1, f) != 1)
+        || fflush(f) != 0
+        || fsync(fileno(f)) != 0)
+    {
+        fprintf(stderr, "ngx_cache_purge_index: write to \"%s\" failed: %s\n",
+                tmp, strerror(errno));
+        fclose(f);
+        unlink(tmp);
+        free(tmp);
+        return -1;
+    }
+
+    fclose(f);
+
+    if (rename(tmp, file) != 0) {
+        fprintf(stderr, "ngx_cache_purge_index: rename(\"%s\", \"%s\")"
+                " failed: %s\n", tmp, file, strerror(errno));
+        unlink(tmp);
+        free(tmp);
+        return -1;
+    }
+
+    free(tmp);
+
+    return 0;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    ngx_http_cache_purge_index_entry_t  *entries, *e;
+    struct timeval                       start, end;
+    cpi_worker_t                        *workers, *w;
+    uint64_t                             n, keys_len, skipped, errors, size;
+    const char                          *index;
+    char                                *keys, *path;
+    long                                 threads;
+    int                                  c, i;
+    size_t                               k;
+
+    index = NULL;
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    cpi_nlevels = 0;
+
+    while ((c = getopt(argc, argv, "t:l:o:h")) != -1) {
+        switch (c) {
+
+        case 't':
+            threads = strtol(optarg, NULL, 10);
+            if (threads < 1 || threads > CPI_MAX_THREADS) {
+                fprintf(stderr, "ngx_cache_purge_index: invalid number"
+                        " of threads \"%s\"\n", optarg);
+                return 2;
+            }
+            break;
+
+        case 'l':
+            if (cpi_parse_levels(optarg) != 0) {
+                fprintf(stderr, "ngx_cache_purge_index: invalid levels"
+                        " \"%s\"\n", optarg);
+                return 2;
+            }
+            break;
+
+        case 'o':
+            index = optarg;
+            break;
+
+        default:
+            cpi_usage();
+            return 2;
+        }
+    }
+
+    if (index == NULL || optind != argc - 1) {
+        cpi_usage();
+        return 2;
+    }
+
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    gettimeofday(&start, NULL);
+
+    path = strdup(argv[optind]);
+    if (path == NULL || cpi_push(path, 0) != 0) {
+        fprintf(stderr, "ngx_cache_purge_index: out of memory\n");
+        return 1;
+    }
+
+    workers = calloc(threads, sizeof(cpi_worker_t));
+    if (workers == NULL) {
+        fprintf(stderr, "ngx_cache_purge_index: out of memory\n");
+        return 1;
+    }
+
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&workers[i].tid, NULL, cpi_worker, &workers[i])
+            != 0)
+        {
+            fprintf(stderr, "ngx_cache_purge_index: pthread_create()"
+                    " failed\n");
+            return 1;
+        }
+    }
+
+    n = 0;
+    keys_len = 0;
+    skipped = 0;
+    errors = 0;
+
+    for (i = 0; i < threads; i++) {
+        pthread_join(workers[i].tid, NULL);
+
+        n += workers[i].nentries;
+        keys_len += workers[i].keys_len;
+        skipped += workers[i].skipped;
+        errors += workers[i].errors;
+    }
+
+    if (cpi_failed) {
+        return 1;
+    }
+
+    /* entries of all threads, with keys offsets into the merged keys */
+
+    entries = malloc(n ? n * sizeof(ngx_http_cache_purge_index_entry_t) : 1);
+    keys = malloc(keys_len ? keys_len : 1);
+
+    if (entries == NULL || keys == NULL) {
+        fprintf(stderr, "ngx_cache_purge_index: out of memory\n");
+        return 1;
+    }
+
+    e = entries;
+    k = 0;
+    size = 0;
+
+    for (i = 0; i < threads; i++) {
+        w = &workers[i];
+
+        memcpy(e, w->entries,
+               w->nentries * sizeof(ngx_http_cache_purge_index_entry_t));
+        memcpy(&keys[k], w->keys, w->keys_len);
+
+        while (w->nentries--) {
+            e->key += k;
+            size += e->size;
+            e++;
+        }
+
+        k += w->keys_len;
+
+        free(w->entries);
+        free(w->keys);
+    }
+
+    free(workers);
+
+    cpi_sort_keys = keys;
+    qsort(entries, n, sizeof(ngx_http_cache_purge_index_entry_t), cpi_cmp);
+
+    if (cpi_write(index, entries, n, keys, keys_len) != 0) {
+        return 1;
+    }
+
+    gettimeofday(&end, NULL);
+
+    fprintf(stderr, "ngx_cache_purge_index: %llu entries, %llu bytes,"
+            " %llu skipped, %llu errors in %.3fs\n",
+            (unsigned long long) n, (unsigned long long) size,
+            (unsigned long long) skipped, (unsigned long long) errors,
+            (end.tv_sec - start.tv_sec)
+            + (end.tv_usec - start.tv_usec) / 1000000.0);
+
+    return errors ? 1 : 0;
+}